@@ -1,9 +1,15 @@
 use crate::parse::CommandLine;
 use crate::config::SERVER_CONFIG;
+use crate::grpc::scheduler_service_client::SchedulerServiceClient;
+use crate::grpc::{
+    Fuzzer, FuzzerType, GetSeedsRequest, PutCoverageRequest, PutSeedRequest, RegisterRequest,
+    Seed, SeedType, SubscribeSeedsRequest, SubscribeSeedsResponse,
+};
 
 use anyhow::{anyhow, Context, Result, bail, format_err};
 use log::{info, warn, error, debug};
 use futures::future::try_join_all;
+use futures::{SinkExt, StreamExt};
 use std::num::Wrapping;
 use std::process::ExitStatus;
 use async_trait::async_trait;
@@ -19,11 +25,15 @@ use std::{
     fmt::Debug,
     process::Stdio,
     path::{Path, PathBuf},
-    sync::Arc,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc,
+    },
 };
 use tempfile::{tempdir_in, TempDir};
 use tokio::{
-    io::{AsyncBufReadExt, BufReader},
+    io::{AsyncBufReadExt, AsyncReadExt, AsyncWriteExt, BufReader},
+    net::{unix::{OwnedReadHalf, OwnedWriteHalf}, UnixListener, UnixStream},
     sync::{mpsc, Notify},
     time::{sleep, Duration, Instant},
 };
@@ -32,8 +42,22 @@ use tempfile::tempdir;
 use uuid::Uuid;
 use tokio::process::{Child, Command};
 use serde::Serialize;
+use tonic::codec::Streaming;
+use tonic::transport::Channel;
 // use std::process::Command;
 
+// -sync_socket 帧类型, 见 libfuzzer/FuzzerSync.h
+const SYNC_PUT_SEED: u8 = 2;
+const SYNC_SEED: u8 = 3;
+const SYNC_COVERAGE: u8 = 4;
+const SYNC_SHA1_SIZE: usize = 20;
+// 与 libfuzzer 的 kMaxSyncFrameSize 相同
+const MAX_SYNC_FRAME_SIZE: usize = 1 << 28;
+// 轮询其他模糊器种子 (GetSeeds) 的间隔
+const SYNC_POLL_INTERVAL: Duration = Duration::from_secs(1);
+// 等待上传的种子数, 满了之后不再读取 libfuzzer 的帧, libfuzzer 随之丢弃新种子
+const PUT_SEEDS_QUEUE: usize = 256;
+
 
 /// c/c++语言的libfuzzer
 pub async fn run_fuzzer(opt: &CommandLine){
@@ -119,25 +143,289 @@ impl LibFuzzerFuzzTask {
         Ok(())
     }
 
-    /// 运行单个 fuzzer 进程
+    /// 运行单个 fuzzer 进程, 直到它退出
     async fn run_fuzzer(&self, worker_id: usize) -> Result<()> {
         println!("outcome: {:?}", self.runtime_stats.execs_sec);
-        let mut running = self.fuzz_cmd(self.runtime_stats.cmd.as_str()).await;
 
-        println!("child is: {:?}", running);
+        // libfuzzer 通过 -sync_socket 连接到这里, 由客户端转发种子
+        let sync_socket = std::env::temp_dir()
+            .join(format!("libfuzzer-sync-{}.sock", self.runtime_stats.run_id));
+        let _ = std::fs::remove_file(&sync_socket);
+        let listener = UnixListener::bind(&sync_socket)
+            .with_context(|| format_err!("failed to bind {:?}", sync_socket))?;
+        let sync = tokio::spawn(async move {
+            if let Err(e) = sync_seeds(listener).await {
+                error!("seed sync stopped: {:?}", e);
+            }
+        });
 
-        // 实现具体的 fuzzer 运行逻辑
+        // 同步任务随 libfuzzer 一起运行, libfuzzer 退出后再停止
+        let status = match self.fuzz_cmd(self.runtime_stats.cmd.as_str(), &sync_socket).await {
+            Ok(mut child) => child.wait().await.map_err(Into::into),
+            Err(e) => Err(e),
+        };
+        sync.abort();
+        let _ = std::fs::remove_file(&sync_socket);
+        let status = status?;
+        println!("libfuzzer exited: {:?}", status);
         Ok(())
     }
 
-    async fn fuzz_cmd(&self, cmd: &str) -> Result<Child> {
+    async fn fuzz_cmd(&self, cmd: &str, sync_socket: &Path) -> Result<Child> {
         println!("Running command: {:?}", &cmd);
 
-        let child = Command::new(cmd)
+        let mut args = cmd.split_whitespace();
+        let program = args.next().ok_or_else(|| anyhow!("empty command"))?;
+        let child = Command::new(program)
+            .args(args)
+            .arg(format!("-sync_socket={}", sync_socket.display()))
             .spawn()
             .with_context(|| format_err!("libfuzzer failed to start."))?;
 
         Ok(child)
     }
 
-}
\ No newline at end of file
+}
+
+/// 在 libfuzzer 与调度服务端之间转发种子:
+/// libfuzzer 的新种子经 PutSeeds 流上传, 其他模糊器的种子经 SubscribeSeeds 流下发.
+/// 服务端不支持流式接口时退回 PutSeed 和 GetSeeds 轮询.
+/// 每个连接单独处理: -fork 和 -jobs 的每个 libfuzzer 进程都会连接到这里.
+/// 连接断开后等待 libfuzzer 重连.
+async fn sync_seeds(listener: UnixListener) -> Result<()> {
+    let addr = format!("http://{}", SERVER_CONFIG.get().unwrap().server_addr);
+    let mut client = SchedulerServiceClient::connect(addr).await?;
+    let request = RegisterRequest {
+        fuzzer: Some(Fuzzer {
+            fuzzer_type: FuzzerType::FuzzerLibfuzzer as i32,
+            ..Default::default()
+        }),
+        ..Default::default()
+    };
+    let fuzzer_id = client.register(request).await?.into_inner().fuzzer_id;
+    // 已收到的最新种子编号, 新连接从这里开始订阅
+    let sync_seed_id = Arc::new(AtomicU64::new(0));
+    loop {
+        let (stream, _) = listener.accept().await?;
+        info!("libfuzzer connected to the sync socket");
+        let client = client.clone();
+        let sync_seed_id = sync_seed_id.clone();
+        tokio::spawn(async move {
+            if let Err(e) = sync_connection(stream, client, fuzzer_id, sync_seed_id).await {
+                warn!("sync connection closed: {:?}", e);
+            }
+        });
+    }
+}
+
+/// 为一个 libfuzzer 进程转发种子, 任一方向出错都断开连接
+async fn sync_connection(
+    stream: UnixStream,
+    mut client: SchedulerServiceClient<Channel>,
+    fuzzer_id: u64,
+    last_seed_id: Arc<AtomicU64>,
+) -> Result<()> {
+    let (rd, wr) = stream.into_split();
+    let (tx, rx) = futures::channel::mpsc::channel(PUT_SEEDS_QUEUE);
+    let queue: SeedQueue = Arc::new(tokio::sync::Mutex::new(rx));
+    let mut sync_seed_id = last_seed_id.load(Ordering::Relaxed);
+    let subscription = client
+        .subscribe_seeds(SubscribeSeedsRequest { fuzzer_id, sync_seed_id })
+        .await;
+    let result = match subscription {
+        Ok(subscription) => {
+            let mut put_client = client.clone();
+            tokio::select! {
+                r = read_frames(rd, client.clone(), fuzzer_id, tx) => r,
+                r = put_client.put_seeds(queued_seeds(queue.clone())) => {
+                    r.map(|_| ()).map_err(Into::into)
+                }
+                r = write_subscribed_seeds(wr, subscription.into_inner(), &mut sync_seed_id) => r,
+            }
+        }
+        Err(status) if status.code() == tonic::Code::Unimplemented => {
+            debug!("SubscribeSeeds is not supported, polling GetSeeds");
+            tokio::select! {
+                r = read_frames(rd, client.clone(), fuzzer_id, tx) => r,
+                r = put_seeds_one_by_one(queued_seeds(queue.clone()), client.clone()) => r,
+                r = poll_seeds(wr, client.clone(), fuzzer_id, &mut sync_seed_id) => r,
+            }
+        }
+        Err(status) => Err(status.into()),
+    };
+    last_seed_id.fetch_max(sync_seed_id, Ordering::Relaxed);
+    // libfuzzer 已把队列中的种子算作发送, 不会重发: 逐个提交.
+    // 服务端不可用时这些种子只留在 libfuzzer 的语料库中
+    let mut rx = queue.lock().await;
+    while let Ok(Some(request)) = rx.try_next() {
+        if let Err(e) = client.put_seed(request).await {
+            warn!("dropping the queued seeds: {:?}", e);
+            break;
+        }
+    }
+    result
+}
+
+/// 等待上传的种子, 连接断开后还要取出剩下的种子
+type SeedQueue = Arc<tokio::sync::Mutex<futures::channel::mpsc::Receiver<PutSeedRequest>>>;
+
+/// 队列中的种子, 作为 PutSeeds 的请求流
+fn queued_seeds(queue: SeedQueue) -> impl futures::Stream<Item = PutSeedRequest> + Send + 'static {
+    futures::stream::unfold(queue, |queue| async move {
+        let seed = queue.lock().await.next().await;
+        seed.map(|seed| (seed, queue))
+    })
+}
+
+/// 读取 libfuzzer 的帧: 新种子送入 seeds, 队列满时等待;
+/// 覆盖率增量直接上传
+async fn read_frames(
+    mut rd: OwnedReadHalf,
+    mut client: SchedulerServiceClient<Channel>,
+    fuzzer_id: u64,
+    mut seeds: futures::channel::mpsc::Sender<PutSeedRequest>,
+) -> Result<()> {
+    let mut header = [0u8; 5];
+    loop {
+        rd.read_exact(&mut header).await?;
+        let size = u32::from_le_bytes([header[0], header[1], header[2], header[3]]) as usize;
+        if size > MAX_SYNC_FRAME_SIZE {
+            bail!("sync frame of {} bytes", size);
+        }
+        let mut payload = vec![0u8; size];
+        rd.read_exact(&mut payload).await?;
+        if header[4] == SYNC_COVERAGE {
+            put_coverage(&mut client, fuzzer_id, &payload).await?;
+            continue;
+        }
+        if header[4] != SYNC_PUT_SEED || size < SYNC_SHA1_SIZE {
+            continue;
+        }
+        let (features, data) = parse_sync_seed(&payload[SYNC_SHA1_SIZE..])?;
+        let seed = Seed {
+            seed_type: SeedType::New as i32,
+            length: data.len() as u64,
+            fuzzer_id,
+            data: data.to_vec(),
+            has_new_cov: 1,
+            features: features.to_vec(),
+            ..Default::default()
+        };
+        // 服务端慢时在这里等待, 不再读取帧: libfuzzer 的发送队列满后丢弃新种子,
+        // 模糊测试不会被阻塞
+        seeds.send(PutSeedRequest { fuzzer_id, seed: Some(seed) }).await?;
+    }
+}
+
+/// 旧的服务端: 逐个提交种子
+async fn put_seeds_one_by_one(
+    seeds: impl futures::Stream<Item = PutSeedRequest>,
+    mut client: SchedulerServiceClient<Channel>,
+) -> Result<()> {
+    let mut seeds = Box::pin(seeds);
+    while let Some(request) = seeds.next().await {
+        client.put_seed(request).await?;
+    }
+    Ok(())
+}
+
+/// 上传覆盖率增量: varint 起始版本, varint 版本, 增量编码原样转发
+async fn put_coverage(
+    client: &mut SchedulerServiceClient<Channel>,
+    fuzzer_id: u64,
+    payload: &[u8],
+) -> Result<()> {
+    let mut pos = 0;
+    let base_epoch = read_varint(payload, &mut pos)?;
+    let epoch = read_varint(payload, &mut pos)?;
+    client
+        .put_coverage(PutCoverageRequest {
+            fuzzer_id,
+            coverage_delta: payload[pos..].to_vec(),
+            base_epoch,
+            epoch,
+            ..Default::default()
+        })
+        .await?;
+    Ok(())
+}
+
+/// 把订阅到的种子发给 libfuzzer. libfuzzer 来不及执行时停止读取套接字,
+/// 这里随之阻塞, 不再读取流, 由 gRPC 流控让服务端暂停推送
+async fn write_subscribed_seeds(
+    mut wr: OwnedWriteHalf,
+    mut subscription: Streaming<SubscribeSeedsResponse>,
+    sync_seed_id: &mut u64,
+) -> Result<()> {
+    while let Some(batch) = subscription.message().await? {
+        for seed in batch.seeds {
+            *sync_seed_id = (*sync_seed_id).max(seed.id);
+            wr.write_all(&sync_seed_frame(&seed)).await?;
+        }
+    }
+    bail!("the seed subscription ended")
+}
+
+/// 旧的服务端: 轮询其他模糊器的种子并发给 libfuzzer
+async fn poll_seeds(
+    mut wr: OwnedWriteHalf,
+    mut client: SchedulerServiceClient<Channel>,
+    fuzzer_id: u64,
+    sync_seed_id: &mut u64,
+) -> Result<()> {
+    loop {
+        let seeds = client
+            .get_seeds(GetSeedsRequest { fuzzer_id, sync_seed_id: *sync_seed_id })
+            .await?
+            .into_inner()
+            .seeds;
+        for seed in seeds {
+            *sync_seed_id = (*sync_seed_id).max(seed.id);
+            if seed.fuzzer_id == fuzzer_id {
+                continue;
+            }
+            wr.write_all(&sync_seed_frame(&seed)).await?;
+        }
+        sleep(SYNC_POLL_INTERVAL).await;
+    }
+}
+
+/// 种子的 SYNC_SEED 帧. 特征无法解析时不发送特征, libfuzzer 总会执行这样的种子
+fn sync_seed_frame(seed: &Seed) -> Vec<u8> {
+    let features: &[u8] = match parse_sync_seed(&seed.features) {
+        Ok((features, rest)) if !seed.features.is_empty() && rest.is_empty() => features,
+        _ => &[0],
+    };
+    let size = features.len() + seed.data.len();
+    let mut frame = Vec::with_capacity(size + 5);
+    frame.extend_from_slice(&(size as u32).to_le_bytes());
+    frame.push(SYNC_SEED);
+    frame.extend_from_slice(features);
+    frame.extend_from_slice(&seed.data);
+    frame
+}
+
+/// 解析种子: varint 特征数, varint 特征差值, 种子数据.
+/// 返回 (特征部分, 种子数据)
+fn parse_sync_seed(payload: &[u8]) -> Result<(&[u8], &[u8])> {
+    let mut pos = 0;
+    let num_features = read_varint(payload, &mut pos)?;
+    for _ in 0..num_features {
+        read_varint(payload, &mut pos)?;
+    }
+    Ok(payload.split_at(pos))
+}
+
+/// 读取 data[*pos..] 处的 varint
+fn read_varint(data: &[u8], pos: &mut usize) -> Result<u64> {
+    let mut v = 0u64;
+    for shift in (0..64).step_by(7) {
+        let b = *data.get(*pos).ok_or_else(|| anyhow!("truncated varint"))?;
+        *pos += 1;
+        v |= u64::from(b & 0x7f) << shift;
+        if b & 0x80 == 0 {
+            return Ok(v);
+        }
+    }
+    bail!("varint too long")
+}
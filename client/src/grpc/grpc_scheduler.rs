@@ -143,6 +143,10 @@ pub struct Seed {
     /// 是否存在新覆盖边
     #[prost(uint64, tag = "7")]
     pub has_new_cov: u64,
+    /// 只有该种子覆盖的特征: varint 个数 + 排序后的 varint 差值 (同 libfuzzer/FuzzerSync.h)
+    /// 接收方已有全部特征时可以不执行该种子. 为空表示未知
+    #[prost(bytes = "vec", tag = "8")]
+    pub features: ::prost::alloc::vec::Vec<u8>,
 }
 /// 获取种子消息 - 向服务端提供fuzzer_id
 #[allow(clippy::derive_partial_eq_without_eq)]
@@ -185,6 +189,36 @@ pub struct PutSeedResponse {
     #[prost(bool, tag = "1")]
     pub success: bool,
 }
+/// 批量提交种子 - 响应, 流结束后返回
+#[allow(clippy::derive_partial_eq_without_eq)]
+#[derive(Clone, PartialEq, ::prost::Message)]
+pub struct PutSeedsResponse {
+    /// 是否成功
+    #[prost(bool, tag = "1")]
+    pub success: bool,
+    /// 服务端收到的种子数
+    #[prost(uint64, tag = "2")]
+    pub num_seeds: u64,
+}
+/// 订阅种子 - 请求
+#[allow(clippy::derive_partial_eq_without_eq)]
+#[derive(Clone, PartialEq, ::prost::Message)]
+pub struct SubscribeSeedsRequest {
+    /// 模糊器编号
+    #[prost(uint64, tag = "1")]
+    pub fuzzer_id: u64,
+    /// 推送该同步种子id之后的种子, 同 GetSeedsRequest. 重连时填收到的最大 Seed.id
+    #[prost(uint64, tag = "2")]
+    pub sync_seed_id: u64,
+}
+/// 订阅种子 - 推送的一批种子, 不含订阅者自己的种子
+#[allow(clippy::derive_partial_eq_without_eq)]
+#[derive(Clone, PartialEq, ::prost::Message)]
+pub struct SubscribeSeedsResponse {
+    /// 种子数组
+    #[prost(message, repeated, tag = "1")]
+    pub seeds: ::prost::alloc::vec::Vec<Seed>,
+}
 /// 覆盖率结构
 #[allow(clippy::derive_partial_eq_without_eq)]
 #[derive(Clone, PartialEq, ::prost::Message)]
@@ -207,6 +241,16 @@ pub struct PutCoverageRequest {
     /// 覆盖率原因: 种子类型
     #[prost(uint32, tag = "3")]
     pub seed_type: u32,
+    /// 覆盖率增量: base_epoch 之后新增的特征, 编码见 libfuzzer/FuzzerCoverageDelta.h
+    /// 非空时代替 bitmap
+    #[prost(bytes = "vec", tag = "4")]
+    pub coverage_delta: ::prost::alloc::vec::Vec<u8>,
+    /// 增量的起始版本, 0 表示全部覆盖率. 与服务端已知的版本不符时应丢弃
+    #[prost(uint64, tag = "5")]
+    pub base_epoch: u64,
+    /// 增量之后的版本, 即该模糊器已发现的特征数
+    #[prost(uint64, tag = "6")]
+    pub epoch: u64,
 }
 /// 提交局部覆盖率 - 响应
 #[allow(clippy::derive_partial_eq_without_eq)]
@@ -273,6 +317,9 @@ pub struct GetCoverageRequest {
     /// 模糊器编号
     #[prost(uint64, tag = "1")]
     pub fuzzer_id: u64,
+    /// 客户端已有的全局覆盖率版本, 0 表示没有. 非 0 时只返回之后的增量
+    #[prost(uint64, tag = "2")]
+    pub known_epoch: u64,
 }
 /// 获取全局覆盖率 - 响应
 #[allow(clippy::derive_partial_eq_without_eq)]
@@ -284,6 +331,15 @@ pub struct GetCoverageResponse {
     /// 全员覆盖率位图
     #[prost(bytes = "vec", tag = "2")]
     pub coverage_data: ::prost::alloc::vec::Vec<u8>,
+    /// 全局覆盖率增量: base_epoch 之后新增的特征, 编码同 PutCoverageRequest
+    #[prost(bytes = "vec", tag = "3")]
+    pub coverage_delta: ::prost::alloc::vec::Vec<u8>,
+    /// 增量的起始版本: known_epoch, 或者 known_epoch 已过期时为 0 (全部覆盖率)
+    #[prost(uint64, tag = "4")]
+    pub base_epoch: u64,
+    /// 当前的全局覆盖率版本
+    #[prost(uint64, tag = "5")]
+    pub epoch: u64,
 }
 /// ===================== ixFuzz系列配置 ==================================
 ///
@@ -642,6 +698,60 @@ pub mod scheduler_service_client {
                 .insert(GrpcMethod::new("grpc_scheduler.SchedulerService", "PutSeed"));
             self.inner.unary(req, path, codec).await
         }
+        /// 批量提交种子: 客户端流, 新种子很多时不必逐个往返
+        pub async fn put_seeds(
+            &mut self,
+            request: impl tonic::IntoStreamingRequest<Message = super::PutSeedRequest>,
+        ) -> std::result::Result<
+            tonic::Response<super::PutSeedsResponse>,
+            tonic::Status,
+        > {
+            self.inner
+                .ready()
+                .await
+                .map_err(|e| {
+                    tonic::Status::new(
+                        tonic::Code::Unknown,
+                        format!("Service was not ready: {}", e.into()),
+                    )
+                })?;
+            let codec = tonic::codec::ProstCodec::default();
+            let path = http::uri::PathAndQuery::from_static(
+                "/grpc_scheduler.SchedulerService/PutSeeds",
+            );
+            let mut req = request.into_streaming_request();
+            req.extensions_mut()
+                .insert(GrpcMethod::new("grpc_scheduler.SchedulerService", "PutSeeds"));
+            self.inner.client_streaming(req, path, codec).await
+        }
+        /// 订阅其他模糊器的种子: 服务端流, 代替 GetSeeds 轮询
+        pub async fn subscribe_seeds(
+            &mut self,
+            request: impl tonic::IntoRequest<super::SubscribeSeedsRequest>,
+        ) -> std::result::Result<
+            tonic::Response<tonic::codec::Streaming<super::SubscribeSeedsResponse>>,
+            tonic::Status,
+        > {
+            self.inner
+                .ready()
+                .await
+                .map_err(|e| {
+                    tonic::Status::new(
+                        tonic::Code::Unknown,
+                        format!("Service was not ready: {}", e.into()),
+                    )
+                })?;
+            let codec = tonic::codec::ProstCodec::default();
+            let path = http::uri::PathAndQuery::from_static(
+                "/grpc_scheduler.SchedulerService/SubscribeSeeds",
+            );
+            let mut req = request.into_request();
+            req.extensions_mut()
+                .insert(
+                    GrpcMethod::new("grpc_scheduler.SchedulerService", "SubscribeSeeds"),
+                );
+            self.inner.server_streaming(req, path, codec).await
+        }
         /// 推送初始覆盖率
         pub async fn put_init_coverage(
             &mut self,
@@ -856,6 +966,28 @@ pub mod scheduler_service_server {
             &self,
             request: tonic::Request<super::PutSeedRequest>,
         ) -> std::result::Result<tonic::Response<super::PutSeedResponse>, tonic::Status>;
+        /// 批量提交种子: 客户端流, 新种子很多时不必逐个往返
+        async fn put_seeds(
+            &self,
+            request: tonic::Request<tonic::Streaming<super::PutSeedRequest>>,
+        ) -> std::result::Result<
+            tonic::Response<super::PutSeedsResponse>,
+            tonic::Status,
+        >;
+        /// Server streaming response type for the SubscribeSeeds method.
+        type SubscribeSeedsStream: futures_core::Stream<
+                Item = std::result::Result<super::SubscribeSeedsResponse, tonic::Status>,
+            >
+            + Send
+            + 'static;
+        /// 订阅其他模糊器的种子: 服务端流, 代替 GetSeeds 轮询
+        async fn subscribe_seeds(
+            &self,
+            request: tonic::Request<super::SubscribeSeedsRequest>,
+        ) -> std::result::Result<
+            tonic::Response<Self::SubscribeSeedsStream>,
+            tonic::Status,
+        >;
         /// 推送初始覆盖率
         async fn put_init_coverage(
             &self,
@@ -1212,6 +1344,102 @@ pub mod scheduler_service_server {
                     };
                     Box::pin(fut)
                 }
+                "/grpc_scheduler.SchedulerService/PutSeeds" => {
+                    #[allow(non_camel_case_types)]
+                    struct PutSeedsSvc<T: SchedulerService>(pub Arc<T>);
+                    impl<
+                        T: SchedulerService,
+                    > tonic::server::ClientStreamingService<super::PutSeedRequest>
+                    for PutSeedsSvc<T> {
+                        type Response = super::PutSeedsResponse;
+                        type Future = BoxFuture<
+                            tonic::Response<Self::Response>,
+                            tonic::Status,
+                        >;
+                        fn call(
+                            &mut self,
+                            request: tonic::Request<
+                                tonic::Streaming<super::PutSeedRequest>,
+                            >,
+                        ) -> Self::Future {
+                            let inner = Arc::clone(&self.0);
+                            let fut = async move {
+                                <T as SchedulerService>::put_seeds(&inner, request).await
+                            };
+                            Box::pin(fut)
+                        }
+                    }
+                    let accept_compression_encodings = self.accept_compression_encodings;
+                    let send_compression_encodings = self.send_compression_encodings;
+                    let max_decoding_message_size = self.max_decoding_message_size;
+                    let max_encoding_message_size = self.max_encoding_message_size;
+                    let inner = self.inner.clone();
+                    let fut = async move {
+                        let inner = inner.0;
+                        let method = PutSeedsSvc(inner);
+                        let codec = tonic::codec::ProstCodec::default();
+                        let mut grpc = tonic::server::Grpc::new(codec)
+                            .apply_compression_config(
+                                accept_compression_encodings,
+                                send_compression_encodings,
+                            )
+                            .apply_max_message_size_config(
+                                max_decoding_message_size,
+                                max_encoding_message_size,
+                            );
+                        let res = grpc.client_streaming(method, req).await;
+                        Ok(res)
+                    };
+                    Box::pin(fut)
+                }
+                "/grpc_scheduler.SchedulerService/SubscribeSeeds" => {
+                    #[allow(non_camel_case_types)]
+                    struct SubscribeSeedsSvc<T: SchedulerService>(pub Arc<T>);
+                    impl<
+                        T: SchedulerService,
+                    > tonic::server::ServerStreamingService<super::SubscribeSeedsRequest>
+                    for SubscribeSeedsSvc<T> {
+                        type Response = super::SubscribeSeedsResponse;
+                        type ResponseStream = T::SubscribeSeedsStream;
+                        type Future = BoxFuture<
+                            tonic::Response<Self::ResponseStream>,
+                            tonic::Status,
+                        >;
+                        fn call(
+                            &mut self,
+                            request: tonic::Request<super::SubscribeSeedsRequest>,
+                        ) -> Self::Future {
+                            let inner = Arc::clone(&self.0);
+                            let fut = async move {
+                                <T as SchedulerService>::subscribe_seeds(&inner, request)
+                                    .await
+                            };
+                            Box::pin(fut)
+                        }
+                    }
+                    let accept_compression_encodings = self.accept_compression_encodings;
+                    let send_compression_encodings = self.send_compression_encodings;
+                    let max_decoding_message_size = self.max_decoding_message_size;
+                    let max_encoding_message_size = self.max_encoding_message_size;
+                    let inner = self.inner.clone();
+                    let fut = async move {
+                        let inner = inner.0;
+                        let method = SubscribeSeedsSvc(inner);
+                        let codec = tonic::codec::ProstCodec::default();
+                        let mut grpc = tonic::server::Grpc::new(codec)
+                            .apply_compression_config(
+                                accept_compression_encodings,
+                                send_compression_encodings,
+                            )
+                            .apply_max_message_size_config(
+                                max_decoding_message_size,
+                                max_encoding_message_size,
+                            );
+                        let res = grpc.server_streaming(method, req).await;
+                        Ok(res)
+                    };
+                    Box::pin(fut)
+                }
                 "/grpc_scheduler.SchedulerService/PutInitCoverage" => {
                     #[allow(non_camel_case_types)]
                     struct PutInitCoverageSvc<T: SchedulerService>(pub Arc<T>);
@@ -0,0 +1,132 @@
+//===- FuzzerCompress.cpp - unit compression ------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// LZ4 block format compression, see FuzzerCompress.h.
+//===----------------------------------------------------------------------===//
+// cjc: 语料库内存压缩
+
+#include "FuzzerCompress.h"
+#include <algorithm>
+#include <cstring>
+
+namespace fuzzer {
+
+static const size_t kMinMatch = 4;
+// The format requires the last 5 bytes to be literals and the last match to
+// start at least 12 bytes before the end.
+static const size_t kLastLiterals = 5;
+static const size_t kMatchStartLimit = 12;
+static const size_t kMaxOffset = 65535;
+static const size_t kHashLog = 12;
+
+static uint32_t Read32(const uint8_t *P) {
+  uint32_t V;
+  memcpy(&V, P, sizeof(V));
+  return V;
+}
+
+static size_t HashOf(uint32_t V) {
+  return (V * 2654435761U) >> (32 - kHashLog);
+}
+
+// A length that does not fit into its 4 bits of the token continues in
+// bytes of 255 and a last byte below 255.
+static void AppendLengthTail(size_t Len, Unit *Out) {
+  for (Len -= 15; Len >= 255; Len -= 255)
+    Out->push_back(255);
+  Out->push_back(static_cast<uint8_t>(Len));
+}
+
+static void AppendSequence(const uint8_t *Literals, size_t NumLiterals,
+                           size_t Offset, size_t MatchLen, Unit *Out) {
+  size_t MatchCode = MatchLen ? MatchLen - kMinMatch : 0;
+  Out->push_back(static_cast<uint8_t>(std::min<size_t>(NumLiterals, 15) << 4 |
+                                      std::min<size_t>(MatchCode, 15)));
+  if (NumLiterals >= 15)
+    AppendLengthTail(NumLiterals, Out);
+  Out->insert(Out->end(), Literals, Literals + NumLiterals);
+  if (!MatchLen)
+    return;  // The last sequence has no match.
+  Out->push_back(static_cast<uint8_t>(Offset));
+  Out->push_back(static_cast<uint8_t>(Offset >> 8));
+  if (MatchCode >= 15)
+    AppendLengthTail(MatchCode, Out);
+}
+
+void CompressUnit(const uint8_t *Data, size_t Size, Unit *Out) {
+  uint32_t Table[1 << kHashLog] = {};  // Position + 1 of the last occurrence.
+  size_t Anchor = 0, Pos = 0;
+  while (Pos + kMatchStartLimit <= Size) {
+    uint32_t V = Read32(Data + Pos);
+    size_t H = HashOf(V);
+    size_t Cand = Table[H];
+    Table[H] = static_cast<uint32_t>(Pos + 1);
+    if (!Cand || Pos - (Cand - 1) > kMaxOffset ||
+        Read32(Data + Cand - 1) != V) {
+      Pos++;
+      continue;
+    }
+    Cand--;
+    size_t Len = kMinMatch;
+    while (Pos + Len < Size - kLastLiterals &&
+           Data[Cand + Len] == Data[Pos + Len])
+      Len++;
+    AppendSequence(Data + Anchor, Pos - Anchor, Pos - Cand, Len, Out);
+    Pos += Len;
+    Anchor = Pos;
+  }
+  AppendSequence(Data + Anchor, Size - Anchor, 0, 0, Out);
+}
+
+static bool ReadLengthTail(const uint8_t **P, const uint8_t *End,
+                           size_t *Len) {
+  uint8_t B;
+  do {
+    if (*P == End)
+      return false;
+    B = *(*P)++;
+    *Len += B;
+  } while (B == 255);
+  return true;
+}
+
+bool DecompressUnit(const uint8_t *Data, size_t Size, size_t UnitSize,
+                    Unit *U) {
+  U->resize(UnitSize);
+  const uint8_t *P = Data, *End = Data + Size;
+  size_t Pos = 0;
+  while (P < End) {
+    uint8_t Token = *P++;
+    size_t NumLiterals = Token >> 4;
+    if (NumLiterals == 15 && !ReadLengthTail(&P, End, &NumLiterals))
+      return false;
+    if (NumLiterals > static_cast<size_t>(End - P) ||
+        NumLiterals > UnitSize - Pos)
+      return false;
+    memcpy(U->data() + Pos, P, NumLiterals);
+    P += NumLiterals;
+    Pos += NumLiterals;
+    if (P == End)
+      break;  // The last sequence.
+    if (End - P < 2)
+      return false;
+    size_t Offset = P[0] | (P[1] << 8);
+    P += 2;
+    size_t MatchLen = Token & 15;
+    if (MatchLen == 15 && !ReadLengthTail(&P, End, &MatchLen))
+      return false;
+    MatchLen += kMinMatch;
+    if (!Offset || Offset > Pos || MatchLen > UnitSize - Pos)
+      return false;
+    // Byte by byte: the match may overlap the bytes it produces.
+    for (size_t i = 0; i < MatchLen; i++, Pos++)
+      (*U)[Pos] = (*U)[Pos - Offset];
+  }
+  return Pos == UnitSize;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,33 @@
+//===- FuzzerCompress.h - Internal header for the Fuzzer --------*- C++ -* ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// Unit compression.
+//
+// A small compressor that writes the LZ4 block format (sequences of a token,
+// literals, a 16-bit offset and the match length), so that units can be kept
+// compressed in memory (-compress_corpus=1) without an external dependency.
+// It trades ratio for speed: one hash table probe per position, no lazy
+// matching. The unit size is not stored, the caller keeps it.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_COMPRESS_H
+#define LLVM_FUZZER_COMPRESS_H
+
+#include "FuzzerDefs.h"
+
+namespace fuzzer {
+
+// Appends the compressed Data to Out.
+void CompressUnit(const uint8_t *Data, size_t Size, Unit *Out);
+// Decompresses a block of UnitSize bytes into U. Returns false if the block
+// is malformed or does not decompress to exactly UnitSize bytes.
+bool DecompressUnit(const uint8_t *Data, size_t Size, size_t UnitSize,
+                    Unit *U);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_COMPRESS_H
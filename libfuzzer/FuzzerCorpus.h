@@ -11,15 +11,19 @@
 #ifndef LLVM_FUZZER_CORPUS
 #define LLVM_FUZZER_CORPUS
 
+#include "FuzzerCompress.h"
 #include "FuzzerDataFlowTrace.h"
 #include "FuzzerDefs.h"
 #include "FuzzerIO.h"
+#include "FuzzerMutate.h"
 #include "FuzzerRandom.h"
 #include "FuzzerSHA1.h"
 #include "FuzzerTracePC.h"
+#include "FuzzerWriter.h"
 #include <algorithm>
 #include <bitset>
 #include <chrono>
+#include <list>
 #include <numeric>
 #include <random>
 #include <unordered_set>
@@ -28,6 +32,13 @@ namespace fuzzer {
 
 struct InputInfo {
   Unit U;  // The actual input data.
+  // -compress_corpus=1: the compressed U of an input that was not chosen
+  // recently, U is empty then.
+  Unit Compressed;
+  size_t CompressedUnitSize = 0;
+  bool Incompressible = false;
+  bool IsHot = false;
+  std::list<InputInfo *>::iterator HotPos;
   std::chrono::microseconds TimeOfUnit;
   uint8_t Sha1[kSHA1NumBytes];  // Checksum.
   // Number of features that this input has and no smaller input has.
@@ -42,12 +53,23 @@ struct InputInfo {
   bool HasFocusFunction = false;
   std::vector<uint32_t> UniqFeatureSet;
   std::vector<uint8_t> DataFlowTraceForFocusFunction;
+  MutationMask DataFlowMask;  // Precomputed from the trace above.
+  // Deterministic stage. EffectorMap has '0' for the bytes that did not
+  // change the coverage when flipped; it is empty if all bytes did.
+  DeterministicCursor Deterministic;
+  uint64_t DeterministicBaseHash = 0;
+  std::vector<uint8_t> EffectorMap;
+  MutationMask EffectorMask;
   // Power schedule.
   bool NeedsEnergyUpdate = false;
   double Energy = 0.0;
   double SumIncidence = 0.0;
   std::vector<std::pair<uint32_t, uint16_t>> FeatureFreqs;
 
+  size_t UnitSize() const {
+    return Compressed.empty() ? U.size() : CompressedUnitSize;
+  }
+
   // Delete feature Idx and its frequency from FeatureFreqs.
   bool DeleteFeatureFreq(uint32_t Idx) {
     if (FeatureFreqs.empty())
@@ -176,21 +198,47 @@ public:
   size_t SizeInBytes() const {
     size_t Res = 0;
     for (auto II : Inputs)
-      Res += II->U.size();
+      Res += II->UnitSize();
+    return Res;
+  }
+  // The bytes of the units as they are kept, some of them compressed.
+  size_t SizeInMemory() const {
+    size_t Res = 0;
+    for (auto II : Inputs)
+      Res += II->U.size() + II->Compressed.size();
     return Res;
   }
   size_t NumActiveUnits() const {
     size_t Res = 0;
     for (auto II : Inputs)
-      Res += !II->U.empty();
+      Res += II->UnitSize() != 0;
     return Res;
   }
   size_t MaxInputSize() const {
     size_t Res = 0;
     for (auto II : Inputs)
-        Res = std::max(Res, II->U.size());
+        Res = std::max(Res, II->UnitSize());
     return Res;
   }
+
+  // Keeps all but the MaxHotUnits most recently chosen inputs compressed.
+  void EnableCompression(size_t MaxHotUnits) {
+    // The inputs to mutate and to cross over with are both hot.
+    this->MaxHotUnits = std::max<size_t>(2, MaxHotUnits);
+  }
+
+  // Compresses the least recently used hot inputs beyond MaxHotUnits, so that
+  // the inputs the scheduler picks often stay uncompressed. Must not be called
+  // while an input of the corpus is being mutated: new inputs are hot, and
+  // the inputs of the last mutation stay in use until the next one is chosen.
+  void CompressColdUnits() {
+    while (HotUnits.size() > MaxHotUnits) {
+      InputInfo &Cold = *HotUnits.back();
+      HotUnits.pop_back();
+      Cold.IsHot = false;
+      Compress(Cold);
+    }
+  }
   void IncrementNumExecutedMutations() { NumExecutedMutations++; }
 
   size_t NumInputsThatTouchFocusFunction() {
@@ -220,6 +268,7 @@ public:
     Inputs.push_back(new InputInfo());
     InputInfo &II = *Inputs.back();
     II.U = U;
+    MakeHot(II);
     II.NumFeatures = NumFeatures;
     II.NeverReduce = NeverReduce;
     II.TimeOfUnit = TimeOfUnit;
@@ -240,8 +289,12 @@ public:
     // This is a gross heuristic.
     // Ideally, when we add an element to a corpus we need to know its DFT.
     // But if we don't, we'll use the DFT of its base input.
-    if (II.DataFlowTraceForFocusFunction.empty() && BaseII)
+    if (II.DataFlowTraceForFocusFunction.empty() && BaseII) {
       II.DataFlowTraceForFocusFunction = BaseII->DataFlowTraceForFocusFunction;
+      II.DataFlowMask = BaseII->DataFlowMask;
+    } else if (!II.DataFlowTraceForFocusFunction.empty()) {
+      II.DataFlowMask = MutationMask(II.DataFlowTraceForFocusFunction);
+    }
     DistributionNeedsUpdate = true;
     PrintCorpus();
     // ValidateFeatureSet();
@@ -287,13 +340,19 @@ public:
 
   void Replace(InputInfo *II, const Unit &U,
                std::chrono::microseconds TimeOfUnit) {
-    assert(II->U.size() > U.size());
+    assert(II->UnitSize() > U.size());
     Hashes.erase(Sha1ToString(II->Sha1));
     DeleteFile(*II);
     ComputeSHA1(U.data(), U.size(), II->Sha1);
     Hashes.insert(Sha1ToString(II->Sha1));
     II->U = U;
+    Unit().swap(II->Compressed);
+    II->Incompressible = false;
     II->Reduced = true;
+    // The offsets of the deterministic stage refer to the old unit.
+    II->Deterministic.Walk = DeterministicCursor::kDone;
+    II->EffectorMap.clear();
+    II->EffectorMask = MutationMask();
     II->TimeOfUnit = TimeOfUnit;
     DistributionNeedsUpdate = true;
   }
@@ -301,7 +360,9 @@ public:
   bool HasUnit(const Unit &U) { return Hashes.count(Hash(U)); }
   bool HasUnit(const std::string &H) { return Hashes.count(H); }
   InputInfo &ChooseUnitToMutate(Random &Rand) {
+    CompressColdUnits();
     InputInfo &II = *Inputs[ChooseUnitIdxToMutate(Rand)];
+    MakeHot(II);
     assert(!II.U.empty());
     return II;
   }
@@ -311,6 +372,7 @@ public:
       return ChooseUnitToMutate(Rand);
     }
     InputInfo &II = *Inputs[Rand(Inputs.size())];
+    MakeHot(II);
     assert(!II.U.empty());
     return II;
   }
@@ -327,7 +389,7 @@ public:
     for (size_t i = 0; i < Inputs.size(); i++) {
       const auto &II = *Inputs[i];
       Printf("  [% 3zd %s] sz: % 5zd runs: % 5zd succ: % 5zd focus: %d\n", i,
-             Sha1ToString(II.Sha1).c_str(), II.U.size(),
+             Sha1ToString(II.Sha1).c_str(), II.UnitSize(),
              II.NumExecutedMutations, II.NumSuccessfullMutations,
              II.HasFocusFunction);
     }
@@ -347,13 +409,20 @@ public:
 
   void DeleteFile(const InputInfo &II) {
     if (!OutputCorpus.empty() && II.MayDeleteFile)
-      RemoveFile(DirPlusFile(OutputCorpus, Sha1ToString(II.Sha1)));
+      GetAsyncWriter().RemoveFile(
+          DirPlusFile(OutputCorpus, Sha1ToString(II.Sha1)));
   }
 
   void DeleteInput(size_t Idx) {
     InputInfo &II = *Inputs[Idx];
     DeleteFile(II);
     Unit().swap(II.U);
+    Unit().swap(II.Compressed);
+    if (II.IsHot)
+      HotUnits.erase(II.HotPos);
+    II.IsHot = false;
+    std::vector<uint8_t>().swap(II.EffectorMap);
+    II.EffectorMask = MutationMask();
     II.Energy = 0.0;
     II.NeedsEnergyUpdate = false;
     DistributionNeedsUpdate = true;
@@ -429,6 +498,7 @@ public:
           DeleteInput(OldIdx);
       } else {
         NumAddedFeatures++;
+        AddedFeatures.push_back(static_cast<uint32_t>(Idx));
         if (Entropic.Enabled)
           AddRareFeature((uint32_t)Idx);
       }
@@ -467,6 +537,19 @@ public:
 
   size_t NumFeatures() const { return NumAddedFeatures; }
   size_t NumFeatureUpdates() const { return NumUpdatedFeatures; }
+  bool HasFeature(uint32_t Idx) const {
+    return GetFeature(Idx % kFeatureSetSize) != 0;
+  }
+
+  // The coverage epoch is the number of features found so far: a peer that
+  // knows the features of an epoch needs only the ones found since.
+  size_t CoverageEpoch() const { return AddedFeatures.size(); }
+  // The features found since Epoch, sorted.
+  void FeaturesSinceEpoch(size_t Epoch, std::vector<uint32_t> *V) const {
+    V->assign(AddedFeatures.begin() + std::min(Epoch, AddedFeatures.size()),
+              AddedFeatures.end());
+    std::sort(V->begin(), V->end());
+  }
 
 private:
 
@@ -488,6 +571,42 @@ private:
     }
   }
 
+  // Decompresses II if needed and makes it the most recently used hot input.
+  void MakeHot(InputInfo &II) {
+    if (!MaxHotUnits)
+      return;
+    if (!II.Compressed.empty()) {
+      if (!DecompressUnit(II.Compressed.data(), II.Compressed.size(),
+                          II.CompressedUnitSize, &II.U)) {
+        Printf("INFO: corrupted compressed unit %s\n",
+               Sha1ToString(II.Sha1).c_str());
+        abort();
+      }
+      Unit().swap(II.Compressed);
+    }
+    if (II.IsHot)
+      HotUnits.erase(II.HotPos);
+    HotUnits.push_front(&II);
+    II.HotPos = HotUnits.begin();
+    II.IsHot = true;
+  }
+
+  void Compress(InputInfo &II) {
+    static const size_t kMinCompressedUnitSize = 64;
+    if (II.Incompressible || II.U.size() < kMinCompressedUnitSize)
+      return;
+    Unit C;
+    CompressUnit(II.U.data(), II.U.size(), &C);
+    // Not worth a decompression per choice if it saves less than 1/8.
+    if (C.size() > II.U.size() - II.U.size() / 8) {
+      II.Incompressible = true;
+      return;
+    }
+    II.Compressed.assign(C.begin(), C.end());  // Without the spare capacity.
+    II.CompressedUnitSize = II.U.size();
+    Unit().swap(II.U);
+  }
+
   // Updates the probability distribution for the units in the corpus.
   // Must be called whenever the corpus or unit weights are changed.
   //
@@ -575,6 +694,7 @@ private:
 
   size_t NumAddedFeatures = 0;
   size_t NumUpdatedFeatures = 0;
+  std::vector<uint32_t> AddedFeatures;  // In the order they were found.
   uint32_t InputSizesPerFeature[kFeatureSetSize];
   uint32_t SmallestElementPerFeature[kFeatureSetSize];
 
@@ -585,6 +705,9 @@ private:
   std::bitset<kFeatureSetSize> IsRareFeature;
 
   std::string OutputCorpus;
+
+  size_t MaxHotUnits = 0;  // 0: no compression.
+  std::list<InputInfo *> HotUnits;  // The most recently used first.
 };
 
 }  // namespace fuzzer
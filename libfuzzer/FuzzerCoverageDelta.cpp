@@ -0,0 +1,182 @@
+//===- FuzzerCoverageDelta.cpp - feature set encoding ---------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// Feature set encoding, see FuzzerCoverageDelta.h.
+//===----------------------------------------------------------------------===//
+// cjc: 覆盖率增量的压缩编码
+
+#include "FuzzerCoverageDelta.h"
+#include "FuzzerUtil.h"
+#include <cassert>
+
+namespace fuzzer {
+
+static const size_t kChunkBits = 1 << 16;
+static const size_t kBitmapBytes = kChunkBits / 8;
+
+static size_t VarintSize(uint64_t X) {
+  size_t N = 1;
+  for (; X >= 0x80; X >>= 7)
+    N++;
+  return N;
+}
+
+// The sizes of the array and the runs of a chunk, without encoding them.
+static void ContainerSizes(const uint32_t *Beg, const uint32_t *End,
+                           size_t *ArraySize, size_t *RunsSize) {
+  size_t NumRuns = 0;
+  *ArraySize = *RunsSize = 0;
+  uint32_t NextInArray = 0, NextInRuns = 0;
+  for (auto *F = Beg; F < End;) {
+    auto *RunEnd = F + 1;
+    while (RunEnd < End && *RunEnd == RunEnd[-1] + 1)
+      RunEnd++;
+    uint32_t Low = *F & 0xFFFF;
+    uint32_t Len = static_cast<uint32_t>(RunEnd - F);
+    *ArraySize += VarintSize(Low - NextInArray) + Len - 1;
+    *RunsSize += VarintSize(Low - NextInRuns) + VarintSize(Len - 1);
+    NextInArray = NextInRuns = Low + Len;
+    NumRuns++;
+    F = RunEnd;
+  }
+  *RunsSize += VarintSize(NumRuns);
+}
+
+static void EncodeArray(const uint32_t *Beg, const uint32_t *End, Unit *Out) {
+  uint32_t Next = 0;
+  for (auto *F = Beg; F < End; F++) {
+    uint32_t Low = *F & 0xFFFF;
+    AppendVarint(Low - Next, Out);
+    Next = Low + 1;
+  }
+}
+
+static void EncodeRuns(const uint32_t *Beg, const uint32_t *End, Unit *Out) {
+  size_t NumRuns = 1;
+  for (auto *F = Beg + 1; F < End; F++)
+    NumRuns += *F != F[-1] + 1;
+  AppendVarint(NumRuns, Out);
+  uint32_t Next = 0;
+  for (auto *F = Beg; F < End;) {
+    auto *RunEnd = F + 1;
+    while (RunEnd < End && *RunEnd == RunEnd[-1] + 1)
+      RunEnd++;
+    uint32_t Low = *F & 0xFFFF;
+    uint32_t Len = static_cast<uint32_t>(RunEnd - F);
+    AppendVarint(Low - Next, Out);
+    AppendVarint(Len - 1, Out);
+    Next = Low + Len;
+    F = RunEnd;
+  }
+}
+
+void EncodeCoverageDelta(const std::vector<uint32_t> &Features, Unit *Out) {
+  size_t NumChunks = 0;
+  for (size_t i = 0; i < Features.size(); i++)
+    NumChunks += i == 0 || (Features[i] >> 16) != (Features[i - 1] >> 16);
+  AppendVarint(NumChunks, Out);
+  uint32_t NextKey = 0;
+  const uint32_t *Data = Features.data(), *End = Data + Features.size();
+  for (auto *Beg = Data; Beg < End;) {
+    uint32_t Key = *Beg >> 16;
+    auto *ChunkEnd = Beg;
+    while (ChunkEnd < End && (*ChunkEnd >> 16) == Key) {
+      assert(ChunkEnd == Beg || *ChunkEnd > ChunkEnd[-1]);
+      ChunkEnd++;
+    }
+    size_t ArraySize, RunsSize;
+    ContainerSizes(Beg, ChunkEnd, &ArraySize, &RunsSize);
+    AppendVarint(Key - NextKey, Out);
+    NextKey = Key + 1;
+    if (RunsSize <= ArraySize && RunsSize <= kBitmapBytes) {
+      Out->push_back(kCoverageRuns);
+      AppendVarint(ChunkEnd - Beg - 1, Out);
+      EncodeRuns(Beg, ChunkEnd, Out);
+    } else if (ArraySize <= kBitmapBytes) {
+      Out->push_back(kCoverageArray);
+      AppendVarint(ChunkEnd - Beg - 1, Out);
+      EncodeArray(Beg, ChunkEnd, Out);
+    } else {
+      Out->push_back(kCoverageBitmap);
+      AppendVarint(ChunkEnd - Beg - 1, Out);
+      size_t Pos = Out->size();
+      Out->resize(Pos + kBitmapBytes);
+      for (auto *F = Beg; F < ChunkEnd; F++)
+        (*Out)[Pos + ((*F & 0xFFFF) >> 3)] |= 1 << (*F & 7);
+    }
+    Beg = ChunkEnd;
+  }
+}
+
+bool DecodeCoverageDelta(const uint8_t *Data, size_t Size,
+                         std::vector<uint32_t> *Out) {
+  const uint8_t *P = Data, *End = Data + Size;
+  uint64_t NumChunks, Gap, N, Len;
+  uint64_t NextKey = 0;
+  if (!ReadVarint(&P, End, &NumChunks))
+    return false;
+  for (uint64_t C = 0; C < NumChunks; C++) {
+    if (!ReadVarint(&P, End, &Gap) || Gap > 0xFFFF || P == End)
+      return false;
+    uint64_t Key = NextKey + Gap;
+    uint8_t Kind = *P++;
+    if (Key > 0xFFFF || !ReadVarint(&P, End, &N) || N >= kChunkBits)
+      return false;
+    N++;
+    NextKey = Key + 1;
+    uint32_t High = static_cast<uint32_t>(Key << 16);
+    uint64_t Next = 0;
+    switch (Kind) {
+    case kCoverageArray:
+      for (uint64_t i = 0; i < N; i++) {
+        if (!ReadVarint(&P, End, &Gap) || Gap >= kChunkBits - Next)
+          return false;
+        Next += Gap;
+        Out->push_back(High | static_cast<uint32_t>(Next++));
+      }
+      break;
+    case kCoverageRuns: {
+      uint64_t NumRuns, Total = 0;
+      if (!ReadVarint(&P, End, &NumRuns) || NumRuns > N)
+        return false;
+      for (uint64_t i = 0; i < NumRuns; i++) {
+        if (!ReadVarint(&P, End, &Gap) || !ReadVarint(&P, End, &Len) ||
+            Gap >= kChunkBits - Next || Len >= kChunkBits - Next - Gap)
+          return false;
+        Next += Gap;
+        Len++;
+        if ((Total += Len) > N)
+          return false;
+        for (uint64_t j = 0; j < Len; j++)
+          Out->push_back(High | static_cast<uint32_t>(Next++));
+      }
+      if (Total != N)
+        return false;
+      break;
+    }
+    case kCoverageBitmap: {
+      if (static_cast<size_t>(End - P) < kBitmapBytes)
+        return false;
+      uint64_t Total = 0;
+      for (size_t i = 0; i < kBitmapBytes; i++, P++)
+        for (size_t Bit = 0; *P >> Bit; Bit++)
+          if (*P & (1 << Bit)) {
+            Out->push_back(High | static_cast<uint32_t>(i * 8 + Bit));
+            Total++;
+          }
+      if (Total != N)
+        return false;
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  return P == End;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,45 @@
+//===- FuzzerCoverageDelta.h - Internal header for the Fuzzer ---*- C++ -* ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// Compact encoding of feature sets, for coverage exchange.
+//
+// A set of 32-bit features is split, like a roaring bitmap, into chunks of
+// the features that share the high 16 bits. Every chunk is stored in the
+// smallest of three containers:
+//   kArray:  the low 16 bits of each feature, as varint gaps.
+//   kRuns:   runs of consecutive features, as varint (gap, length - 1) pairs.
+//   kBitmap: a 65536-bit bitmap.
+// Encoding:
+//   varint number of chunks, then for each chunk:
+//     varint high 16 bits (the gap from the previous chunk), 1-byte container
+//     kind, varint number of features - 1, the container.
+// The gaps of arrays and runs are from the previous feature + 1, so dense
+// sets cost about a byte per run.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_COVERAGE_DELTA_H
+#define LLVM_FUZZER_COVERAGE_DELTA_H
+
+#include "FuzzerDefs.h"
+
+namespace fuzzer {
+
+enum CoverageContainerKind : uint8_t {
+  kCoverageArray = 0,
+  kCoverageRuns = 1,
+  kCoverageBitmap = 2,
+};
+
+// Features must be sorted and unique.
+void EncodeCoverageDelta(const std::vector<uint32_t> &Features, Unit *Out);
+// Appends the features to Out. Returns false for a broken encoding.
+bool DecodeCoverageDelta(const uint8_t *Data, size_t Size,
+                         std::vector<uint32_t> *Out);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_COVERAGE_DELTA_H
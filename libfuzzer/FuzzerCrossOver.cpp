@@ -12,6 +12,7 @@
 #include "FuzzerDefs.h"
 #include "FuzzerMutate.h"
 #include "FuzzerRandom.h"
+#include <algorithm>
 #include <cstring>
 
 namespace fuzzer {
@@ -49,4 +50,49 @@ size_t MutationDispatcher::CrossOver(const uint8_t *Data1, size_t Size1,
   return OutPos;
 }
 
+size_t MutationDispatcher::SpliceCrossOver(const uint8_t *From,
+                                           size_t FromSize, uint8_t *To,
+                                           size_t ToSize, size_t MaxToSize) {
+  if (!FromSize || !ToSize || ToSize > MaxToSize) return 0;
+  size_t ToPos = Rand(ToSize) + 1;
+  size_t FromPos = Rand(FromSize);
+  size_t CopySize = std::min(FromSize - FromPos, MaxToSize - ToPos);
+  memcpy(To + ToPos, From + FromPos, CopySize);
+  return ToPos + CopySize;
+}
+
+size_t MutationDispatcher::TwoPointCrossOver(const uint8_t *From,
+                                             size_t FromSize, uint8_t *To,
+                                             size_t ToSize, size_t MaxToSize) {
+  if (!FromSize || !ToSize || ToSize > MaxToSize) return 0;
+  // Replace To[ToBeg, ToBeg + ToLen) with From[FromBeg, FromBeg + FromLen).
+  size_t ToBeg = Rand(ToSize);
+  size_t ToLen = Rand(ToSize - ToBeg) + 1;
+  size_t FromBeg = Rand(FromSize);
+  size_t FromLen = Rand(FromSize - FromBeg) + 1;
+  FromLen = std::min(FromLen, MaxToSize - (ToSize - ToLen));
+  size_t TailSize = ToSize - ToBeg - ToLen;
+  if (FromLen != ToLen)
+    memmove(To + ToBeg + FromLen, To + ToBeg + ToLen, TailSize);
+  memcpy(To + ToBeg, From + FromBeg, FromLen);
+  return ToBeg + FromLen + TailSize;
+}
+
+size_t MutationDispatcher::AlignedCrossOver(const uint8_t *From,
+                                            size_t FromSize, uint8_t *To,
+                                            size_t ToSize) {
+  size_t CommonSize = std::min(FromSize, ToSize);
+  if (!CommonSize) return 0;
+  // Blocks of 1 to 64 bytes, but not larger than the common prefix.
+  size_t BlockSize = size_t(1) << Rand(7);
+  while (BlockSize > CommonSize)
+    BlockSize >>= 1;
+  size_t NumBlocks = CommonSize / BlockSize;
+  size_t FirstBlock = Rand(NumBlocks);
+  size_t CopyBlocks = Rand(NumBlocks - FirstBlock) + 1;
+  size_t Offset = FirstBlock * BlockSize;
+  memcpy(To + Offset, From + Offset, CopyBlocks * BlockSize);
+  return ToSize;
+}
+
 }  // namespace fuzzer
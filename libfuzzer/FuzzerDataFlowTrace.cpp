@@ -13,11 +13,15 @@
 
 #include "FuzzerCommand.h"
 #include "FuzzerIO.h"
+#include "FuzzerPack.h"
 #include "FuzzerRandom.h"
 #include "FuzzerSHA1.h"
 #include "FuzzerUtil.h"
 
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <numeric>
 #include <queue>
@@ -29,6 +33,16 @@
 
 namespace fuzzer {
 static const char *kFunctionsTxt = "functions.txt";
+static const char kBinaryTracesExt[] = ".dftbin";
+static const char kBinaryTracesMagic[] = "\x7f" "DFT";
+static const size_t kBinaryTracesMagicSize = 4;
+static const uint64_t kBinaryTracesVersion = 1;
+
+static bool IsBinaryTracesFile(const std::string &Name) {
+  size_t ExtSize = sizeof(kBinaryTracesExt) - 1;
+  return Name.size() > ExtSize &&
+         !Name.compare(Name.size() - ExtSize, ExtSize, kBinaryTracesExt);
+}
 
 bool BlockCoverage::AppendCoverage(const std::string &S) {
   std::stringstream SS(S);
@@ -49,7 +63,7 @@ bool BlockCoverage::AppendCoverage(std::istream &IN) {
     size_t FunctionId  = 0;
     SS >> FunctionId;
     if (L[0] == 'F') {
-      FunctionsWithDFT.insert(FunctionId);
+      AddFunctionWithDFT(FunctionId);
       continue;
     }
     if (L[0] != 'C') continue;
@@ -64,43 +78,119 @@ bool BlockCoverage::AppendCoverage(std::istream &IN) {
     // Ensures no CoverageVector is longer than UINT32_MAX.
     uint32_t NumBlocks = CoveredBlocks.back();
     CoveredBlocks.pop_back();
-    for (auto BB : CoveredBlocks)
-      if (BB >= NumBlocks) return false;
-    auto It = Functions.find(FunctionId);
-    auto &Counters =
-        It == Functions.end()
-            ? Functions.insert({FunctionId, std::vector<uint32_t>(NumBlocks)})
-                  .first->second
-            : It->second;
-
-    if (Counters.size() != NumBlocks) return false;  // wrong number of blocks.
-
-    Counters[0]++;
-    for (auto BB : CoveredBlocks)
-      Counters[BB]++;
+    if (!AppendFunctionCoverage(FunctionId, CoveredBlocks, NumBlocks))
+      return false;
   }
   return true;
 }
 
+BlockCoverage::FunctionCoverage &
+BlockCoverage::GetFunction(size_t FunctionId) {
+  if (FunctionId >= Functions.size())
+    Functions.resize(FunctionId + 1);
+  return Functions[FunctionId];
+}
+
+void BlockCoverage::MarkDirty(size_t FunctionId) {
+  auto &F = Functions[FunctionId];
+  if (F.IsDirty)
+    return;
+  F.IsDirty = true;
+  Dirty.push_back(FunctionId);
+}
+
+void BlockCoverage::IncrementCounter(FunctionCoverage &F,
+                                     size_t BasicBlockId) {
+  uint32_t &Cnt = F.Counters[BasicBlockId];
+  if (!Cnt) {
+    F.NumCovered++;
+    if (F.MinCounter != 1) {
+      F.MinCounter = 1;
+      F.NumAtMinCounter = 0;
+    }
+    F.NumAtMinCounter++;
+  } else if (Cnt == F.MinCounter && !--F.NumAtMinCounter) {
+    // The last counter at the minimum grows: the minimum is now Cnt + 1
+    // unless another counter sits between them, rescan.
+    F.MinCounter = 0;
+    Cnt++;
+    for (auto C : F.Counters) {
+      if (!C) continue;
+      if (!F.MinCounter || C < F.MinCounter) {
+        F.MinCounter = C;
+        F.NumAtMinCounter = 0;
+      }
+      if (C == F.MinCounter)
+        F.NumAtMinCounter++;
+    }
+    return;
+  }
+  Cnt++;
+}
+
+bool BlockCoverage::AppendFunctionCoverage(
+    size_t FunctionId, const std::vector<uint32_t> &CoveredBlocks,
+    uint32_t NumBlocks) {
+  if (FunctionId >= MaxFunctions || !NumBlocks) return false;
+  for (auto BB : CoveredBlocks)
+    if (BB >= NumBlocks) return false;
+  auto &F = GetFunction(FunctionId);
+  if (F.Counters.empty()) {
+    F.Counters.resize(NumBlocks);
+    NumFunctionsCovered++;
+  }
+
+  // wrong number of blocks.
+  if (F.Counters.size() != NumBlocks) return false;
+
+  IncrementCounter(F, 0);
+  for (auto BB : CoveredBlocks)
+    IncrementCounter(F, BB);
+  MarkDirty(FunctionId);
+  return true;
+}
+
+void BlockCoverage::AddFunctionWithDFT(size_t FunctionId) {
+  if (FunctionId >= MaxFunctions)
+    return;
+  auto &F = GetFunction(FunctionId);
+  if (F.HasDFT)
+    return;
+  F.HasDFT = true;
+  MarkDirty(FunctionId);
+}
+
 // Assign weights to each function.
 // General principles:
 //   * any uncovered function gets weight 0.
 //   * a function with lots of uncovered blocks gets bigger weight.
 //   * a function with a less frequently executed code gets bigger weight.
-std::vector<double> BlockCoverage::FunctionWeights(size_t NumFunctions) const {
-  std::vector<double> Res(NumFunctions);
-  for (const auto &It : Functions) {
-    auto FunctionID = It.first;
-    auto Counters = It.second;
-    assert(FunctionID < NumFunctions);
-    auto &Weight = Res[FunctionID];
-    // Give higher weight if the function has a DFT.
-    Weight = FunctionsWithDFT.count(FunctionID) ? 1000. : 1;
-    // Give higher weight to functions with less frequently seen basic blocks.
-    Weight /= SmallestNonZeroCounter(Counters);
-    // Give higher weight to functions with the most uncovered basic blocks.
-    Weight *= NumberOfUncoveredBlocks(Counters) + 1;
+double BlockCoverage::ComputeWeight(const FunctionCoverage &F) const {
+  if (F.Counters.empty())
+    return 0;
+  // Give higher weight if the function has a DFT.
+  double Weight = F.HasDFT ? 1000. : 1;
+  // Give higher weight to functions with less frequently seen basic blocks.
+  assert(F.MinCounter);
+  Weight /= F.MinCounter;
+  // Give higher weight to functions with the most uncovered basic blocks.
+  Weight *= static_cast<uint32_t>(F.Counters.size()) - F.NumCovered + 1;
+  return Weight;
+}
+
+std::vector<double> BlockCoverage::FunctionWeights(size_t NumFunctions) {
+  if (Weights.size() < Functions.size())
+    Weights.resize(Functions.size());
+  for (auto FunctionId : Dirty) {
+    auto &F = Functions[FunctionId];
+    Weights[FunctionId] = ComputeWeight(F);
+    F.IsDirty = false;
   }
+  Dirty.clear();
+  std::vector<double> Res(NumFunctions);
+  std::copy(Weights.begin(),
+            Weights.begin() + std::min(NumFunctions, Weights.size()),
+            Res.begin());
   return Res;
 }
 
@@ -110,6 +200,14 @@ void DataFlowTrace::ReadCoverage(const std::string &DirPath) {
   for (auto &SF : Files) {
     auto Name = Basename(SF.File);
     if (Name == kFunctionsTxt) continue;
+    if (IsBinaryTracesFile(Name)) {
+      DataFlowTraceFile BF;
+      if (!BF.Open(SF.File)) continue;
+      for (size_t Idx = 0; Idx < BF.size(); Idx++)
+        if (CorporaHashes.count(BF.Sha1(Idx)))
+          BF.ReadCoverage(Idx, &Coverage);
+      continue;
+    }
     if (!CorporaHashes.count(Name)) continue;
     std::ifstream IF(SF.File);
     Coverage.AppendCoverage(IF);
@@ -120,10 +218,11 @@ static void DFTStringAppendToVector(std::vector<uint8_t> *DFT,
                                     const std::string &DFTString) {
   assert(DFT->size() == DFTString.size());
   for (size_t I = 0, Len = DFT->size(); I < Len; I++)
-    (*DFT)[I] = DFTString[I] == '1';
+    (*DFT)[I] = static_cast<uint8_t>(DFTString[I] - '0');
 }
 
-// converts a string of '0' and '1' into a std::vector<uint8_t>
+// Converts a string of digits into a std::vector<uint8_t>. The tracer emits
+// '0' and '1', larger digits weight the bytes that more comparisons depend on.
 static std::vector<uint8_t> DFTStringToVector(const std::string &DFTString) {
   std::vector<uint8_t> DFT(DFTString.size());
   DFTStringAppendToVector(&DFT, DFTString);
@@ -152,13 +251,257 @@ static bool ParseDFTLine(const std::string &Line, size_t *FunctionNum,
   assert(Beg < End);
   size_t Len = End - Beg;
   for (size_t I = 0; I < Len; I++) {
-    if (Beg[I] != '0' && Beg[I] != '1')
-      return ParseError("the trace should contain only 0 or 1", Line);
+    if (!isdigit(Beg[I]))
+      return ParseError("the trace should contain only digits", Line);
   }
   *DFTString = Beg;
   return true;
 }
 
+static bool ParseSha1(const std::string &Str, uint8_t Sha1[kSHA1NumBytes]) {
+  if (Str.size() != 2 * kSHA1NumBytes)
+    return false;
+  for (size_t i = 0; i < kSHA1NumBytes; i++) {
+    char *End;
+    char Hex[3] = {Str[2 * i], Str[2 * i + 1], 0};
+    Sha1[i] = static_cast<uint8_t>(strtoul(Hex, &End, 16));
+    if (End != Hex + 2)
+      return false;
+  }
+  return true;
+}
+
+bool DataFlowTraceFileWriter::Add(const std::string &InputSha1,
+                                  const std::string &Trace) {
+  uint8_t Sha1[kSHA1NumBytes];
+  if (!ParseSha1(InputSha1, Sha1))
+    return false;
+  bool Ok = true;
+  Unit Traces, Cov;
+  size_t NumTraces = 0, NumCov = 0;
+  std::stringstream IN(Trace);
+  std::string L;
+  while (std::getline(IN, L, '\n')) {
+    if (L.empty())
+      continue;
+    size_t FunctionNum = 0;
+    std::string DFTString;
+    if (L[0] == 'F') {
+      if (!ParseDFTLine(L, &FunctionNum, &DFTString)) {
+        Ok = false;
+        continue;
+      }
+      bool Raw = DFTString.find_first_not_of("01") != std::string::npos;
+      AppendVarint(FunctionNum, &Traces);
+      AppendVarint(DFTString.size() << 1 | Raw, &Traces);
+      if (Raw) {
+        for (char C : DFTString)
+          Traces.push_back(static_cast<uint8_t>(C - '0'));
+      } else {
+        size_t Beg = Traces.size();
+        Traces.resize(Beg + (DFTString.size() + 7) / 8);
+        for (size_t I = 0; I < DFTString.size(); I++)
+          if (DFTString[I] == '1')
+            Traces[Beg + I / 8] |= static_cast<uint8_t>(1 << (I % 8));
+      }
+      NumTraces++;
+    } else if (L[0] == 'C') {
+      std::stringstream SS(L.c_str() + 1);
+      std::vector<uint32_t> Blocks;
+      SS >> FunctionNum;
+      for (uint32_t BB; SS >> BB;)
+        Blocks.push_back(BB);
+      if (Blocks.empty() ||
+          !std::is_sorted(Blocks.begin(), Blocks.end() - 1)) {
+        Ok = false;
+        continue;
+      }
+      AppendVarint(FunctionNum, &Cov);
+      AppendVarint(Blocks.back(), &Cov);
+      AppendVarint(Blocks.size() - 1, &Cov);
+      uint32_t Prev = 0;
+      for (size_t I = 0; I + 1 < Blocks.size(); I++) {
+        AppendVarint(Blocks[I] - Prev, &Cov);
+        Prev = Blocks[I];
+      }
+      NumCov++;
+    }
+  }
+  Index.push_back({InputSha1, Records.size()});
+  AppendVarint(NumTraces, &Records);
+  Records.insert(Records.end(), Traces.begin(), Traces.end());
+  AppendVarint(NumCov, &Records);
+  Records.insert(Records.end(), Cov.begin(), Cov.end());
+  return Ok;
+}
+
+Unit DataFlowTraceFileWriter::Finish() {
+  std::stable_sort(Index.begin(), Index.end(),
+                   [](const std::pair<std::string, size_t> &A,
+                      const std::pair<std::string, size_t> &B) {
+                     return A.first < B.first;
+                   });
+  Index.erase(std::unique(Index.begin(), Index.end(),
+                          [](const std::pair<std::string, size_t> &A,
+                             const std::pair<std::string, size_t> &B) {
+                            return A.first == B.first;
+                          }),
+              Index.end());
+  Unit Res(kBinaryTracesMagic, kBinaryTracesMagic + kBinaryTracesMagicSize);
+  AppendVarint(kBinaryTracesVersion, &Res);
+  AppendVarint(Index.size(), &Res);
+  for (auto &E : Index) {
+    uint8_t Sha1[kSHA1NumBytes];
+    ParseSha1(E.first, Sha1);
+    Res.insert(Res.end(), Sha1, Sha1 + kSHA1NumBytes);
+    for (size_t I = 0; I < 8; I++)
+      Res.push_back(static_cast<uint8_t>(static_cast<uint64_t>(E.second) >>
+                                         (8 * I)));
+  }
+  Res.insert(Res.end(), Records.begin(), Records.end());
+  Index.clear();
+  Records.clear();
+  return Res;
+}
+
+bool DataFlowTraceFile::Open(const std::string &Path) {
+  Data = MapFile(Path, &Size);
+  if (!Data || Size < kBinaryTracesMagicSize ||
+      memcmp(Data, kBinaryTracesMagic, kBinaryTracesMagicSize))
+    return false;
+  const uint8_t *P = Data + kBinaryTracesMagicSize, *End = Data + Size;
+  uint64_t Version, N;
+  if (!ReadVarint(&P, End, &Version) || Version != kBinaryTracesVersion ||
+      !ReadVarint(&P, End, &N) ||
+      static_cast<uint64_t>(End - P) / kIndexEntrySize < N)
+    return false;
+  NumInputs = static_cast<size_t>(N);
+  Index = P;
+  Records = P + NumInputs * kIndexEntrySize;
+  return true;
+}
+
+size_t DataFlowTraceFile::Find(const std::string &InputSha1) const {
+  uint8_t Sha1[kSHA1NumBytes];
+  if (!ParseSha1(InputSha1, Sha1))
+    return NumInputs;
+  size_t Beg = 0, End = NumInputs;
+  while (Beg < End) {
+    size_t Mid = Beg + (End - Beg) / 2;
+    int Cmp = memcmp(IndexEntry(Mid), Sha1, kSHA1NumBytes);
+    if (!Cmp)
+      return Mid;
+    if (Cmp < 0)
+      Beg = Mid + 1;
+    else
+      End = Mid;
+  }
+  return NumInputs;
+}
+
+const uint8_t *DataFlowTraceFile::Record(size_t Idx) const {
+  const uint8_t *E = IndexEntry(Idx) + kSHA1NumBytes;
+  uint64_t Offset = 0;
+  for (size_t I = 0; I < 8; I++)
+    Offset |= static_cast<uint64_t>(E[I]) << (8 * I);
+  if (Offset >= static_cast<uint64_t>(Data + Size - Records))
+    return nullptr;
+  return Records + Offset;
+}
+
+// Reads the header of the next trace of a record and advances *P past it.
+static bool NextTrace(const uint8_t **P, const uint8_t *End, uint64_t *Func,
+                      uint64_t *Len, bool *Raw, const uint8_t **Trace) {
+  uint64_t LenAndRaw;
+  if (!ReadVarint(P, End, Func) || !ReadVarint(P, End, &LenAndRaw))
+    return false;
+  *Len = LenAndRaw >> 1;
+  *Raw = LenAndRaw & 1;
+  uint64_t Bytes = *Raw ? *Len : (*Len + 7) / 8;
+  if (static_cast<uint64_t>(End - *P) < Bytes)
+    return false;
+  *Trace = *P;
+  *P += Bytes;
+  return true;
+}
+
+bool DataFlowTraceFile::ReadTrace(size_t Idx, size_t FunctionId,
+                                  std::vector<uint8_t> *Trace) const {
+  const uint8_t *P = Record(Idx), *End = Data + Size;
+  uint64_t NumTraces, Func, Len;
+  bool Raw;
+  const uint8_t *T;
+  if (!P || !ReadVarint(&P, End, &NumTraces))
+    return false;
+  for (uint64_t I = 0; I < NumTraces; I++) {
+    if (!NextTrace(&P, End, &Func, &Len, &Raw, &T))
+      return false;
+    if (Func != FunctionId)
+      continue;
+    Trace->resize(Len);
+    for (size_t J = 0; J < Len; J++)
+      (*Trace)[J] = Raw ? T[J] : (T[J / 8] >> (J % 8)) & 1;
+    return true;
+  }
+  return false;
+}
+
+bool DataFlowTraceFile::ReadCoverage(size_t Idx,
+                                     BlockCoverage *Coverage) const {
+  const uint8_t *P = Record(Idx), *End = Data + Size;
+  uint64_t NumTraces, NumCov, Func, Len, NumBlocks, NumCovered, Delta;
+  bool Raw;
+  const uint8_t *T;
+  if (!P || !ReadVarint(&P, End, &NumTraces))
+    return false;
+  for (uint64_t I = 0; I < NumTraces; I++) {
+    if (!NextTrace(&P, End, &Func, &Len, &Raw, &T))
+      return false;
+    Coverage->AddFunctionWithDFT(Func);
+  }
+  if (!ReadVarint(&P, End, &NumCov))
+    return false;
+  std::vector<uint32_t> Blocks;
+  for (uint64_t I = 0; I < NumCov; I++) {
+    if (!ReadVarint(&P, End, &Func) || !ReadVarint(&P, End, &NumBlocks) ||
+        !ReadVarint(&P, End, &NumCovered) || NumBlocks > UINT32_MAX ||
+        NumCovered > static_cast<uint64_t>(End - P))
+      return false;
+    Blocks.clear();
+    uint64_t BB = 0;
+    for (uint64_t J = 0; J < NumCovered; J++) {
+      // A block out of range is malformed, as in AppendCoverage.
+      if (!ReadVarint(&P, End, &Delta) || Delta >= NumBlocks - BB)
+        return false;
+      BB += Delta;
+      Blocks.push_back(static_cast<uint32_t>(BB));
+    }
+    if (!Coverage->AppendFunctionCoverage(Func, Blocks,
+                                          static_cast<uint32_t>(NumBlocks)))
+      return false;
+  }
+  return true;
+}
+
+const std::vector<uint8_t> *
+DataFlowTrace::Get(const std::string &InputSha1) const {
+  auto It = Traces.find(InputSha1);
+  if (It != Traces.end())
+    return &It->second;
+  if (!CorporaHashes.count(InputSha1))
+    return nullptr;  // Like the text traces, only those of the corpus.
+  for (auto &BF : BinaryFiles) {
+    size_t Idx = BF->Find(InputSha1);
+    if (Idx == BF->size())
+      continue;
+    std::vector<uint8_t> Trace;
+    if (!BF->ReadTrace(Idx, FocusFuncIdx, &Trace))
+      return nullptr;
+    return &(Traces[InputSha1] = std::move(Trace));
+  }
+  return nullptr;
+}
+
 bool DataFlowTrace::Init(const std::string &DirPath, std::string *FocusFunction,
                          std::vector<SizedFile> &CorporaFiles, Random &Rand) {
   if (DirPath.empty()) return false;
@@ -166,7 +509,7 @@ bool DataFlowTrace::Init(const std::string &DirPath, std::string *FocusFunction,
   std::vector<SizedFile> Files;
   GetSizedFilesFromDir(DirPath, &Files);
   std::string L;
-  size_t FocusFuncIdx = SIZE_MAX;
+  FocusFuncIdx = SIZE_MAX;
   std::vector<std::string> FunctionNames;
 
   // Collect the hashes of the corpus files.
@@ -190,6 +533,7 @@ bool DataFlowTrace::Init(const std::string &DirPath, std::string *FocusFunction,
     // * reads the coverage data from the DFT files.
     // * assigns weights to functions based on coverage.
     // * chooses a random function according to the weights.
+    Coverage.SetNumFunctions(NumFunctions);
     ReadCoverage(DirPath);
     auto Weights = Coverage.FunctionWeights(NumFunctions);
     std::vector<double> Intervals(NumFunctions + 1);
@@ -217,9 +561,25 @@ bool DataFlowTrace::Init(const std::string &DirPath, std::string *FocusFunction,
   // Read traces.
   size_t NumTraceFiles = 0;
   size_t NumTracesWithFocusFunction = 0;
+  size_t NumBinaryTraces = 0;
   for (auto &SF : Files) {
     auto Name = Basename(SF.File);
     if (Name == kFunctionsTxt) continue;
+    if (IsBinaryTracesFile(Name)) {
+      // Only mapped, Get decodes the traces of the inputs it is asked for.
+      std::unique_ptr<DataFlowTraceFile> BF(new DataFlowTraceFile);
+      if (!BF->Open(SF.File)) {
+        Printf("WARNING: DataFlowTrace: can't read '%s'\n", SF.File.c_str());
+        continue;
+      }
+      size_t NumInCorpus = 0;
+      for (size_t Idx = 0; Idx < BF->size(); Idx++)
+        NumInCorpus += CorporaHashes.count(BF->Sha1(Idx));
+      if (!NumInCorpus) continue;  // Nothing in the corpus.
+      NumBinaryTraces += NumInCorpus;
+      BinaryFiles.push_back(std::move(BF));
+      continue;
+    }
     if (!CorporaHashes.count(Name)) continue;  // not in the corpus.
     NumTraceFiles++;
     // Printf("=== %s\n", Name.c_str());
@@ -242,9 +602,44 @@ bool DataFlowTrace::Init(const std::string &DirPath, std::string *FocusFunction,
     }
   }
   Printf("INFO: DataFlowTrace: %zd trace files, %zd functions, "
-         "%zd traces with focus function\n",
-         NumTraceFiles, NumFunctions, NumTracesWithFocusFunction);
-  return NumTraceFiles > 0;
+         "%zd traces with focus function, %zd inputs in %zd %s files\n",
+         NumTraceFiles, NumFunctions, NumTracesWithFocusFunction,
+         NumBinaryTraces, BinaryFiles.size(), kBinaryTracesExt);
+  return NumTraceFiles + NumBinaryTraces > 0;
+}
+
+static void CollectDataFlowForFile(const std::string &DFTBinary,
+                                   const std::string &DirPath,
+                                   const SizedFile &F) {
+  auto OutPath = DirPlusFile(DirPath, Hash(FileToVector(F.File)));
+  Command Cmd;
+  Cmd.addArgument(DFTBinary);
+  Cmd.addArgument(F.File);
+  Cmd.addArgument(OutPath);
+  Printf("CMD: %s\n", Cmd.toString().c_str());
+  ExecuteCommand(Cmd);
+}
+
+// Adds the traces of a batched tracer run to Writer. Returns the number of
+// complete traces.
+static size_t SplitDataFlowOutput(const std::string &OutPath,
+                                  DataFlowTraceFileWriter *Writer) {
+  std::ifstream IF(OutPath);
+  std::string L, Trace;
+  size_t NumTraces = 0;
+  while (std::getline(IF, L, '\n')) {
+    if (L.size() > 2 && L[0] == 'I' && L[1] == ' ') {
+      if (!Writer->Add(L.substr(2), Trace))
+        Printf("WARNING: malformed data flow trace of %s\n",
+               L.substr(2).c_str());
+      Trace.clear();
+      NumTraces++;
+      continue;
+    }
+    Trace += L;
+    Trace += '\n';
+  }
+  return NumTraces;
 }
 
 int CollectDataFlow(const std::string &DFTBinary, const std::string &DirPath,
@@ -259,22 +654,62 @@ int CollectDataFlow(const std::string &DFTBinary, const std::string &DirPath,
   static char DFSanEnv[] = "DFSAN_OPTIONS=warn_unimplemented=0";
   putenv(DFSanEnv);
   MkDir(DirPath);
+  // All inputs go to the tracer as one packed corpus, so that DFSan starts
+  // once and not once per input. The tracer writes the traces in order, if it
+  // dies on an input the inputs after it are traced by another run. The
+  // traces are stored in one *.dftbin file.
+  DataFlowTraceFileWriter Writer;
+  Unit Pack;
+  AppendPackedCorpusHeader(&Pack);
+  size_t HeaderSize = Pack.size();
+  std::vector<size_t> RecordOffsets;
   for (auto &F : CorporaFiles) {
-    // For every input F we need to collect the data flow and the coverage.
-    // Data flow collection may fail if we request too many DFSan tags at once.
-    // So, we start from requesting all tags in range [0,Size) and if that fails
-    // we then request tags in [0,Size/2) and [Size/2, Size), and so on.
-    // Function number => DFT.
-    auto OutPath = DirPlusFile(DirPath, Hash(FileToVector(F.File)));
-    std::unordered_map<size_t, std::vector<uint8_t>> DFTMap;
-    std::unordered_set<std::string> Cov;
+    RecordOffsets.push_back(Pack.size());
+    AppendPackedUnitRecord(FileToVector(F.File), &Pack);
+  }
+  auto PackPath = TempPath("DataFlow", ".pack");
+  auto OutPath = TempPath("DataFlow", ".txt");
+  size_t Beg = 0, NumRuns = 0;
+  while (Beg < CorporaFiles.size()) {
+    Unit Batch(Pack.begin(), Pack.begin() + HeaderSize);
+    Batch.insert(Batch.end(), Pack.begin() + RecordOffsets[Beg], Pack.end());
+    WriteToFile(Batch, PackPath);
     Command Cmd;
     Cmd.addArgument(DFTBinary);
-    Cmd.addArgument(F.File);
+    Cmd.addArgument(PackPath);
     Cmd.addArgument(OutPath);
-    Printf("CMD: %s\n", Cmd.toString().c_str());
-    ExecuteCommand(Cmd);
+    Printf("CMD: %s (%zd inputs)\n", Cmd.toString().c_str(),
+           CorporaFiles.size() - Beg);
+    int ExitCode = ExecuteCommand(Cmd);
+    NumRuns++;
+    size_t NumTraces = SplitDataFlowOutput(OutPath, &Writer);
+    Beg += NumTraces;
+    if (Beg == CorporaFiles.size())
+      break;
+    if (!ExitCode && !NumTraces) {
+      // A tracer without batches took the pack for a single input.
+      Printf("INFO: %s does not trace packed corpora, running it per input\n",
+             DFTBinary.c_str());
+      for (; Beg < CorporaFiles.size(); Beg++, NumRuns++)
+        CollectDataFlowForFile(DFTBinary, DirPath, CorporaFiles[Beg]);
+      break;
+    }
+    Printf("WARNING: no data flow for %s, the tracer exited with %d\n",
+           CorporaFiles[Beg].File.c_str(), ExitCode);
+    Beg++;
+  }
+  RemoveFile(PackPath);
+  RemoveFile(OutPath);
+  if (Writer.size()) {
+    Unit Traces = Writer.Finish();
+    // Named by the contents, so that concurrent collections into one dir
+    // (-fork with -collect_data_flow) don't clash.
+    auto TracesPath = DirPlusFile(DirPath, Hash(Traces) + kBinaryTracesExt);
+    WriteToFile(Traces, TracesPath + ".tmp");
+    RenameFile(TracesPath + ".tmp", TracesPath);
   }
+  Printf("INFO: collected data flow for %zd files in %zd runs\n",
+         CorporaFiles.size(), NumRuns);
   // Write functions.txt if it's currently empty or doesn't exist.
   auto FunctionsTxtPath = DirPlusFile(DirPath, kFunctionsTxt);
   if (FileToString(FunctionsTxtPath).empty()) {
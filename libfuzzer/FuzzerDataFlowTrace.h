@@ -20,6 +20,22 @@
 // All other files in the dir are the traces, see dataflow/DataFlow.cpp.
 // The name of the file is sha1 of the input used to generate the trace.
 //
+// CollectDataFlow stores the traces of many inputs in one binary file instead,
+// named *.dftbin:
+//   magic "\x7fDFT", varint version, varint number of inputs,
+//   the index: 20-byte SHA1 and 8-byte little-endian record offset per input,
+//     sorted by SHA1,
+//   the records, at their offsets from the end of the index:
+//     varint number of traces, for each:
+//       varint function, varint (input size << 1 | raw),
+//       the trace: one bit per byte of the input, or one byte per byte if the
+//       trace has digits other than 0 and 1 (raw),
+//     varint number of covered functions, for each:
+//       varint function, varint number of blocks, varint number of covered
+//       blocks, the covered blocks as varint deltas.
+// The files are mapped and a trace is only decoded when an input with that
+// SHA1 is added to the corpus.
+//
 // Current status:
 //   the data is parsed and the summary is printed, but the data is not yet
 //   used in any other way.
@@ -30,7 +46,9 @@
 
 #include "FuzzerDefs.h"
 #include "FuzzerIO.h"
+#include "FuzzerSHA1.h"
 
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -41,76 +59,129 @@ namespace fuzzer {
 int CollectDataFlow(const std::string &DFTBinary, const std::string &DirPath,
                     const std::vector<SizedFile> &CorporaFiles);
 
+// Block coverage of the corpus, from the "C" lines of the traces. The
+// counters are kept in flat arrays indexed by function, along with the number
+// of covered blocks and the smallest non-zero counter of every function, so
+// that appending coverage and recomputing the weights only touch the
+// functions that changed.
 class BlockCoverage {
 public:
   // These functions guarantee no CoverageVector is longer than UINT32_MAX.
   bool AppendCoverage(std::istream &IN);
   bool AppendCoverage(const std::string &S);
+  // Adds one "CN X Y Z T" line: CoveredBlocks are X, Y, Z and NumBlocks is T.
+  bool AppendFunctionCoverage(size_t FunctionId,
+                              const std::vector<uint32_t> &CoveredBlocks,
+                              uint32_t NumBlocks);
+  void AddFunctionWithDFT(size_t FunctionId);
+  // Function ids from NumFunctions on (the size of functions.txt) are then
+  // ignored or rejected as malformed, like those past kMaxFunctions.
+  void SetNumFunctions(size_t NumFunctions) {
+    MaxFunctions = NumFunctions < kMaxFunctions ? NumFunctions : kMaxFunctions;
+  }
 
-  size_t NumCoveredFunctions() const { return Functions.size(); }
+  size_t NumCoveredFunctions() const { return NumFunctionsCovered; }
 
-  uint32_t GetCounter(size_t FunctionId, size_t BasicBlockId) {
-    auto It = Functions.find(FunctionId);
-    if (It == Functions.end())
+  uint32_t GetCounter(size_t FunctionId, size_t BasicBlockId) const {
+    if (FunctionId >= Functions.size())
       return 0;
-    const auto &Counters = It->second;
+    const auto &Counters = Functions[FunctionId].Counters;
     if (BasicBlockId < Counters.size())
       return Counters[BasicBlockId];
     return 0;
   }
 
-  uint32_t GetNumberOfBlocks(size_t FunctionId) {
-    auto It = Functions.find(FunctionId);
-    if (It == Functions.end()) return 0;
-    const auto &Counters = It->second;
-    return static_cast<uint32_t>(Counters.size());
+  uint32_t GetNumberOfBlocks(size_t FunctionId) const {
+    if (FunctionId >= Functions.size()) return 0;
+    return static_cast<uint32_t>(Functions[FunctionId].Counters.size());
   }
 
-  uint32_t GetNumberOfCoveredBlocks(size_t FunctionId) {
-    auto It = Functions.find(FunctionId);
-    if (It == Functions.end()) return 0;
-    const auto &Counters = It->second;
-    uint32_t Result = 0;
-    for (auto Cnt: Counters)
-      if (Cnt)
-        Result++;
-    return Result;
+  uint32_t GetNumberOfCoveredBlocks(size_t FunctionId) const {
+    if (FunctionId >= Functions.size()) return 0;
+    return Functions[FunctionId].NumCovered;
   }
 
-  std::vector<double> FunctionWeights(size_t NumFunctions) const;
-  void clear() { Functions.clear(); }
+  // Only the weights of the functions changed since the last call are
+  // recomputed.
+  std::vector<double> FunctionWeights(size_t NumFunctions);
+  void clear() {
+    Functions.clear();
+    Weights.clear();
+    Dirty.clear();
+    NumFunctionsCovered = 0;
+  }
 
 private:
-  typedef std::vector<uint32_t> CoverageVector;
-
-  uint32_t NumberOfCoveredBlocks(const CoverageVector &Counters) const {
-    uint32_t Res = 0;
-    for (auto Cnt : Counters)
-      if (Cnt)
-        Res++;
-    return Res;
-  }
+  // Larger function ids are rejected as malformed, the arrays are dense.
+  static const size_t kMaxFunctions = 1 << 24;
+  size_t MaxFunctions = kMaxFunctions;
+
+  struct FunctionCoverage {
+    // Each counter represents how many input files trigger the given basic
+    // block. Empty if the function is not covered.
+    std::vector<uint32_t> Counters;
+    uint32_t NumCovered = 0;
+    // The smallest non-zero counter and how many counters have that value.
+    uint32_t MinCounter = 0;
+    uint32_t NumAtMinCounter = 0;
+    bool HasDFT = false;
+    bool IsDirty = false;
+  };
+
+  FunctionCoverage &GetFunction(size_t FunctionId);
+  void IncrementCounter(FunctionCoverage &F, size_t BasicBlockId);
+  void MarkDirty(size_t FunctionId);
+  double ComputeWeight(const FunctionCoverage &F) const;
+
+  std::vector<FunctionCoverage> Functions;
+  size_t NumFunctionsCovered = 0;
+  std::vector<double> Weights;
+  std::vector<size_t> Dirty;
+};
+
+// Builds a *.dftbin file from the text traces of the inputs.
+class DataFlowTraceFileWriter {
+ public:
+  // Returns false if Trace has a malformed line. The other lines are kept.
+  bool Add(const std::string &InputSha1, const std::string &Trace);
+  size_t size() const { return Index.size(); }
+  Unit Finish();
+
+ private:
+  std::vector<std::pair<std::string, size_t>> Index;  // Sha1, record offset.
+  Unit Records;
+};
 
-  uint32_t NumberOfUncoveredBlocks(const CoverageVector &Counters) const {
-    return static_cast<uint32_t>(Counters.size()) -
-           NumberOfCoveredBlocks(Counters);
+// A mapped *.dftbin file.
+class DataFlowTraceFile {
+ public:
+  ~DataFlowTraceFile() { UnmapFile(Data, Size); }
+  // Returns false if Path is not a complete *.dftbin file.
+  bool Open(const std::string &Path);
+  size_t size() const { return NumInputs; }
+  std::string Sha1(size_t Idx) const {
+    return Sha1ToString(IndexEntry(Idx));
   }
+  // Returns the index of the input, or size() if there is none.
+  size_t Find(const std::string &InputSha1) const;
+  // Returns false if the input has no trace for FunctionId.
+  bool ReadTrace(size_t Idx, size_t FunctionId,
+                 std::vector<uint8_t> *Trace) const;
+  // Adds the coverage of the input and the functions it has traces for.
+  bool ReadCoverage(size_t Idx, BlockCoverage *Coverage) const;
 
-  uint32_t SmallestNonZeroCounter(const CoverageVector &Counters) const {
-    assert(!Counters.empty());
-    uint32_t Res = Counters[0];
-    for (auto Cnt : Counters)
-      if (Cnt)
-        Res = Min(Res, Cnt);
-    assert(Res);
-    return Res;
+ private:
+  static const size_t kIndexEntrySize = kSHA1NumBytes + 8;
+  const uint8_t *IndexEntry(size_t Idx) const {
+    return Index + Idx * kIndexEntrySize;
   }
+  const uint8_t *Record(size_t Idx) const;
 
-  // Function ID => vector of counters.
-  // Each counter represents how many input files trigger the given basic block.
-  std::unordered_map<size_t, CoverageVector> Functions;
-  // Functions that have DFT entry.
-  std::unordered_set<size_t> FunctionsWithDFT;
+  const uint8_t *Data = nullptr;
+  size_t Size = 0;
+  size_t NumInputs = 0;
+  const uint8_t *Index = nullptr;
+  const uint8_t *Records = nullptr;
 };
 
 class DataFlowTrace {
@@ -118,17 +189,18 @@ class DataFlowTrace {
   void ReadCoverage(const std::string &DirPath);
   bool Init(const std::string &DirPath, std::string *FocusFunction,
             std::vector<SizedFile> &CorporaFiles, Random &Rand);
-  void Clear() { Traces.clear(); }
-  const std::vector<uint8_t> *Get(const std::string &InputSha1) const {
-    auto It = Traces.find(InputSha1);
-    if (It != Traces.end())
-      return &It->second;
-    return nullptr;
+  void Clear() {
+    Traces.clear();
+    BinaryFiles.clear();
   }
+  // Traces from *.dftbin files are decoded on the first Get.
+  const std::vector<uint8_t> *Get(const std::string &InputSha1) const;
 
  private:
   // Input's sha1 => DFT for the FocusFunction.
-   std::unordered_map<std::string, std::vector<uint8_t>> Traces;
+   mutable std::unordered_map<std::string, std::vector<uint8_t>> Traces;
+   std::vector<std::unique_ptr<DataFlowTraceFile>> BinaryFiles;
+   size_t FocusFuncIdx = SIZE_MAX;
    BlockCoverage Coverage;
    std::unordered_set<std::string> CorporaHashes;
 };
@@ -17,6 +17,7 @@
 #include "FuzzerInternal.h"
 #include "FuzzerMerge.h"
 #include "FuzzerMutate.h"
+#include "FuzzerPack.h"
 #include "FuzzerPlatform.h"
 #include "FuzzerRandom.h"
 #include "FuzzerTracePC.h"
@@ -349,7 +350,7 @@ int RunOneTest(Fuzzer *F, const char *InputFilePath, size_t MaxLen) {
 static bool AllInputsAreFiles() {
   if (Inputs->empty()) return false;
   for (auto &Path : *Inputs)
-    if (!IsFile(Path))
+    if (!IsFile(Path) || IsPackedCorpus(Path))
       return false;
   return true;
 }
@@ -544,7 +545,12 @@ void Merge(Fuzzer *F, FuzzingOptions &Options,
 
   // 合并操作, 计算新的覆盖率特征和覆盖率信息
   CrashResistantMerge(Args, OldCorpus, NewCorpus, &NewFiles, {}, &NewFeatures,
-                      {}, &NewCov, CFPath, true, Flags.set_cover_merge);
+                      {}, &NewCov, CFPath, true, Flags.set_cover_merge,
+                      Flags.binary_merge_control_file,
+                      Flags.merge_jobs > 1 ? Flags.merge_jobs : 1,
+                      Flags.merge_feature_cache
+                          ? MergeFeatureCacheDir(Corpora[0])
+                          : "");
 
   // 输出到新的语料库
   for (auto &Path : NewFiles)
@@ -716,7 +722,9 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.Verbosity = Flags.verbosity; // 输出详细日志
   Options.MaxLen = Flags.max_len; // 测试用例的最大长度
   Options.LenControl = Flags.len_control; // 输入长度的增长速率
+  Options.AdaptiveLenControl = Flags.adaptive_len_control; // 根据覆盖率收益调整输入长度上限
   Options.KeepSeed = Flags.keep_seed; // 将种子保留在语料库中
+  Options.SeedPrefetchThreads = Flags.seed_prefetch_threads; // 预读种子的线程数
   Options.UnitTimeoutSec = Flags.timeout; // 单元测试的运行时间
   Options.ErrorExitCode = Flags.error_exitcode; // 错误退出码
   Options.TimeoutExitCode = Flags.timeout_exitcode; // 超时退出码
@@ -728,6 +736,7 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.CrossOverUniformDist = Flags.cross_over_uniform_dist; // 交叉输入使用均匀概率分布
   Options.MutateDepth = Flags.mutate_depth; // 变异次数
   Options.ReduceDepth = Flags.reduce_depth; // 减少变异次数
+  Options.DeterministicStage = Flags.deterministic_stage; // 确定性变异阶段每次的执行次数
   Options.UseCounters = Flags.use_counters; // 使用覆盖计数器
   Options.UseMemmem = Flags.use_memmem; // 使用内存函数指导fuzzer
   Options.UseCmp = Flags.use_cmp; // 使用cmp来变异
@@ -737,12 +746,19 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.ShuffleAtStartUp = Flags.shuffle; // 输入随机排序
   Options.PreferSmall = Flags.prefer_small; // 输入排序优先较小的输入
   Options.ReloadIntervalSec = Flags.reload; // 重新加载语料库的时间间隔
+  Options.ReloadWatch = Flags.reload_watch; // 监视输出语料库目录中的新文件
+  Options.AsyncWrites = Flags.async_writes; // 后台线程写语料库
+  Options.AsyncWritesFsync = Flags.async_writes_fsync; // 后台写入后fsync
+  if (Flags.sync_socket)
+    Options.SyncSocket = Flags.sync_socket; // 与调度客户端交换种子的套接字
   Options.OnlyASCII = Flags.only_ascii; // 输入只为ascii
   Options.DetectLeaks = Flags.detect_leaks; // 内存泄露，lsan
   Options.PurgeAllocatorIntervalSec = Flags.purge_allocator_interval; // 清除分配器缓存时间间隔
   Options.TraceMalloc = Flags.trace_malloc; // 打印malloc/free和堆栈跟踪操作
   Options.RssLimitMb = Flags.rss_limit_mb; // 内存使用限制
   Options.MallocLimitMb = Flags.malloc_limit_mb; // 分配内存最大限制
+  Options.BinaryMergeControlFile = Flags.binary_merge_control_file; // 合并控制文件使用二进制格式
+  Options.MergeFeatureCache = Flags.merge_feature_cache; // 缓存已执行输入的特征, 合并时跳过
 
   if (!Options.MallocLimitMb)
     Options.MallocLimitMb = Options.RssLimitMb;
@@ -755,7 +771,9 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
     // Ensure output corpus assumed to be the first arbitrary argument input
     // is not a path to an existing file.
     std::string OutputCorpusDir = (*Inputs)[0];
-    if (!IsFile(OutputCorpusDir)) {
+    if (IsPackedCorpus(OutputCorpusDir)) {
+      Options.OutputCorpus = OutputCorpusDir;
+    } else if (!IsFile(OutputCorpusDir)) {
       Options.OutputCorpus = OutputCorpusDir;
       ValidateDirectoryExists(Options.OutputCorpus, Flags.create_missing_dirs);
     }
@@ -796,6 +814,8 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.PrintNewCovPcs = Flags.print_pcs;
   Options.PrintNewCovFuncs = Flags.print_funcs;
   Options.PrintFinalStats = Flags.print_final_stats;
+  Options.CompressCorpus = Flags.compress_corpus; // 冷门语料在内存中压缩保存
+  Options.CompressCorpusHotUnits = Flags.compress_corpus_hot_units;
   Options.PrintCorpusStats = Flags.print_corpus_stats;
   Options.PrintCoverage = Flags.print_coverage;
   Options.PrintFullCoverage = Flags.print_full_coverage;
@@ -812,6 +832,14 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
     Options.FeaturesDir = Flags.features_dir;
     ValidateDirectoryExists(Options.FeaturesDir, Flags.create_missing_dirs);
   }
+  if (Flags.features_log) {
+    Options.FeaturesLog = Flags.features_log; // 所有特征集追加到一个文件
+    if (!FileSize(Options.FeaturesLog)) {
+      Unit Header;
+      AppendMergeFeatureCacheHeader(&Header);
+      WriteToFile(Header, Options.FeaturesLog);
+    }
+  }
   if (Flags.mutation_graph_file)
     Options.MutationGraphFile = Flags.mutation_graph_file;
   if (Flags.collect_data_flow)
@@ -862,6 +890,9 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   auto *MD = new MutationDispatcher(Rand, Options);
   // cjc: 数据语料库
   auto *Corpus = new InputCorpus(Options.OutputCorpus, Entropic);
+  if (Options.CompressCorpus)
+    Corpus->EnableCompression(
+        static_cast<size_t>(std::max(Options.CompressCorpusHotUnits, 0)));
 
   // fUZZER核心逻辑模块
   auto *F = new Fuzzer(Callback, *Corpus, *MD, Options);
@@ -905,6 +936,12 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   if (Flags.cleanse_crash)
     return CleanseCrashInput(Args, Options);
 
+  // cjc: 语料库目录和打包语料库之间的转换
+  if (Flags.pack_corpus)
+    return PackCorpus(Flags.pack_corpus, *Inputs);
+  if (Flags.unpack_corpus)
+    return UnpackCorpus(Flags.unpack_corpus, *Inputs);
+
   if (RunIndividualFiles) {
     Options.SaveArtifacts = false;
     int Runs = std::max(1, Flags.runs);
@@ -928,6 +965,10 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   }
 
   Options.ForkCorpusGroups = Flags.fork_corpus_groups;
+  Options.ForkMergeThreads = Flags.fork_merge_threads; // fork模式下合并结果的线程数
+  Options.ForkDftThreads = Flags.fork_dft_threads; // 后台收集数据流的线程数
+  Options.ForkAdaptiveJobs = Flags.fork_adaptive_jobs; // 根据已完成的任务调整任务时长和种子数
+  Options.ForkCoverageAwareSeeds = Flags.fork_coverage_aware_seeds; // 按稀有特征挑选子进程种子
   if (Flags.fork)
     FuzzWithFork(F->GetMD().GetRand(), Options, Args, *Inputs, Flags.fork);
 
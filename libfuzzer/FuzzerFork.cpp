@@ -15,6 +15,7 @@
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
 #include "FuzzerMerge.h"
+#include "FuzzerPack.h"
 #include "FuzzerSHA1.h"
 #include "FuzzerTracePC.h"
 #include "FuzzerUtil.h"
@@ -22,12 +23,15 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <random>
 #include <sstream>
 #include <thread>
+#include <unordered_set>
 
 namespace fuzzer {
 
@@ -35,6 +39,7 @@ struct Stats {
   size_t number_of_executed_units = 0;
   size_t peak_rss_mb = 0;
   size_t average_exec_per_sec = 0;
+  size_t init_time_ms = 0;
 };
 
 static Stats ParseFinalStatsFromLog(const std::string &LogPath) {
@@ -48,6 +53,7 @@ static Stats ParseFinalStatsFromLog(const std::string &LogPath) {
       {"stat::number_of_executed_units:", &Res.number_of_executed_units},
       {"stat::peak_rss_mb:", &Res.peak_rss_mb},
       {"stat::average_exec_per_sec:", &Res.average_exec_per_sec},
+      {"stat::init_time_ms:", &Res.init_time_ms},
       {nullptr, nullptr},
   };
   while (std::getline(In, Line, '\n')) {
@@ -63,46 +69,261 @@ static Stats ParseFinalStatsFromLog(const std::string &LogPath) {
   return Res;
 }
 
-struct FuzzJob {
-  // Inputs.
-  Command Cmd;
-  std::string CorpusDir;
-  std::string FeaturesDir;
-  std::string LogPath;
-  std::string SeedListPath;
-  std::string CFPath;
-  size_t      JobId;
+void ForkJobTuner::AddJobResult(const JobResult &R) {
+  const double kWeight = 0.2;  // Of the last job in the moving averages.
+  double JobOverhead = R.InitTime + R.MergeTime +
+                       std::max(0.0, R.WallTime - R.TimeBudget);
+  if (!NumResults++) {
+    Time = R.TimeBudget;
+    Overhead = JobOverhead;
+  } else {
+    Overhead += kWeight * (JobOverhead - Overhead);
+  }
+  if (R.NumSeeds) {
+    double JobSeedCost = R.InitTime / static_cast<double>(R.NumSeeds);
+    SeedCost = SeedCost > 0 ? SeedCost + kWeight * (JobSeedCost - SeedCost)
+                            : JobSeedCost;
+  }
+  Time *= R.NumNewFeatures ? 0.8 : 1.25;
+  Time = std::min(static_cast<double>(kMaxJobTime),
+                  std::max({1.0, 10 * Overhead, Time}));
+}
 
-  int         DftTimeInSeconds = 0;
+size_t ForkJobTuner::JobTime(size_t JobId) const {
+  if (!NumResults)
+    return std::min(kMaxJobTime, JobId);
+  return static_cast<size_t>(Time + 0.5);
+}
 
-  // Fuzzing Outputs.
-  int ExitCode;
+size_t ForkJobTuner::NumSeeds(size_t NumFiles, size_t JobTime) const {
+  double Max = sqrt(static_cast<double>(NumFiles + 2)) *
+               std::min(2.0, std::max(1.0, sqrt(JobTime / 60.0)));
+  if (SeedCost > 0)
+    Max = std::min(Max, 0.1 * static_cast<double>(JobTime) / SeedCost);
+  return std::min(NumFiles, std::max<size_t>(1, static_cast<size_t>(Max)));
+}
 
-  ~FuzzJob() {
-    RemoveFile(CFPath);
-    RemoveFile(LogPath);
-    RemoveFile(SeedListPath);
-    RmDirRecursive(CorpusDir);
-    RmDirRecursive(FeaturesDir);
+size_t ForkJobTuner::NumCorpusGroups(size_t NumFiles, size_t NumSeeds) const {
+  return std::min<size_t>(
+      80, std::max<size_t>(12, NumFiles / (3 * std::max<size_t>(1, NumSeeds))));
+}
+
+void ForkSeedSelector::AddFile(const std::string &Path,
+                               const std::vector<uint32_t> &Features) {
+  auto &FI = Files[Path];
+  for (auto F : FI.Features)
+    if (!--FeatureFreqs[F])
+      FeatureFreqs.erase(F);
+  FI.Features = Features;
+  for (auto F : Features)
+    FeatureFreqs[F]++;
+}
+
+void ForkSeedSelector::KeepFiles(const std::vector<std::string> &Paths) {
+  std::unordered_set<std::string> Keep(Paths.begin(), Paths.end());
+  for (auto It = Files.begin(); It != Files.end();) {
+    if (Keep.count(It->first)) {
+      ++It;
+      continue;
+    }
+    for (auto F : It->second.Features)
+      if (!--FeatureFreqs[F])
+        FeatureFreqs.erase(F);
+    It = Files.erase(It);
+  }
+}
+
+std::vector<std::string>
+ForkSeedSelector::Choose(const std::vector<std::string> &Candidates,
+                         size_t NumSeeds, Random &Rand) {
+  // A file with unknown features counts as one unique feature. Files that
+  // add nothing new still get picked now and then.
+  const double kUnknownGain = 1.0, kMinGain = 0.01;
+  std::vector<std::string> Pool;
+  std::unordered_set<std::string> InPool;
+  for (auto &C : Candidates)
+    if (InPool.insert(C).second)
+      Pool.push_back(C);
+  // The gains are computed once, then only the candidates that have a newly
+  // covered feature are rescored.
+  std::vector<FileInfo *> Infos(Pool.size());
+  std::vector<double> Gains(Pool.size()), Yields(Pool.size());
+  std::unordered_map<uint32_t, std::vector<size_t>> Holders;
+  for (size_t i = 0; i < Pool.size(); i++) {
+    auto &FI = *(Infos[i] = &Files[Pool[i]]);
+    Gains[i] = FI.Features.empty() ? kUnknownGain : 0;
+    for (auto F : FI.Features) {
+      Gains[i] += 1.0 / FeatureFreqs[F];
+      Holders[F].push_back(i);
+    }
+    Yields[i] =
+        (FI.NewFeaturesFound + 1) / (static_cast<double>(FI.TimesChosen) + 1);
+  }
+  std::vector<std::string> Seeds;
+  std::vector<double> Weights(Pool.size());
+  for (size_t i = 0; i < Pool.size(); i++)
+    Weights[i] = (Gains[i] + kMinGain) * Yields[i];
+  for (size_t n = 0; n < NumSeeds && n < Pool.size(); n++) {
+    std::discrete_distribution<size_t> Dist(Weights.begin(), Weights.end());
+    size_t Idx = Dist(Rand);
+    auto &FI = *Infos[Idx];
+    FI.TimesChosen++;
+    Weights[Idx] = 0;
+    for (auto F : FI.Features) {
+      auto It = Holders.find(F);
+      if (It == Holders.end())
+        continue;  // Already covered.
+      double Rarity = 1.0 / FeatureFreqs[F];
+      for (auto i : It->second) {
+        Gains[i] -= Rarity;
+        if (Weights[i] > 0)
+          Weights[i] = (std::max(0.0, Gains[i]) + kMinGain) * Yields[i];
+      }
+      Holders.erase(It);
+    }
+    Seeds.push_back(std::move(Pool[Idx]));
+  }
+  return Seeds;
+}
+
+void ForkSeedSelector::AddJobResult(const std::vector<std::string> &Seeds,
+                                    size_t NumNewFeatures) {
+  // Every seed gets its share of the job's new features.
+  for (auto &S : Seeds)
+    Files[S].NewFeaturesFound +=
+        static_cast<double>(NumNewFeatures) / static_cast<double>(Seeds.size());
+}
+
+FuzzJob::~FuzzJob() {
+  RemoveFile(CFPath);
+  RemoveFile(LogPath);
+  RemoveFile(SeedListPath);
+  RemoveFile(FeaturesLog);
+  RmDirRecursive(CorpusDir);
+}
+
+// Collects the data flow traces (-collect_data_flow) of the seeds of the fork
+// jobs on a few threads, so that creating a job never waits for them. A job
+// runs with the traces that are ready, an input without one falls back to
+// the trace of its base input. The newest requests are served first: they
+// are the likeliest seeds of the next jobs. When too many are pending, the
+// oldest are dropped. Every process collects a batch of inputs.
+class DataFlowCollector {
+ public:
+  void Start(const std::vector<std::string> &Args,
+             const std::vector<std::string> &CorpusDirs,
+             const std::string &DFTDir, const std::string &TempDir,
+             size_t NumThreads) {
+    BaseCmd.reset(new Command(Args));
+    BaseCmd->removeFlag("fork");
+    BaseCmd->removeFlag("runs");
+    BaseCmd->addFlag("data_flow_trace", DFTDir);
+    for (auto &C : CorpusDirs) // Remove all corpora from the args.
+      BaseCmd->removeArgument(C);
+    BaseCmd->combineOutAndErr();
+    for (size_t i = 0; i < NumThreads; i++)
+      Threads.emplace_back([this, TempDir, i] {
+        Collect(DirPlusFile(TempDir, "dft." + std::to_string(i) + ".log"));
+      });
+  }
+
+  void Request(const std::string &InputPath) {
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      if (!Requested.insert(InputPath).second)
+        return;
+      Pending.push_back(InputPath);
+      if (Pending.size() > kMaxPending) {
+        Requested.erase(Pending.front());
+        Pending.pop_front();
+      }
+    }
+    Cv.notify_one();
+  }
+
+  // Waits for the running batches, the pending requests are dropped.
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Stopped = true;
+    }
+    Cv.notify_all();
+    for (auto &T : Threads)
+      T.join();
+    Threads.clear();
+  }
+
+  size_t NumCollected() const { return Collected; }
+  // The time spent in the tracing processes, summed over the threads.
+  size_t TracingSeconds() const { return TracingMicros / 1000000; }
+  size_t NumPending() {
+    std::lock_guard<std::mutex> Lock(Mu);
+    return Pending.size();
+  }
+
+ private:
+  static const size_t kMaxPending = 4096;
+  static const size_t kBatchSize = 64;
+
+  void Collect(const std::string &LogPath) {
+    while (true) {
+      Command Cmd(*BaseCmd);
+      size_t BatchSize = 0;
+      {
+        std::unique_lock<std::mutex> Lock(Mu);
+        Cv.wait(Lock, [&] { return Stopped || !Pending.empty(); });
+        if (Stopped)
+          return;
+        for (; BatchSize < kBatchSize && !Pending.empty(); BatchSize++) {
+          Cmd.addArgument(Pending.back());
+          Pending.pop_back();
+        }
+      }
+      Cmd.setOutputFile(LogPath);
+      // Printf("CollectDFT: %s\n", Cmd.toString().c_str());
+      auto Start = std::chrono::steady_clock::now();
+      ExecuteCommand(Cmd);
+      TracingMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - Start)
+                           .count();
+      Collected += BatchSize;
+    }
   }
+
+  std::unique_ptr<Command> BaseCmd;
+  std::mutex Mu;
+  std::condition_variable Cv;
+  std::deque<std::string> Pending;
+  std::unordered_set<std::string> Requested;
+  std::vector<std::thread> Threads;
+  std::atomic<size_t> Collected{0};
+  std::atomic<size_t> TracingMicros{0};
+  bool Stopped = false;
 };
 
 struct GlobalEnv {
   std::vector<std::string> Args;
   std::vector<std::string> CorpusDirs;
   std::string MainCorpusDir;
+  bool MainCorpusIsPacked = false;
   std::string TempDir;
   std::string DFTDir;
   std::string DataFlowBinary;
   std::set<uint32_t> Features, Cov;
-  std::set<std::string> FilesWithDFT;
+  DataFlowCollector DFTCollector;
   std::vector<std::string> Files;
   std::vector<std::size_t> FilesSizes;
   Random *Rand;
   std::chrono::system_clock::time_point ProcessStartTime;
   int Verbosity = 0;
   int Group = 0;
+  bool BinaryMergeControlFile = true;
+  std::string FeatureCacheDir;
   int NumCorpuses = 8;
+  bool AdaptiveJobs = false;
+  ForkJobTuner Tuner;
+  bool CoverageAwareSeeds = false;
+  ForkSeedSelector Selector;
 
   size_t NumTimeouts = 0;
   size_t NumOOMs = 0;
@@ -111,6 +332,14 @@ struct GlobalEnv {
 
   size_t NumRuns = 0;
 
+  // Guards the state above once the merge threads run. The feature cache is
+  // not safe for concurrent merges, FeatureCacheMu guards it.
+  std::mutex Mu, FeatureCacheMu;
+  size_t NumMergeThreads = 1;
+  // Microseconds spent in the stages of the pipeline, for the status line.
+  size_t NumWorkers = 1;
+  std::atomic<uint64_t> FuzzBusy{0}, MergeBusy{0}, CreateBusy{0};
+
   std::string StopFile() { return DirPlusFile(TempDir, "STOP"); }
 
   size_t secondsSinceProcessStartUp() const {
@@ -129,7 +358,9 @@ struct GlobalEnv {
     Cmd.addFlag("reload", "0");  // working in an isolated dir, no reload.
     Cmd.addFlag("print_final_stats", "1");
     Cmd.addFlag("print_funcs", "0");  // no need to spend time symbolizing.
-    Cmd.addFlag("max_total_time", std::to_string(std::min((size_t)300, JobId)));
+    size_t JobTime = AdaptiveJobs ? Tuner.JobTime(JobId)
+                                  : std::min((size_t)300, JobId);
+    Cmd.addFlag("max_total_time", std::to_string(JobTime));
     Cmd.addFlag("stop_file", StopFile());
     if (!DataFlowBinary.empty()) {
       Cmd.addFlag("data_flow_trace", DFTDir);
@@ -138,32 +369,37 @@ struct GlobalEnv {
     }
     auto Job = new FuzzJob;
     std::string Seeds;
-    if (size_t CorpusSubsetSize =
-            std::min(Files.size(), (size_t)sqrt(Files.size() + 2))) {
-      auto Time1 = std::chrono::system_clock::now();
+    size_t CorpusSubsetSize =
+        AdaptiveJobs ? Tuner.NumSeeds(Files.size(), JobTime)
+                     : std::min(Files.size(), (size_t)sqrt(Files.size() + 2));
+    Job->TimeBudget = JobTime;
+    Job->NumSeeds = CorpusSubsetSize;
+    if (CorpusSubsetSize) {
+      // With coverage aware seeds the usual draws are the candidates.
+      size_t NumDraws =
+          CoverageAwareSeeds ? 4 * CorpusSubsetSize : CorpusSubsetSize;
+      std::vector<std::string> Candidates;
       if (Group) { // whether to group the corpus.
         size_t AverageCorpusSize = Files.size() / NumCorpuses + 1;
         size_t StartIndex = ((JobId - 1) % NumCorpuses) * AverageCorpusSize;
-        for (size_t i = 0; i < CorpusSubsetSize; i++) {
+        for (size_t i = 0; i < NumDraws; i++) {
           size_t RandNum = (*Rand)(AverageCorpusSize);
           size_t Index = RandNum + StartIndex;
           Index = Index < Files.size() ? Index
                                        : Rand->SkewTowardsLast(Files.size());
-          auto &SF = Files[Index];
-          Seeds += (Seeds.empty() ? "" : ",") + SF;
-          CollectDFT(SF);
+          Candidates.push_back(Files[Index]);
         }
       } else {
-        for (size_t i = 0; i < CorpusSubsetSize; i++) {
-          auto &SF = Files[Rand->SkewTowardsLast(Files.size())];
-          Seeds += (Seeds.empty() ? "" : ",") + SF;
-          CollectDFT(SF);
-        }
+        for (size_t i = 0; i < NumDraws; i++)
+          Candidates.push_back(Files[Rand->SkewTowardsLast(Files.size())]);
+      }
+      Job->Seeds = CoverageAwareSeeds
+                       ? Selector.Choose(Candidates, CorpusSubsetSize, *Rand)
+                       : Candidates;
+      for (auto &SF : Job->Seeds) {
+        Seeds += (Seeds.empty() ? "" : ",") + SF;
+        CollectDFT(SF);
       }
-      auto Time2 = std::chrono::system_clock::now();
-      auto DftTimeInSeconds = duration_cast<seconds>(Time2 - Time1).count();
-      assert(DftTimeInSeconds < std::numeric_limits<int>::max());
-      Job->DftTimeInSeconds = static_cast<int>(DftTimeInSeconds);
     }
     if (!Seeds.empty()) {
       Job->SeedListPath =
@@ -173,18 +409,18 @@ struct GlobalEnv {
     }
     Job->LogPath = DirPlusFile(TempDir, std::to_string(JobId) + ".log");
     Job->CorpusDir = DirPlusFile(TempDir, "C" + std::to_string(JobId));
-    Job->FeaturesDir = DirPlusFile(TempDir, "F" + std::to_string(JobId));
+    Job->FeaturesLog = DirPlusFile(TempDir, std::to_string(JobId) + ".ft");
     Job->CFPath = DirPlusFile(TempDir, std::to_string(JobId) + ".merge");
     Job->JobId = JobId;
 
 
     Cmd.addArgument(Job->CorpusDir);
-    Cmd.addFlag("features_dir", Job->FeaturesDir);
-
-    for (auto &D : {Job->CorpusDir, Job->FeaturesDir}) {
-      RmDirRecursive(D);
-      MkDir(D);
-    }
+    // One feature log per job instead of a file per new input: the job
+    // writes one file and the merge below reads it with one pass.
+    Cmd.addFlag("features_log", Job->FeaturesLog);
+    RemoveFile(Job->FeaturesLog);
+    RmDirRecursive(Job->CorpusDir);
+    MkDir(Job->CorpusDir);
 
     Cmd.setOutputFile(Job->LogPath);
     Cmd.combineOutAndErr();
@@ -198,23 +434,48 @@ struct GlobalEnv {
     return Job;
   }
 
+  // Utilization of a stage with NumThreads threads since the start, in %.
+  size_t Utilization(const std::atomic<uint64_t> &Busy,
+                     size_t NumThreads) const {
+    auto Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now() - ProcessStartTime)
+                       .count();
+    return Elapsed > 0 ? static_cast<size_t>(Busy * 100 / NumThreads /
+                                             static_cast<uint64_t>(Elapsed))
+                       : 0;
+  }
+
+  // Called by the merge threads, concurrently. The merge itself runs without
+  // the lock, against a snapshot of the features.
   void RunOneMergeJob(FuzzJob *Job) {
     auto Stats = ParseFinalStatsFromLog(Job->LogPath);
-    NumRuns += Stats.number_of_executed_units;
+    ForkJobTuner::JobResult Result;
+    Result.TimeBudget = static_cast<double>(Job->TimeBudget);
+    Result.WallTime = Job->WallTime;
+    Result.InitTime = static_cast<double>(Stats.init_time_ms) / 1000;
+    Result.NumSeeds = Job->NumSeeds;
 
     std::vector<SizedFile> TempFiles, MergeCandidates;
     // Read all newly created inputs and their feature sets.
     // Choose only those inputs that have new features.
     GetSizedFilesFromDir(Job->CorpusDir, &TempFiles);
     std::sort(TempFiles.begin(), TempFiles.end());
+    std::unordered_map<std::string, std::vector<uint32_t>> FeatureLog;
+    size_t LogSize = 0;
+    const uint8_t *LogData = MapFile(Job->FeaturesLog, &LogSize);
+    if (LogData && !ParseMergeFeatureCache(LogData, LogSize, &FeatureLog))
+      Printf("WARNING: bad feature log of job %zd\n", Job->JobId);
+    UnmapFile(LogData, LogSize);
+    std::unordered_map<std::string, const std::vector<uint32_t> *> ByName;
+    for (auto &KV : FeatureLog)
+      ByName[Sha1ToString(
+          reinterpret_cast<const uint8_t *>(KV.first.data()))] = &KV.second;
+    std::unique_lock<std::mutex> Lock(Mu);
+    NumRuns += Stats.number_of_executed_units;
     for (auto &F : TempFiles) {
-      auto FeatureFile = F.File;
-      FeatureFile.replace(0, Job->CorpusDir.size(), Job->FeaturesDir);
-      auto FeatureBytes = FileToVector(FeatureFile, 0, false);
-      assert((FeatureBytes.size() % sizeof(uint32_t)) == 0);
-      std::vector<uint32_t> NewFeatures(FeatureBytes.size() / sizeof(uint32_t));
-      memcpy(NewFeatures.data(), FeatureBytes.data(), FeatureBytes.size());
-      for (auto Ft : NewFeatures) {
+      auto It = ByName.find(Basename(F.File));
+      if (It == ByName.end()) continue;
+      for (auto Ft : *It->second) {
         if (!Features.count(Ft)) {
           MergeCandidates.push_back(F);
           break;
@@ -222,25 +483,69 @@ struct GlobalEnv {
       }
     }
     // if (!FilesToAdd.empty() || Job->ExitCode != 0)
+    std::string DFTStatus;
+    if (!DataFlowBinary.empty())
+      DFTStatus = " dft: " + std::to_string(DFTCollector.NumCollected()) +
+                  "/" + std::to_string(DFTCollector.NumPending());
     Printf("#%zd: cov: %zd ft: %zd corp: %zd exec/s: %zd "
-           "oom/timeout/crash: %zd/%zd/%zd time: %zds job: %zd dft_time: %d\n",
+           "oom/timeout/crash: %zd/%zd/%zd time: %zds job: %zd dft_time: %zd "
+           "util: fuzz %zd%% merge %zd%% create %zd%%%s\n",
            NumRuns, Cov.size(), Features.size(), Files.size(),
            Stats.average_exec_per_sec, NumOOMs, NumTimeouts, NumCrashes,
-           secondsSinceProcessStartUp(), Job->JobId, Job->DftTimeInSeconds);
-
-    if (MergeCandidates.empty()) return;
+           secondsSinceProcessStartUp(), Job->JobId,
+           DFTCollector.TracingSeconds(), Utilization(FuzzBusy, NumWorkers),
+           Utilization(MergeBusy, NumMergeThreads), Utilization(CreateBusy, 1),
+           DFTStatus.c_str());
+
+    if (MergeCandidates.empty()) {
+      Tuner.AddJobResult(Result);
+      if (CoverageAwareSeeds)
+        Selector.AddJobResult(Job->Seeds, 0);
+      return;
+    }
 
+    // Another merge may add some of the same features meanwhile, then a few
+    // redundant inputs get into the corpus.
+    auto FeaturesSnapshot = Features;
+    auto CovSnapshot = Cov;
+    Lock.unlock();
     std::vector<std::string> FilesToAdd;
     std::set<uint32_t> NewFeatures, NewCov;
+    std::unordered_map<std::string, std::vector<uint32_t>> FileFeatures;
     bool IsSetCoverMerge =
         !Job->Cmd.getFlagValue("set_cover_merge").compare("1");
-    CrashResistantMerge(Args, {}, MergeCandidates, &FilesToAdd, Features,
-                        &NewFeatures, Cov, &NewCov, Job->CFPath, false,
-                        IsSetCoverMerge);
+    auto MergeStart = std::chrono::steady_clock::now();
+    {
+      // Concurrent merges would share the cache, they do without it.
+      bool UseCache = NumMergeThreads == 1 && !FeatureCacheDir.empty();
+      std::unique_lock<std::mutex> CacheLock(FeatureCacheMu, std::defer_lock);
+      if (UseCache)
+        CacheLock.lock();
+      CrashResistantMerge(Args, {}, MergeCandidates, &FilesToAdd,
+                          FeaturesSnapshot, &NewFeatures, CovSnapshot, &NewCov,
+                          Job->CFPath, false, IsSetCoverMerge,
+                          BinaryMergeControlFile, /*NumJobs=*/1,
+                          UseCache ? FeatureCacheDir : "",
+                          CoverageAwareSeeds ? &FileFeatures : nullptr);
+    }
+    Result.MergeTime = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - MergeStart)
+                           .count();
+    Lock.lock();
     for (auto &Path : FilesToAdd) {
       auto U = FileToVector(Path);
-      auto NewPath = DirPlusFile(MainCorpusDir, Hash(U));
-      WriteToFile(U, NewPath);
+      std::string NewPath;
+      if (MainCorpusIsPacked) {
+        NewPath = AppendToPackedCorpus(U, MainCorpusDir);
+        if (NewPath.empty())
+          continue;  // The pack can't be written.
+      } else {
+        NewPath = DirPlusFile(MainCorpusDir, Hash(U));
+        WriteToFile(U, NewPath);
+      }
+      if (CoverageAwareSeeds)
+        Selector.AddFile(NewPath, FileFeatures[Path]);
+      CollectDFT(NewPath);  // A likely seed of the next jobs.
       if (Group) { // Insert the queue according to the size of the seed.
         size_t UnitSize = U.size();
         auto Idx =
@@ -252,7 +557,12 @@ struct GlobalEnv {
         Files.push_back(NewPath);
       }
     }
+    size_t NumFeaturesBefore = Features.size();
     Features.insert(NewFeatures.begin(), NewFeatures.end());
+    Result.NumNewFeatures = Features.size() - NumFeaturesBefore;
+    Tuner.AddJobResult(Result);
+    if (CoverageAwareSeeds)
+      Selector.AddJobResult(Job->Seeds, Result.NumNewFeatures);
     Cov.insert(NewCov.begin(), NewCov.end());
     for (auto Idx : NewCov)
       if (auto *TE = TPC.PCTableEntryByIdx(Idx))
@@ -263,18 +573,7 @@ struct GlobalEnv {
 
   void CollectDFT(const std::string &InputPath) {
     if (DataFlowBinary.empty()) return;
-    if (!FilesWithDFT.insert(InputPath).second) return;
-    Command Cmd(Args);
-    Cmd.removeFlag("fork");
-    Cmd.removeFlag("runs");
-    Cmd.addFlag("data_flow_trace", DFTDir);
-    Cmd.addArgument(InputPath);
-    for (auto &C : CorpusDirs) // Remove all corpora from the args.
-      Cmd.removeArgument(C);
-    Cmd.setOutputFile(DirPlusFile(TempDir, "dft.log"));
-    Cmd.combineOutAndErr();
-    // Printf("CollectDFT: %s\n", Cmd.toString().c_str());
-    ExecuteCommand(Cmd);
+    DFTCollector.Request(InputPath);
   }
 
 };
@@ -300,13 +599,81 @@ struct JobQueue {
     Qu.pop();
     return Job;
   }
+  size_t Size() {
+    std::lock_guard<std::mutex> Lock(Mu);
+    return Qu.size();
+  }
 };
 
-void WorkerThread(JobQueue *FuzzQ, JobQueue *MergeQ) {
-  while (auto Job = FuzzQ->Pop()) {
+void FuzzJobDeques::Push(FuzzJob *Job) {
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Deques[NextDeque++ % Deques.size()].push_back(Job);
+  }
+  Cv.notify_one();
+}
+
+FuzzJob *FuzzJobDeques::Pop(size_t Worker) {
+  std::unique_lock<std::mutex> Lock(Mu);
+  while (true) {
+    if (Stopped)
+      return nullptr;
+    auto &Own = Deques[Worker];
+    if (!Own.empty()) {
+      auto Job = Own.front();
+      Own.pop_front();
+      return Job;
+    }
+    auto Victim = std::max_element(
+        Deques.begin(), Deques.end(),
+        [](const std::deque<FuzzJob *> &A, const std::deque<FuzzJob *> &B) {
+          return A.size() < B.size();
+        });
+    if (!Victim->empty()) {
+      auto Job = Victim->back();
+      Victim->pop_back();
+      Steals++;
+      return Job;
+    }
+    Cv.wait(Lock);
+  }
+}
+
+void FuzzJobDeques::Stop() {
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Stopped = true;
+    for (auto &D : Deques) {
+      for (auto Job : D)
+        delete Job;
+      D.clear();
+    }
+  }
+  Cv.notify_all();
+}
+
+void WorkerThread(GlobalEnv *Env, size_t Worker, FuzzJobDeques *FuzzQ,
+                  JobQueue *DoneQ) {
+  while (auto Job = FuzzQ->Pop(Worker)) {
     // Printf("WorkerThread: job %p\n", Job);
+    auto Start = std::chrono::steady_clock::now();
     Job->ExitCode = ExecuteCommand(Job->Cmd);
-    MergeQ->Push(Job);
+    auto Elapsed = std::chrono::steady_clock::now() - Start;
+    Job->WallTime = std::chrono::duration<double>(Elapsed).count();
+    Env->FuzzBusy +=
+        std::chrono::duration_cast<std::chrono::microseconds>(Elapsed).count();
+    DoneQ->Push(Job);
+  }
+}
+
+void MergeThread(GlobalEnv *Env, JobQueue *MergeQ) {
+  while (auto Job = MergeQ->Pop()) {
+    auto Start = std::chrono::steady_clock::now();
+    Env->RunOneMergeJob(Job);
+    delete Job;
+    Env->MergeBusy += std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - Start)
+                          .count();
   }
 }
 
@@ -324,6 +691,9 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
   Env.ProcessStartTime = std::chrono::system_clock::now();
   Env.DataFlowBinary = Options.CollectDataFlow;
   Env.Group = Options.ForkCorpusGroups;
+  Env.BinaryMergeControlFile = Options.BinaryMergeControlFile;
+  Env.AdaptiveJobs = Options.ForkAdaptiveJobs;
+  Env.CoverageAwareSeeds = Options.ForkCoverageAwareSeeds;
 
   std::vector<SizedFile> SeedFiles;
   for (auto &Dir : CorpusDirs)
@@ -340,6 +710,9 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
     MkDir(Env.MainCorpusDir = DirPlusFile(Env.TempDir, "C"));
   else
     Env.MainCorpusDir = CorpusDirs[0];
+  Env.MainCorpusIsPacked = IsPackedCorpus(Env.MainCorpusDir);
+  if (Options.MergeFeatureCache)
+    Env.FeatureCacheDir = MergeFeatureCacheDir(Env.MainCorpusDir);
 
   if (Options.KeepSeed) {
     for (auto &File : SeedFiles)
@@ -347,9 +720,15 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
   } else {
     auto CFPath = DirPlusFile(Env.TempDir, "merge.txt");
     std::set<uint32_t> NewFeatures, NewCov;
+    std::unordered_map<std::string, std::vector<uint32_t>> FileFeatures;
     CrashResistantMerge(Env.Args, {}, SeedFiles, &Env.Files, Env.Features,
                         &NewFeatures, Env.Cov, &NewCov, CFPath,
-                        /*Verbose=*/false, /*IsSetCoverMerge=*/false);
+                        /*Verbose=*/false, /*IsSetCoverMerge=*/false,
+                        Env.BinaryMergeControlFile, NumJobs,
+                        Env.FeatureCacheDir,
+                        Env.CoverageAwareSeeds ? &FileFeatures : nullptr);
+    for (auto &KV : FileFeatures)
+      Env.Selector.AddFile(KV.first, KV.second);
     Env.Features.insert(NewFeatures.begin(), NewFeatures.end());
     Env.Cov.insert(NewFeatures.begin(), NewFeatures.end());
     RemoveFile(CFPath);
@@ -360,46 +739,110 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
       Env.FilesSizes.push_back(FileSize(path));
   }
 
+  if (!Env.DataFlowBinary.empty()) {
+    Env.DFTCollector.Start(
+        Env.Args, Env.CorpusDirs, Env.DFTDir, Env.TempDir,
+        static_cast<size_t>(std::max(1, Options.ForkDftThreads)));
+    for (auto &File : Env.Files)
+      Env.CollectDFT(File);
+  }
+
   Printf("INFO: -fork=%d: %zd seed inputs, starting to fuzz in %s\n", NumJobs,
          Env.Files.size(), Env.TempDir.c_str());
 
   int ExitCode = 0;
 
-  JobQueue FuzzQ, MergeQ;
+  // Finished jobs go from the workers to this thread, and from it to the
+  // merge threads. Replacement jobs are created right away, a few ahead of
+  // demand, so the workers don't wait for merges.
+  Env.NumWorkers = static_cast<size_t>(NumJobs);
+  Env.NumMergeThreads =
+      Options.ForkMergeThreads > 0
+          ? static_cast<size_t>(Options.ForkMergeThreads)
+          : std::min<size_t>(8, std::max<size_t>(1, NumJobs / 8));
+  size_t JobsAhead = static_cast<size_t>(NumJobs) / 4 + 1;
+  FuzzJobDeques FuzzQ(static_cast<size_t>(NumJobs));
+  JobQueue DoneQ, MergeQ;
+
+  auto CreateNewJob = [&](size_t JobId) {
+    auto Start = std::chrono::steady_clock::now();
+    FuzzJob *Job;
+    {
+      std::lock_guard<std::mutex> Lock(Env.Mu);
+      Job = Env.CreateNewJob(JobId);
+    }
+    Env.CreateBusy += std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - Start)
+                          .count();
+    return Job;
+  };
 
   auto StopJobs = [&]() {
-    for (int i = 0; i < NumJobs; i++)
-      FuzzQ.Push(nullptr);
-    MergeQ.Push(nullptr);
+    FuzzQ.Stop();
     WriteToFile(Unit({1}), Env.StopFile());
   };
 
   size_t MergeCycle = 20;
   size_t JobExecuted = 0;
   size_t JobId = 1;
-  std::vector<std::thread> Threads;
-  for (int t = 0; t < NumJobs; t++) {
-    Threads.push_back(std::thread(WorkerThread, &FuzzQ, &MergeQ));
-    FuzzQ.Push(Env.CreateNewJob(JobId++));
-  }
+  std::vector<std::thread> Threads, MergeThreads;
+  for (size_t t = 0; t < Env.NumMergeThreads; t++)
+    MergeThreads.push_back(std::thread(MergeThread, &Env, &MergeQ));
+  for (int t = 0; t < NumJobs; t++)
+    Threads.push_back(std::thread(WorkerThread, &Env, static_cast<size_t>(t),
+                                  &FuzzQ, &DoneQ));
+  for (size_t i = 0; i < static_cast<size_t>(NumJobs) + JobsAhead; i++)
+    FuzzQ.Push(CreateNewJob(JobId++));
 
   while (true) {
-    std::unique_ptr<FuzzJob> Job(MergeQ.Pop());
-    if (!Job)
-      break;
+    auto Job = DoneQ.Pop();
     ExitCode = Job->ExitCode;
     if (ExitCode == Options.InterruptExitCode) {
       Printf("==%lu== libFuzzer: a child was interrupted; exiting\n", GetPid());
+      delete Job;
       StopJobs();
       break;
     }
     Fuzzer::MaybeExitGracefully();
 
-    Env.RunOneMergeJob(Job.get());
+    // Continue if our crash is one of the ignored ones.
+    bool Stop = false;
+    {
+      std::lock_guard<std::mutex> Lock(Env.Mu);
+      if (Options.IgnoreTimeouts && ExitCode == Options.TimeoutExitCode)
+        Env.NumTimeouts++;
+      else if (Options.IgnoreOOMs && ExitCode == Options.OOMExitCode)
+        Env.NumOOMs++;
+      else if (ExitCode != 0) {
+        Env.NumCrashes++;
+        if (Options.IgnoreCrashes) {
+          std::ifstream In(Job->LogPath);
+          std::string Line;
+          while (std::getline(In, Line, '\n'))
+            if (Line.find("ERROR:") != Line.npos ||
+                Line.find("runtime error:") != Line.npos)
+              Printf("%s\n", Line.c_str());
+        } else {
+          // And exit if we don't ignore this crash.
+          Printf("INFO: log from the inner process:\n%s",
+                 FileToString(Job->LogPath).c_str());
+          Stop = true;
+        }
+      }
+    }
+
+    // The merge threads own the job from here on.
+    MergeQ.Push(Job);
+    if (Stop) {
+      StopJobs();
+      break;
+    }
 
     // merge the corpus .
     JobExecuted++;
     if (Env.Group && JobExecuted >= MergeCycle) {
+      std::lock_guard<std::mutex> Lock(Env.Mu);
+      std::lock_guard<std::mutex> CacheLock(Env.FeatureCacheMu);
       std::vector<SizedFile> CurrentSeedFiles;
       for (auto &Dir : CorpusDirs)
         GetSizedFilesFromDir(Dir, &CurrentSeedFiles);
@@ -408,11 +851,19 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
       auto CFPath = DirPlusFile(Env.TempDir, "merge.txt");
       std::set<uint32_t> TmpNewFeatures, TmpNewCov;
       std::set<uint32_t> TmpFeatures, TmpCov;
+      std::unordered_map<std::string, std::vector<uint32_t>> FileFeatures;
       Env.Files.clear();
       Env.FilesSizes.clear();
       CrashResistantMerge(Env.Args, {}, CurrentSeedFiles, &Env.Files,
                           TmpFeatures, &TmpNewFeatures, TmpCov, &TmpNewCov,
-                          CFPath, /*Verbose=*/false, /*IsSetCoverMerge=*/false);
+                          CFPath, /*Verbose=*/false, /*IsSetCoverMerge=*/false,
+                          Env.BinaryMergeControlFile, /*NumJobs=*/1,
+                          Env.FeatureCacheDir,
+                          Env.CoverageAwareSeeds ? &FileFeatures : nullptr);
+      for (auto &KV : FileFeatures)
+        Env.Selector.AddFile(KV.first, KV.second);
+      if (Env.CoverageAwareSeeds)
+        Env.Selector.KeepFiles(Env.Files);
       for (auto &path : Env.Files)
         Env.FilesSizes.push_back(FileSize(path));
       RemoveFile(CFPath);
@@ -420,42 +871,31 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
       MergeCycle += 5;
     }
 
-    // Since the number of corpus seeds will gradually increase, in order to
-    // control the number in each group to be about three times the number of
-    // seeds selected each time, the number of groups is dynamically adjusted.
-    if (Env.Files.size() < 2000)
-      Env.NumCorpuses = 12;
-    else if (Env.Files.size() < 6000)
-      Env.NumCorpuses = 20;
-    else if (Env.Files.size() < 12000)
-      Env.NumCorpuses = 32;
-    else if (Env.Files.size() < 16000)
-      Env.NumCorpuses = 40;
-    else if (Env.Files.size() < 24000)
-      Env.NumCorpuses = 60;
-    else
-      Env.NumCorpuses = 80;
-
-    // Continue if our crash is one of the ignored ones.
-    if (Options.IgnoreTimeouts && ExitCode == Options.TimeoutExitCode)
-      Env.NumTimeouts++;
-    else if (Options.IgnoreOOMs && ExitCode == Options.OOMExitCode)
-      Env.NumOOMs++;
-    else if (ExitCode != 0) {
-      Env.NumCrashes++;
-      if (Options.IgnoreCrashes) {
-        std::ifstream In(Job->LogPath);
-        std::string Line;
-        while (std::getline(In, Line, '\n'))
-          if (Line.find("ERROR:") != Line.npos ||
-              Line.find("runtime error:") != Line.npos)
-            Printf("%s\n", Line.c_str());
+    size_t NumRuns;
+    {
+      std::lock_guard<std::mutex> Lock(Env.Mu);
+      NumRuns = Env.NumRuns;
+      // Since the number of corpus seeds will gradually increase, in order
+      // to control the number in each group to be about three times the
+      // number of seeds selected each time, the number of groups is
+      // dynamically adjusted.
+      if (Env.AdaptiveJobs) {
+        size_t NumFiles = Env.Files.size();
+        Env.NumCorpuses = static_cast<int>(Env.Tuner.NumCorpusGroups(
+            NumFiles,
+            Env.Tuner.NumSeeds(NumFiles, Env.Tuner.JobTime(JobId))));
+      } else if (Env.Files.size() < 2000) {
+        Env.NumCorpuses = 12;
+      } else if (Env.Files.size() < 6000) {
+        Env.NumCorpuses = 20;
+      } else if (Env.Files.size() < 12000) {
+        Env.NumCorpuses = 32;
+      } else if (Env.Files.size() < 16000) {
+        Env.NumCorpuses = 40;
+      } else if (Env.Files.size() < 24000) {
+        Env.NumCorpuses = 60;
       } else {
-        // And exit if we don't ignore this crash.
-        Printf("INFO: log from the inner process:\n%s",
-               FileToString(Job->LogPath).c_str());
-        StopJobs();
-        break;
+        Env.NumCorpuses = 80;
       }
     }
 
@@ -470,18 +910,29 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
       StopJobs();
       break;
     }
-    if (Env.NumRuns >= Options.MaxNumberOfRuns) {
-      Printf("INFO: fuzzed for %zd iterations, wrapping up soon\n",
-             Env.NumRuns);
+    if (NumRuns >= Options.MaxNumberOfRuns) {
+      Printf("INFO: fuzzed for %zd iterations, wrapping up soon\n", NumRuns);
       StopJobs();
       break;
     }
 
-    FuzzQ.Push(Env.CreateNewJob(JobId++));
+    FuzzQ.Push(CreateNewJob(JobId++));
   }
 
   for (auto &T : Threads)
     T.join();
+  // The merges of the finished jobs are completed, the jobs that finished
+  // after the stop are dropped.
+  for (size_t t = 0; t < Env.NumMergeThreads; t++)
+    MergeQ.Push(nullptr);
+  for (auto &T : MergeThreads)
+    T.join();
+  Env.DFTCollector.Stop();
+  while (DoneQ.Size())
+    delete DoneQ.Pop();
+  if (Options.Verbosity >= 2)
+    Printf("INFO: -fork=%d: %zd jobs were stolen\n", NumJobs,
+           FuzzQ.NumSteals());
 
   // The workers have terminated. Don't try to remove the directory before they
   // terminate to avoid a race condition preventing cleanup on Windows.
@@ -9,13 +9,128 @@
 #ifndef LLVM_FUZZER_FORK_H
 #define LLVM_FUZZER_FORK_H
 
+#include "FuzzerCommand.h"
 #include "FuzzerDefs.h"
 #include "FuzzerOptions.h"
 #include "FuzzerRandom.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 namespace fuzzer {
+
+// Tunes the fork jobs (-fork_adaptive_jobs=1) from the results of the
+// finished ones. The job time starts with the usual ramp up and then grows
+// while the jobs find nothing new and shrinks while they do, so that long
+// jobs don't fuzz a stale corpus. It stays at least 10 times the overhead of
+// a job (startup, seed loading, merge). The seed subset size is sqrt(corpus
+// size), up to twice that for long jobs, and less if loading the seeds would
+// take more than 10% of the job. The number of corpus groups keeps each
+// group at about 3 subsets.
+class ForkJobTuner {
+ public:
+  struct JobResult {
+    double TimeBudget = 0;  // -max_total_time of the job.
+    double WallTime = 0;
+    double InitTime = 0;    // Startup and seed corpus execution.
+    double MergeTime = 0;
+    size_t NumSeeds = 0;
+    size_t NumNewFeatures = 0;  // Added to the main corpus.
+  };
+
+  void AddJobResult(const JobResult &R);
+  size_t JobTime(size_t JobId) const;  // In seconds.
+  size_t NumSeeds(size_t NumFiles, size_t JobTime) const;
+  size_t NumCorpusGroups(size_t NumFiles, size_t NumSeeds) const;
+
+  static constexpr size_t kMaxJobTime = 300;
+
+ private:
+  size_t NumResults = 0;
+  double Time = 0;
+  double Overhead = 0;  // Moving averages.
+  double SeedCost = 0;
+};
+
+// Chooses the seeds of the fork jobs (-fork_coverage_aware_seeds=1), the
+// entropic idea at the level of the jobs. The parent knows the features the
+// merge recorded for each corpus file, how often each feature occurs in the
+// corpus, how often a file was a seed and how many new features the jobs it
+// was a seed of found. A job's seeds are picked one by one from a pool of
+// candidates, each with a probability proportional to the rarity of the
+// features it adds to the ones already picked (the sum of 1/frequency),
+// times its smoothed yield per job.
+class ForkSeedSelector {
+ public:
+  // Features is empty if they are unknown (e.g. -keep_seed=1 seeds).
+  void AddFile(const std::string &Path, const std::vector<uint32_t> &Features);
+  // Forgets the files that are not in Paths, e.g. after the corpus was merged.
+  void KeepFiles(const std::vector<std::string> &Paths);
+  std::vector<std::string> Choose(const std::vector<std::string> &Candidates,
+                                  size_t NumSeeds, Random &Rand);
+  void AddJobResult(const std::vector<std::string> &Seeds,
+                    size_t NumNewFeatures);
+
+ private:
+  struct FileInfo {
+    std::vector<uint32_t> Features;
+    size_t TimesChosen = 0;
+    double NewFeaturesFound = 0;
+  };
+  std::unordered_map<std::string, FileInfo> Files;
+  std::unordered_map<uint32_t, uint32_t> FeatureFreqs;
+};
+
+struct FuzzJob {
+  // Inputs.
+  Command Cmd;
+  std::string CorpusDir;
+  std::string FeaturesLog;
+  std::string LogPath;
+  std::string SeedListPath;
+  std::string CFPath;
+  size_t      JobId;
+
+  size_t      TimeBudget = 0;
+  size_t      NumSeeds = 0;
+  std::vector<std::string> Seeds;
+  double      WallTime = 0;
+
+  // Fuzzing Outputs.
+  int ExitCode;
+
+  // Removes the files of the job.
+  ~FuzzJob();
+};
+
+// The jobs to fuzz: a deque per worker. A worker takes the jobs of its own
+// deque first and steals from the back of the longest other one when it runs
+// dry, so new jobs are spread over the workers without a single hot queue.
+// Jobs take seconds, one lock for all deques is enough.
+class FuzzJobDeques {
+ public:
+  explicit FuzzJobDeques(size_t NumWorkers) : Deques(NumWorkers) {}
+
+  void Push(FuzzJob *Job);
+  // Returns nullptr once stopped.
+  FuzzJob *Pop(size_t Worker);
+  // Wakes up the workers, the jobs that were not taken are deleted.
+  void Stop();
+
+  size_t NumSteals() const { return Steals; }
+
+ private:
+  std::mutex Mu;
+  std::condition_variable Cv;
+  std::vector<std::deque<FuzzJob *>> Deques;
+  size_t NextDeque = 0;
+  size_t Steals = 0;
+  bool Stopped = false;
+};
+
 void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
                   const std::vector<std::string> &Args,
                   const std::vector<std::string> &CorpusDirs, int NumJobs);
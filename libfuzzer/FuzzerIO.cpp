@@ -13,6 +13,7 @@
 #include "FuzzerDefs.h"
 #include "FuzzerExtFunctions.h"
 #include "FuzzerIO.h"
+#include "FuzzerPack.h"
 #include "FuzzerUtil.h"
 #include <algorithm>
 #include <cstdarg>
@@ -41,6 +42,9 @@ long GetEpoch(const std::string &Path) {
 }
 
 Unit FileToVector(const std::string &Path, size_t MaxSize, bool ExitOnError) {
+  Unit Packed;
+  if (ReadPackedUnit(Path, MaxSize, &Packed))
+    return Packed;
   std::ifstream T(Path, std::ios::binary);
   if (ExitOnError && !T) {
     Printf("No such directory: %s; exiting\n", Path.c_str());
@@ -103,6 +107,14 @@ void AppendToFile(const uint8_t *Data, size_t Size, const std::string &Path) {
 void ReadDirToVectorOfUnits(const char *Path, std::vector<Unit> *V, long *Epoch,
                             size_t MaxSize, bool ExitOnError,
                             std::vector<std::string> *VPaths) {
+  if (IsPackedCorpus(Path)) {
+    // The epoch of a packed corpus is the offset of its unread records.
+    size_t Offset = Epoch ? static_cast<size_t>(*Epoch) : 0;
+    ReadPackedCorpus(Path, &Offset, MaxSize, V, VPaths);
+    if (Epoch)
+      *Epoch = static_cast<long>(Offset);
+    return;
+  }
   long E = Epoch ? *Epoch : 0;
   std::vector<std::string> Files;
   ListFilesInDirRecursive(Path, Epoch, &Files, /*TopDir*/true);
@@ -123,6 +135,8 @@ void ReadDirToVectorOfUnits(const char *Path, std::vector<Unit> *V, long *Epoch,
 }
 
 void GetSizedFilesFromDir(const std::string &Dir, std::vector<SizedFile> *V) {
+  if (IsPackedCorpus(Dir))
+    return ListPackedCorpus(Dir, V);
   std::vector<std::string> Files;
   ListFilesInDirRecursive(Dir, 0, &Files, /*TopDir*/true);
   for (auto &File : Files)
@@ -32,6 +32,11 @@ void WriteToFile(const Unit &U, const std::string &Path);
 void AppendToFile(const uint8_t *Data, size_t Size, const std::string &Path);
 void AppendToFile(const std::string &Data, const std::string &Path);
 
+// Maps the whole file into memory for reading. Returns nullptr if the file
+// can not be read or is empty. The mapping is released by UnmapFile.
+const uint8_t *MapFile(const std::string &Path, size_t *Size);
+void UnmapFile(const uint8_t *Data, size_t Size);
+
 void ReadDirToVectorOfUnits(const char *Path, std::vector<Unit> *V, long *Epoch,
                             size_t MaxSize, bool ExitOnError,
                             std::vector<std::string> *VPaths = 0);
@@ -73,6 +78,14 @@ size_t FileSize(const std::string &Path);
 void ListFilesInDirRecursive(const std::string &Dir, long *Epoch,
                              std::vector<std::string> *V, bool TopDir);
 
+// Watches Dir and its subdirs for new files on a thread (inotify), so that
+// they can be found without rescanning Dir. Only one dir per process.
+// Returns false if the platform can't watch dirs or the watch limit is hit.
+bool StartDirWatcher(const std::string &Dir);
+// Moves the files written to the watched dir since the last call to V.
+// Returns false if events were lost and Dir needs to be rescanned.
+bool TakeNewFilesFromDirWatcher(std::vector<std::string> *V);
+
 bool MkDirRecursive(const std::string &Dir);
 void RmDirRecursive(const std::string &Dir);
 
@@ -105,6 +118,8 @@ int DuplicateFile(int Fd);
 
 void RemoveFile(const std::string &Path);
 void RenameFile(const std::string &OldPath, const std::string &NewPath);
+// Flushes the file to the disk (fsync).
+void SyncFile(const std::string &Path);
 
 intptr_t GetHandleFromFd(int fd);
 
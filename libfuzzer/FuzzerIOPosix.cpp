@@ -14,15 +14,26 @@
 
 #include "FuzzerExtFunctions.h"
 #include "FuzzerIO.h"
+#include "FuzzerPack.h"
+#include "FuzzerUtil.h"
 #include <cstdarg>
 #include <cstdio>
 #include <dirent.h>
 #include <fstream>
 #include <iterator>
+#include <fcntl.h>
 #include <libgen.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#if LIBFUZZER_LINUX
+#include <cerrno>
+#include <mutex>
+#include <sys/inotify.h>
+#include <thread>
+#include <unordered_map>
+#endif
 
 namespace fuzzer {
 
@@ -43,10 +54,31 @@ bool IsDirectory(const std::string &Path) {
 size_t FileSize(const std::string &Path) {
   struct stat St;
   if (stat(Path.c_str(), &St))
-    return 0;
+    return PackedUnitSize(Path);
   return St.st_size;
 }
 
+const uint8_t *MapFile(const std::string &Path, size_t *Size) {
+  *Size = 0;
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0)
+    return nullptr;
+  struct stat St;
+  void *Data = MAP_FAILED;
+  if (!fstat(Fd, &St) && St.st_size > 0)
+    Data = mmap(nullptr, St.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+  close(Fd);
+  if (Data == MAP_FAILED)
+    return nullptr;
+  *Size = St.st_size;
+  return static_cast<const uint8_t *>(Data);
+}
+
+void UnmapFile(const uint8_t *Data, size_t Size) {
+  if (Data)
+    munmap(const_cast<uint8_t *>(Data), Size);
+}
+
 std::string Basename(const std::string &Path) {
   size_t Pos = Path.rfind(GetSeparator());
   if (Pos == std::string::npos) return Path;
@@ -101,6 +133,112 @@ void IterateDirRecursive(const std::string &Dir,
   DirPostCallback(Dir);
 }
 
+#if LIBFUZZER_LINUX
+// The dir watcher: one inotify instance with a watch per dir, read by a
+// detached thread that queues the paths of the new files.
+static std::mutex WatcherMutex;
+static int WatcherFd = -1;
+static std::unordered_map<int, std::string> WatchedDirs;
+static std::vector<std::string> WatcherNewFiles;
+static bool WatcherLostEvents = false;  // Until the next take.
+static bool WatcherFailed = false;      // For good.
+static bool WatcherQueuesExistingFiles = false;
+
+static void WatchDir(const std::string &Dir) {
+  int Wd = inotify_add_watch(WatcherFd, Dir.c_str(),
+                             IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                 IN_ONLYDIR);
+  std::lock_guard<std::mutex> Lock(WatcherMutex);
+  if (Wd < 0)
+    WatcherFailed = true;  // Most likely the watch limit.
+  else
+    WatchedDirs[Wd] = Dir;
+}
+
+// Files that are in a dir by the time we watch it.
+static void QueueExistingFile(const std::string &Path) {
+  std::lock_guard<std::mutex> Lock(WatcherMutex);
+  if (WatcherQueuesExistingFiles)
+    WatcherNewFiles.push_back(Path);
+}
+
+static void Ignore(const std::string &) {}
+
+static void DirWatcherThread() {
+  IsInternalThread = true;
+  alignas(struct inotify_event) char Buf[1 << 16];
+  while (true) {
+    ssize_t N = read(WatcherFd, Buf, sizeof(Buf));
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0) {
+      std::lock_guard<std::mutex> Lock(WatcherMutex);
+      WatcherFailed = true;
+      return;
+    }
+    for (char *P = Buf; P < Buf + N;) {
+      auto *E = reinterpret_cast<struct inotify_event *>(P);
+      P += sizeof(*E) + E->len;
+      std::string Dir;
+      {
+        std::lock_guard<std::mutex> Lock(WatcherMutex);
+        if (E->mask & IN_Q_OVERFLOW)
+          WatcherLostEvents = true;
+        auto It = WatchedDirs.find(E->wd);
+        if (It == WatchedDirs.end())
+          continue;
+        if (E->mask & IN_IGNORED) {
+          WatchedDirs.erase(It);
+          continue;
+        }
+        Dir = It->second;
+      }
+      if (!E->len)
+        continue;
+      std::string Path = DirPlusFile(Dir, E->name);
+      if (E->mask & IN_ISDIR) {
+        // Like ListFilesInDirRecursive, skip the dirs starting with '.'.
+        if (E->name[0] != '.' && (E->mask & (IN_CREATE | IN_MOVED_TO)))
+          IterateDirRecursive(Path, WatchDir, Ignore, QueueExistingFile);
+      } else if (E->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        std::lock_guard<std::mutex> Lock(WatcherMutex);
+        WatcherNewFiles.push_back(Path);
+      }
+    }
+  }
+}
+
+bool StartDirWatcher(const std::string &Dir) {
+  if (WatcherFd >= 0)
+    return false;
+  WatcherFd = inotify_init1(IN_CLOEXEC);
+  if (WatcherFd < 0)
+    return false;
+  IterateDirRecursive(Dir, WatchDir, Ignore, Ignore);
+  std::lock_guard<std::mutex> Lock(WatcherMutex);
+  if (WatcherFailed) {
+    close(WatcherFd);
+    return false;
+  }
+  WatcherQueuesExistingFiles = true;
+  std::thread(DirWatcherThread).detach();
+  return true;
+}
+
+bool TakeNewFilesFromDirWatcher(std::vector<std::string> *V) {
+  std::lock_guard<std::mutex> Lock(WatcherMutex);
+  V->insert(V->end(), WatcherNewFiles.begin(), WatcherNewFiles.end());
+  WatcherNewFiles.clear();
+  bool Res = !WatcherLostEvents && !WatcherFailed;
+  WatcherLostEvents = false;
+  return Res;
+}
+#else
+bool StartDirWatcher(const std::string &Dir) { return false; }
+
+bool TakeNewFilesFromDirWatcher(std::vector<std::string> *V) { return false; }
+#endif  // LIBFUZZER_LINUX
+
 char GetSeparator() {
   return '/';
 }
@@ -129,6 +267,14 @@ void RenameFile(const std::string &OldPath, const std::string &NewPath) {
   rename(OldPath.c_str(), NewPath.c_str());
 }
 
+void SyncFile(const std::string &Path) {
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0)
+    return;
+  fsync(Fd);
+  close(Fd);
+}
+
 intptr_t GetHandleFromFd(int fd) {
   return static_cast<intptr_t>(fd);
 }
@@ -14,8 +14,10 @@
 
 #include "FuzzerExtFunctions.h"
 #include "FuzzerIO.h"
+#include "FuzzerPack.h"
 #include <cstdarg>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <io.h>
 #include <iterator>
@@ -104,7 +106,7 @@ size_t FileSize(const std::string &Path) {
     if (LastError != ERROR_FILE_NOT_FOUND)
       Printf("GetFileAttributesExA() failed for \"%s\" (Error code: %lu).\n",
              Path.c_str(), LastError);
-    return 0;
+    return PackedUnitSize(Path);
   }
   ULARGE_INTEGER size;
   size.HighPart = attr.nFileSizeHigh;
@@ -112,6 +114,19 @@ size_t FileSize(const std::string &Path) {
   return size.QuadPart;
 }
 
+// Reads the file instead of mapping it, the callers only need the bytes.
+const uint8_t *MapFile(const std::string &Path, size_t *Size) {
+  Unit U = FileToVector(Path, 0, /*ExitOnError=*/false);
+  *Size = U.size();
+  if (U.empty())
+    return nullptr;
+  uint8_t *Data = new uint8_t[U.size()];
+  memcpy(Data, U.data(), U.size());
+  return Data;
+}
+
+void UnmapFile(const uint8_t *Data, size_t Size) { delete[] Data; }
+
 void ListFilesInDirRecursive(const std::string &Dir, long *Epoch,
                              std::vector<std::string> *V, bool TopDir) {
   auto E = GetEpoch(Dir);
@@ -139,10 +154,9 @@ void ListFilesInDirRecursive(const std::string &Dir, long *Epoch,
     std::string FileName = DirPlusFile(Dir, FindInfo.cFileName);
 
     if (FindInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-      size_t FilenameLen = strlen(FindInfo.cFileName);
-      if ((FilenameLen == 1 && FindInfo.cFileName[0] == '.') ||
-          (FilenameLen == 2 && FindInfo.cFileName[0] == '.' &&
-                               FindInfo.cFileName[1] == '.'))
+      // Skip ".", ".." and, as on Posix, the hidden dirs such as the merge
+      // feature cache.
+      if (FindInfo.cFileName[0] == '.')
         continue;
 
       ListFilesInDirRecursive(FileName, Epoch, V, false);
@@ -212,6 +226,11 @@ void IterateDirRecursive(const std::string &Dir,
   DirPostCallback(Dir);
 }
 
+// The reload falls back to rescanning the dir.
+bool StartDirWatcher(const std::string &Dir) { return false; }
+
+bool TakeNewFilesFromDirWatcher(std::vector<std::string> *V) { return false; }
+
 char GetSeparator() {
   return '\\';
 }
@@ -236,6 +255,16 @@ void RenameFile(const std::string &OldPath, const std::string &NewPath) {
   rename(OldPath.c_str(), NewPath.c_str());
 }
 
+void SyncFile(const std::string &Path) {
+  HANDLE H = CreateFileA(Path.c_str(), GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (H == INVALID_HANDLE_VALUE)
+    return;
+  FlushFileBuffers(H);
+  CloseHandle(H);
+}
+
 intptr_t GetHandleFromFd(int fd) {
   return _get_osfhandle(fd);
 }
@@ -15,6 +15,7 @@
 #include "FuzzerDefs.h"
 #include "FuzzerExtFunctions.h"
 #include "FuzzerInterface.h"
+#include "FuzzerLenControl.h"
 #include "FuzzerOptions.h"
 #include "FuzzerSHA1.h"
 #include "FuzzerValueBitMap.h"
@@ -29,6 +30,8 @@ namespace fuzzer {
 
 using namespace std::chrono;
 
+class SyncAgent;
+
 class Fuzzer final {
 public:
   Fuzzer(UserCallback CB, InputCorpus &Corpus, MutationDispatcher &MD,
@@ -38,6 +41,8 @@ public:
   void ReadAndExecuteSeedCorpora(std::vector<SizedFile> &CorporaFiles);
   void MinimizeCrashLoop(const Unit &U);
   void RereadOutputCorpus(size_t MaxSize);
+  void RunSyncedSeeds();
+  void SyncCoverage();
 
   size_t secondsSinceProcessStartUp() {
     return duration_cast<seconds>(system_clock::now() - ProcessStartTime)
@@ -70,7 +75,8 @@ public:
   bool ExecuteCallback(const uint8_t *Data, size_t Size);
   bool RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile = false,
               InputInfo *II = nullptr, bool ForceAddToCorpus = false,
-              bool *FoundUniqFeatures = nullptr);
+              bool *FoundUniqFeatures = nullptr,
+              uint64_t *FeaturesHash = nullptr);
   void TPCUpdateObservedPCs();
 
   // Merge Corpora[1:] into Corpora[0].
@@ -100,6 +106,7 @@ private:
   void CrashOnOverwrittenData();
   void InterruptCallback();
   void MutateAndTestOne();
+  bool RunDeterministicStage(InputInfo &II);
   void PurgeAllocator();
   void ReportNewCoverage(InputInfo *II, const Unit &U);
   void PrintPulseAndReportSlowInput(const uint8_t *Data, size_t Size);
@@ -114,6 +121,7 @@ private:
   void DeathCallback();
 
   void AllocateCurrentUnitData();
+  void GrowMaxInputLen(size_t NewMaxInputLen);
   uint8_t *CurrentUnitData = nullptr;
   std::atomic<size_t> CurrentUnitSize;
   uint8_t BaseSha1[kSHA1NumBytes];  // Checksum of the base unit.
@@ -139,11 +147,19 @@ private:
   system_clock::time_point ProcessStartTime = system_clock::now();
   system_clock::time_point UnitStartTime, UnitStopTime;
   long TimeOfLongestUnitInSeconds = 0;
+  size_t InitTimeMs = 0;  // Until the seed corpus was executed.
   long EpochOfLastReadOfOutputCorpus = 0;
+  bool OutputCorpusIsPacked = false;
+  bool DirWatcherStarted = false;
+  bool WatchingOutputCorpus = false;
+  SyncAgent *Sync = nullptr;  // -sync_socket.
+  bool RunningSyncedSeeds = false;
+  size_t NumSyncedSeedsSkipped = 0;
 
   size_t MaxInputLen = 0;
   size_t MaxMutationLen = 0;
   size_t TmpMaxMutationLen = 0;
+  LengthController LenController;
 
   std::vector<uint32_t> UniqFeatureSetTmp;
 
@@ -0,0 +1,130 @@
+//===- FuzzerLenControl.h - Internal header for the Fuzzer ------*- C++ -* ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::LengthController
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_LEN_CONTROL_H
+#define LLVM_FUZZER_LEN_CONTROL_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerUtil.h"
+#include <algorithm>
+
+namespace fuzzer {
+
+// Chooses the mutation length limit (-adaptive_len_control) from the yield of
+// the executed mutants: new features per CPU second, kept per log2 length
+// bucket. The mutants longer than half the limit are compared with the best
+// bucket below them. The limit is doubled while the long mutants pay off and
+// halved when they cost much more than they find. The stats decay with every
+// decision so that the controller follows the campaign.
+class LengthController {
+ public:
+  enum Decision { kKeep, kGrow, kShrink };
+
+  // The limit is reconsidered after this many executions.
+  static const size_t kExecsPerDecision = 1 << 12;
+  // Buckets with fewer executions than this are not trusted.
+  static const size_t kMinExecs = 64;
+  // The limit never goes below this.
+  static const size_t kMinLimit = 4;
+
+  void Record(size_t Size, size_t Nanoseconds, size_t NewFeatures) {
+    auto &B = Buckets[BucketOf(Size)];
+    B.Execs += 1;
+    B.Nanoseconds += static_cast<double>(Nanoseconds);
+    B.NewFeatures += static_cast<double>(NewFeatures);
+    ExecsSinceDecision++;
+    NewFeaturesSinceDecision += NewFeatures;
+  }
+
+  // Returns the new limit, Limit itself if it is not time to decide yet.
+  size_t Update(size_t Limit, size_t MaxLen) {
+    if (ExecsSinceDecision < kExecsPerDecision)
+      return Limit;
+    size_t NewLimit = Decide(Limit, MaxLen);
+    for (auto &B : Buckets) {
+      B.Execs /= 2;
+      B.Nanoseconds /= 2;
+      B.NewFeatures /= 2;
+    }
+    ExecsSinceDecision = 0;
+    NewFeaturesSinceDecision = 0;
+    return NewLimit;
+  }
+
+  Decision LastDecision() const { return Last; }
+  // New features per CPU second of the mutants longer than half the limit
+  // and of the best bucket below them, as of the last decision.
+  double LongYield() const { return LastLongYield; }
+  double ShortYield() const { return LastShortYield; }
+
+ private:
+  static const size_t kNumBuckets = 32;
+
+  struct Bucket {
+    double Execs = 0;
+    double Nanoseconds = 0;
+    double NewFeatures = 0;
+  };
+
+  // Bucket 0 holds the sizes up to 2, bucket N the sizes in (2^N, 2^(N+1)],
+  // so that the mutants as long as the limit share a bucket with the ones
+  // just above half of it.
+  static size_t BucketOf(size_t Size) {
+    return Size <= 2 ? 0 : std::min(Log(Size - 1), kNumBuckets - 1);
+  }
+
+  double Yield(const Bucket &B) const {
+    return B.Nanoseconds > 0 ? B.NewFeatures * 1e9 / B.Nanoseconds : 0;
+  }
+
+  size_t Decide(size_t Limit, size_t MaxLen) {
+    Limit = std::min(std::max(Limit, kMinLimit), MaxLen);
+    // The top bucket holds the mutants in (Limit / 2, Limit] when Limit is a
+    // power of two, and a little more or less of them otherwise.
+    size_t Top = BucketOf(Limit);
+    const Bucket &T = Buckets[Top];
+    LastLongYield = Yield(T);
+    LastShortYield = 0;
+    bool ShortFindsFeatures = false;
+    for (size_t i = 0; i < Top; i++) {
+      if (Buckets[i].Execs < kMinExecs)
+        continue;
+      LastShortYield = std::max(LastShortYield, Yield(Buckets[i]));
+      ShortFindsFeatures |= Buckets[i].NewFeatures > 0;
+    }
+    Last = kKeep;
+    if (!NewFeaturesSinceDecision) {
+      // Nothing new at any length: the short inputs are exhausted, explore.
+      Last = kGrow;
+    } else if (T.Execs >= kMinExecs) {
+      if (LastLongYield >= LastShortYield / 2)
+        Last = kGrow;
+      else if (ShortFindsFeatures && LastLongYield < LastShortYield / 8)
+        Last = kShrink;
+    }
+    if (Last == kGrow && Limit < MaxLen)
+      return std::min(MaxLen, Limit * 2);
+    if (Last == kShrink && Limit > kMinLimit)
+      return std::max(kMinLimit, Limit / 2);
+    Last = kKeep;
+    return Limit;
+  }
+
+  Bucket Buckets[kNumBuckets];
+  size_t ExecsSinceDecision = 0;
+  size_t NewFeaturesSinceDecision = 0;
+  Decision Last = kKeep;
+  double LastLongYield = 0;
+  double LastShortYield = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_LEN_CONTROL_H
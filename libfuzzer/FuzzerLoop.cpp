@@ -12,10 +12,15 @@
 #include "FuzzerCorpus.h"
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
+#include "FuzzerMerge.h"
 #include "FuzzerMutate.h"
+#include "FuzzerPack.h"
 #include "FuzzerPlatform.h"
+#include "FuzzerPrefetch.h"
 #include "FuzzerRandom.h"
+#include "FuzzerSync.h"
 #include "FuzzerTracePC.h"
+#include "FuzzerWriter.h"
 #include <algorithm>
 #include <cstring>
 #include <memory>
@@ -38,6 +43,19 @@
 
 namespace fuzzer {
 static const size_t kMaxUnitSizeToPrint = 256;
+// Larger inputs skip the deterministic stage, it would take too long.
+static const size_t kMaxDeterministicStageLen = 4096;
+// The largest max_len that is chosen without -max_len.
+static const size_t kMaxSaneLen = 1 << 20;
+
+// -async_writes=1: the fuzzing thread blocks while this much is queued, and
+// waits this long for the queue when it exits on a crash.
+static const size_t kMaxQueuedWriteBytes = 64 << 20;
+static const int kMaxSecondsToFinishWrites = 10;
+// -sync_socket: seeds beyond this many queued bytes are dropped.
+static const size_t kMaxQueuedSyncBytes = 64 << 20;
+// -sync_socket: how often the new features are sent.
+static const int kCoverageSyncIntervalSec = 1;
 
 thread_local bool Fuzzer::IsMyThread;
 
@@ -97,6 +115,8 @@ private:
 
 ATTRIBUTE_NO_SANITIZE_MEMORY
 void MallocHook(const volatile void *ptr, size_t size) {
+  if (IsInternalThread)
+    return;
   size_t N = AllocTracer.Mallocs++;
   F->HandleMalloc(size);
   if (int TraceLevel = AllocTracer.TraceLevel) {
@@ -111,6 +131,8 @@ void MallocHook(const volatile void *ptr, size_t size) {
 
 ATTRIBUTE_NO_SANITIZE_MEMORY
 void FreeHook(const volatile void *ptr) {
+  if (IsInternalThread)
+    return;
   size_t N = AllocTracer.Frees++;
   if (int TraceLevel = AllocTracer.TraceLevel) {
     TraceLock Lock;
@@ -156,8 +178,13 @@ Fuzzer::Fuzzer(UserCallback CB, InputCorpus &Corpus, MutationDispatcher &MD,
 
   if (Options.Verbosity)
     TPC.PrintModuleInfo();
+  if (!Options.OutputCorpus.empty())
+    OutputCorpusIsPacked = IsPackedCorpus(Options.OutputCorpus);
   if (!Options.OutputCorpus.empty() && Options.ReloadIntervalSec)
-    EpochOfLastReadOfOutputCorpus = GetEpoch(Options.OutputCorpus);
+    EpochOfLastReadOfOutputCorpus =
+        OutputCorpusIsPacked
+            ? static_cast<long>(FileSize(Options.OutputCorpus))
+            : GetEpoch(Options.OutputCorpus);
   MaxInputLen = MaxMutationLen = Options.MaxLen;
   TmpMaxMutationLen = 0;  // Will be set once we load the corpus.
   AllocateCurrentUnitData();
@@ -190,6 +217,8 @@ void Fuzzer::DumpCurrentUnit(const char *Prefix) {
   }
   WriteUnitToFileWithPrefix({CurrentUnitData, CurrentUnitData + UnitSize},
                             Prefix);
+  // The inputs found before the crash should make it to the corpus too.
+  GetAsyncWriter().WaitForPendingRequests(kMaxSecondsToFinishWrites);
 }
 
 NO_SANITIZE_MEMORY
@@ -265,6 +294,7 @@ void Fuzzer::ExitCallback() {
 void Fuzzer::MaybeExitGracefully() {
   if (!F->GracefulExitRequested) return;
   Printf("==%lu== INFO: libFuzzer: exiting as requested\n", GetPid());
+  GetAsyncWriter().WaitForPendingRequests(kMaxSecondsToFinishWrites);
   RmDirRecursive(TempPath("FuzzWithFork", ".dir"));
   F->PrintFinalStats();
   _Exit(0);
@@ -279,6 +309,7 @@ int Fuzzer::InterruptExitCode() {
 void Fuzzer::InterruptCallback() {
   Printf("==%lu== libFuzzer: run interrupted; exiting\n", GetPid());
   PrintFinalStats();
+  GetAsyncWriter().WaitForPendingRequests(kMaxSecondsToFinishWrites);
   ScopedDisableMsanInterceptorChecks S; // RmDirRecursive may call opendir().
   RmDirRecursive(TempPath("FuzzWithFork", ".dir"));
   // Stop right now, don't perform any at-exit actions.
@@ -360,8 +391,15 @@ void Fuzzer::PrintStats(const char *Where, const char *End, size_t Units,
     if (size_t FF = Corpus.NumInputsThatTouchFocusFunction())
       Printf(" focus: %zd", FF);
   }
-  if (TmpMaxMutationLen)
+  if (TmpMaxMutationLen) {
     Printf(" lim: %zd", TmpMaxMutationLen);
+    // cjc: 长度控制的决定, 以及长/短变异每秒发现的新特征数
+    if (Options.AdaptiveLenControl) {
+      const char *D = "=+-";
+      Printf("%c ly: %.1f/%.1f", D[LenController.LastDecision()],
+             LenController.LongYield(), LenController.ShortYield());
+    }
+  }
   if (Units)
     Printf(" units: %zd", Units);
 
@@ -385,6 +423,17 @@ void Fuzzer::PrintFinalStats() {
   Printf("stat::new_units_added:          %zd\n", NumberOfNewUnitsAdded);
   Printf("stat::slowest_unit_time_sec:    %ld\n", TimeOfLongestUnitInSeconds);
   Printf("stat::peak_rss_mb:              %zd\n", GetPeakRSSMb());
+  Printf("stat::init_time_ms:             %zd\n", InitTimeMs);
+  if (Options.CompressCorpus)
+    Printf("stat::corpus_bytes_in_memory:   %zd/%zd\n", Corpus.SizeInMemory(),
+           Corpus.SizeInBytes());
+  if (Sync)
+    Printf("stat::sync_seeds:               %zd sent, %zd received, "
+           "%zd dropped, %zd skipped\n",
+           Sync->NumSent(), Sync->NumReceived(), Sync->NumDropped(),
+           NumSyncedSeedsSkipped);
+  if (Sync)
+    Printf("stat::sync_coverage_bytes:      %zd\n", Sync->NumCoverageBytes());
 }
 
 void Fuzzer::SetMaxInputLen(size_t MaxInputLen) {
@@ -398,6 +447,18 @@ void Fuzzer::SetMaxInputLen(size_t MaxInputLen) {
          MaxInputLen);
 }
 
+// Only between two mutations: CurrentUnitData is not in use then.
+void Fuzzer::GrowMaxInputLen(size_t NewMaxInputLen) {
+  assert(NewMaxInputLen > MaxInputLen && MaxMutationLen == MaxInputLen);
+  Printf("INFO: -max_len raised from %zd to %zd bytes, the longest inputs "
+         "still find new features\n",
+         MaxInputLen, NewMaxInputLen);
+  uint8_t *Old = CurrentUnitData;
+  CurrentUnitData = new uint8_t[NewMaxInputLen];
+  MaxInputLen = MaxMutationLen = NewMaxInputLen;
+  delete[] Old;
+}
+
 void Fuzzer::SetMaxMutationLen(size_t MaxMutationLen) {
   assert(MaxMutationLen && MaxMutationLen <= MaxInputLen);
   this->MaxMutationLen = MaxMutationLen;
@@ -432,11 +493,37 @@ void Fuzzer::RereadOutputCorpus(size_t MaxSize) {
     return;
   std::vector<Unit> AdditionalCorpus;
   std::vector<std::string> AdditionalCorpusPaths;
-  ReadDirToVectorOfUnits(
-      Options.OutputCorpus.c_str(), &AdditionalCorpus,
-      &EpochOfLastReadOfOutputCorpus, MaxSize,
-      /*ExitOnError*/ false,
-      (Options.Verbosity >= 2 ? &AdditionalCorpusPaths : nullptr));
+  std::vector<std::string> NewFiles;
+  // The watcher starts with the first reload, which still rescans the dir
+  // for the files written before that.
+  bool Rescan = !WatchingOutputCorpus;
+  if (!DirWatcherStarted) {
+    DirWatcherStarted = true;
+    WatchingOutputCorpus = Options.ReloadWatch && !OutputCorpusIsPacked &&
+                           StartDirWatcher(Options.OutputCorpus);
+  } else if (WatchingOutputCorpus) {
+    Rescan = !TakeNewFilesFromDirWatcher(&NewFiles);
+  }
+  if (Rescan) {
+    ReadDirToVectorOfUnits(
+        Options.OutputCorpus.c_str(), &AdditionalCorpus,
+        &EpochOfLastReadOfOutputCorpus, MaxSize,
+        /*ExitOnError*/ false,
+        (Options.Verbosity >= 2 ? &AdditionalCorpusPaths : nullptr));
+  } else {
+    for (auto &Path : NewFiles) {
+      // Our own units come back too, skip them without reading.
+      if (Corpus.HasUnit(Basename(Path)))
+        continue;
+      auto U = FileToVector(Path, MaxSize, /*ExitOnError*/ false);
+      if (U.empty())
+        continue;
+      AdditionalCorpus.push_back(U);
+      if (Options.Verbosity >= 2)
+        AdditionalCorpusPaths.push_back(Path);
+    }
+    EpochOfLastReadOfOutputCorpus = GetEpoch(Options.OutputCorpus);
+  }
   if (Options.Verbosity >= 2)
     Printf("Reload: read %zd new units.\n", AdditionalCorpus.size());
   bool Reloaded = false;
@@ -457,6 +544,47 @@ void Fuzzer::RereadOutputCorpus(size_t MaxSize) {
     PrintStats("RELOAD");
 }
 
+void Fuzzer::RunSyncedSeeds() {
+  std::vector<SyncSeed> Seeds;
+  Sync->TakeSeeds(&Seeds);
+  bool Added = false;
+  RunningSyncedSeeds = true;
+  for (auto &S : Seeds) {
+    if (S.U.size() > MaxInputLen)
+      S.U.resize(MaxInputLen);
+    if (Corpus.HasUnit(S.U))
+      continue;
+    // The sender's unique features: none new here, the seed would not be
+    // added. Seeds without features are always run.
+    if (!S.Features.empty() &&
+        std::all_of(S.Features.begin(), S.Features.end(),
+                    [&](uint32_t F) { return Corpus.HasFeature(F); })) {
+      NumSyncedSeedsSkipped++;
+      continue;
+    }
+    if (RunOne(S.U.data(), S.U.size())) {
+      // Kept like the inputs found here: in the output corpus, and so in the
+      // job's corpus in fork mode.
+      WriteToOutputCorpus(S.U);
+      NumberOfNewUnitsAdded++;
+      CheckExitOnSrcPosOrItem();
+      Added = true;
+    }
+  }
+  RunningSyncedSeeds = false;
+  if (Added)
+    PrintStats("SYNC");
+}
+
+void Fuzzer::SyncCoverage() {
+  size_t Base = Sync->CoverageEpoch(), Epoch = Corpus.CoverageEpoch();
+  if (Base == Epoch)
+    return;
+  std::vector<uint32_t> Features;
+  Corpus.FeaturesSinceEpoch(Base, &Features);
+  Sync->PutCoverage(Base, Epoch, Features);
+}
+
 void Fuzzer::PrintPulseAndReportSlowInput(const uint8_t *Data, size_t Size) {
   auto TimeOfUnit =
       duration_cast<seconds>(UnitStopTime - UnitStartTime).count();
@@ -476,17 +604,34 @@ static void WriteFeatureSetToFile(const std::string &FeaturesDir,
                                   const std::string &FileName,
                                   const std::vector<uint32_t> &FeatureSet) {
   if (FeaturesDir.empty() || FeatureSet.empty()) return;
-  WriteToFile(reinterpret_cast<const uint8_t *>(FeatureSet.data()),
-              FeatureSet.size() * sizeof(FeatureSet[0]),
-              DirPlusFile(FeaturesDir, FileName));
+  auto *Begin = reinterpret_cast<const uint8_t *>(FeatureSet.data());
+  GetAsyncWriter().WriteToFile(
+      Unit(Begin, Begin + FeatureSet.size() * sizeof(FeatureSet[0])),
+      DirPlusFile(FeaturesDir, FileName));
 }
 
 static void RenameFeatureSetFile(const std::string &FeaturesDir,
                                  const std::string &OldFile,
                                  const std::string &NewFile) {
   if (FeaturesDir.empty()) return;
-  RenameFile(DirPlusFile(FeaturesDir, OldFile),
-             DirPlusFile(FeaturesDir, NewFile));
+  GetAsyncWriter().RenameFile(DirPlusFile(FeaturesDir, OldFile),
+                              DirPlusFile(FeaturesDir, NewFile));
+}
+
+static void AppendFeatureSetToLog(const std::string &FeaturesLog,
+                                  const uint8_t Sha1[kSHA1NumBytes],
+                                  const std::vector<uint32_t> &FeatureSet) {
+  if (FeaturesLog.empty() || FeatureSet.empty()) return;
+  Unit Record;
+  if (std::is_sorted(FeatureSet.begin(), FeatureSet.end())) {
+    AppendMergeFeatureCacheRecord(Sha1, FeatureSet, &Record);
+  } else {
+    auto Sorted = FeatureSet;
+    std::sort(Sorted.begin(), Sorted.end());
+    AppendMergeFeatureCacheRecord(Sha1, Sorted, &Record);
+  }
+  GetAsyncWriter().AppendToFile(std::string(Record.begin(), Record.end()),
+                                FeaturesLog);
 }
 
 static void WriteEdgeToMutationGraphFile(const std::string &MutationGraphFile,
@@ -517,13 +662,13 @@ static void WriteEdgeToMutationGraphFile(const std::string &MutationGraphFile,
     OutputString.append("\"];\n");
   }
 
-  AppendToFile(OutputString, MutationGraphFile);
+  GetAsyncWriter().AppendToFile(OutputString, MutationGraphFile);
 }
 
 // cjc: 执行单个测试用例
 bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
                     InputInfo *II, bool ForceAddToCorpus,
-                    bool *FoundUniqFeatures) {
+                    bool *FoundUniqFeatures, uint64_t *FeaturesHash) {
   if (!Size)
     return false;
   // Largest input length should be INT_MAX.
@@ -538,7 +683,10 @@ bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
   // cjc: 从SanitizerCoverage插桩记录的信息中获取分支数据
   size_t NumUpdatesBefore = Corpus.NumFeatureUpdates();
 
+  uint64_t Hash = 0;
   TPC.CollectFeatures([&](uint32_t Feature) {
+    if (FeaturesHash)
+      Hash = (Hash ^ Feature) * 0x100000001b3ULL;  // FNV-1a step.
     if (Corpus.AddFeature(Feature, static_cast<uint32_t>(Size), Options.Shrink))
       UniqFeatureSetTmp.push_back(Feature);
     if (Options.Entropic)
@@ -551,6 +699,8 @@ bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
 
   if (FoundUniqFeatures)
     *FoundUniqFeatures = FoundUniqFeaturesOfII;
+  if (FeaturesHash)
+    *FeaturesHash = Hash;
   PrintPulseAndReportSlowInput(Data, Size);
 
   // cjc: 计算发现了多少新分支路径
@@ -563,6 +713,11 @@ bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
                            TimeOfUnit, UniqFeatureSetTmp, DFT, II);
     WriteFeatureSetToFile(Options.FeaturesDir, Sha1ToString(NewII->Sha1),
                           NewII->UniqFeatureSet);
+    AppendFeatureSetToLog(Options.FeaturesLog, NewII->Sha1,
+                          NewII->UniqFeatureSet);
+    // The peer has the seeds it sent us.
+    if (Sync && !RunningSyncedSeeds)
+      Sync->PutSeed(NewII->U, NewII->Sha1, NewII->UniqFeatureSet);
     WriteEdgeToMutationGraphFile(Options.MutationGraphFile, NewII, II,
                                  MD.MutationSequence());
     return true;
@@ -575,6 +730,8 @@ bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
     Corpus.Replace(II, {Data, Data + Size}, TimeOfUnit);
     RenameFeatureSetFile(Options.FeaturesDir, OldFeaturesFile,
                          Sha1ToString(II->Sha1));
+    // The latest record of a SHA1 wins, the old one is left behind.
+    AppendFeatureSetToLog(Options.FeaturesLog, II->Sha1, II->UniqFeatureSet);
     return true;
   }
   return false;
@@ -655,8 +812,14 @@ std::string Fuzzer::WriteToOutputCorpus(const Unit &U) {
     assert(IsASCII(U));
   if (Options.OutputCorpus.empty())
     return "";
-  std::string Path = DirPlusFile(Options.OutputCorpus, Hash(U));
-  WriteToFile(U, Path);
+  std::string Path;
+  if (OutputCorpusIsPacked) {
+    Path = Options.OutputCorpus;
+    GetAsyncWriter().AppendToPackedCorpus(U, Path);
+  } else {
+    Path = DirPlusFile(Options.OutputCorpus, Hash(U));
+    GetAsyncWriter().WriteToFile(U, Path);
+  }
   if (Options.Verbosity >= 2)
     Printf("Written %zd bytes to %s\n", U.size(), Path.c_str());
   return Path;
@@ -743,6 +906,66 @@ void Fuzzer::TryDetectingAMemoryLeak(const uint8_t *Data, size_t Size,
   }
 }
 
+// Runs the next slice of the deterministic stage of II, at most
+// Options.DeterministicStage executions. Returns false if the stage of II is
+// already over, in which case II should be mutated randomly instead.
+bool Fuzzer::RunDeterministicStage(InputInfo &II) {
+  auto &C = II.Deterministic;
+  if (C.Done())
+    return false;
+  size_t Size = II.U.size();
+  if (Size > kMaxDeterministicStageLen) {
+    C.Walk = DeterministicCursor::kDone;
+    return false;
+  }
+  size_t NumRuns = 0;
+  if (C.Walk == DeterministicCursor::kBitFlip && !C.Pos && !C.Step) {
+    // Remember the coverage of the unmodified input, the byte flip walk
+    // compares against it to build the effector map.
+    RunOne(II.U.data(), Size, /*MayDeleteFile*/ false, /*II*/ nullptr,
+           /*ForceAddToCorpus*/ false, /*FoundUniqFeatures*/ nullptr,
+           &II.DeterministicBaseHash);
+    NumRuns++;
+  }
+  while (NumRuns < static_cast<size_t>(Options.DeterministicStage)) {
+    if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
+      break;
+    MaybeExitGracefully();
+    MD.StartMutationSequence();
+    memcpy(CurrentUnitData, II.U.data(), Size);
+    if (!MD.MutateDeterministic(CurrentUnitData, Size, &C, II.EffectorMap))
+      break;
+    NumRuns++;
+    II.NumExecutedMutations++;
+    Corpus.IncrementNumExecutedMutations();
+
+    uint64_t Hash = 0;
+    bool NewCov = RunOne(CurrentUnitData, Size, /*MayDeleteFile=*/true, &II,
+                         /*ForceAddToCorpus*/ false,
+                         /*FoundUniqFeatures*/ nullptr, &Hash);
+    TryDetectingAMemoryLeak(CurrentUnitData, Size,
+                            /*DuringInitialCorpusExecution*/ false);
+    if (NewCov)
+      ReportNewCoverage(&II, {CurrentUnitData, CurrentUnitData + Size});
+    if (II.U.empty())
+      return true;  // II was evicted from the corpus, nothing left to do.
+    if (C.LastWalk == DeterministicCursor::kByteFlip) {
+      if (II.EffectorMap.empty())
+        II.EffectorMap.assign(Size, 1);
+      II.EffectorMap[C.LastPos] = Hash != II.DeterministicBaseHash;
+    }
+  }
+  // An effector map without zeros does not prune anything.
+  if (C.Walk > DeterministicCursor::kByteFlip && II.EffectorMask.empty()) {
+    if (std::all_of(II.EffectorMap.begin(), II.EffectorMap.end(),
+                    [](uint8_t E) { return E != 0; }))
+      std::vector<uint8_t>().swap(II.EffectorMap);
+    else
+      II.EffectorMask = MutationMask(II.EffectorMap);
+  }
+  return NumRuns > 0;
+}
+
 // cjc: 核心代码, 生成测试用例并执行
 void Fuzzer::MutateAndTestOne() {
   // cjc: 清空突变序列
@@ -755,7 +978,13 @@ void Fuzzer::MutateAndTestOne() {
         MD.GetRand(), Options.CrossOverUniformDist);
     MD.SetCrossOverWith(&CrossOverII.U);
   }
-  
+
+  // cjc: 新输入先执行确定性变异阶段, 每次被调度时执行一段
+  if (Options.DeterministicStage > 0 && RunDeterministicStage(II)) {
+    II.NeedsEnergyUpdate = true;
+    return;
+  }
+
   // cjc: 复制单元U, 并保存sha1, 获取测试用例
   const auto &U = II.U;
   memcpy(BaseSha1, II.Sha1, sizeof(BaseSha1));
@@ -777,10 +1006,13 @@ void Fuzzer::MutateAndTestOne() {
       break;
     MaybeExitGracefully();
     size_t NewSize = 0;
-    if (II.HasFocusFunction && !II.DataFlowTraceForFocusFunction.empty() &&
+    if (II.HasFocusFunction && !II.DataFlowMask.empty() &&
         Size <= CurrentMaxMutationLen)
       NewSize = MD.MutateWithMask(CurrentUnitData, Size, Size,
-                                  II.DataFlowTraceForFocusFunction);
+                                  II.DataFlowMask);
+    else if (!II.EffectorMask.empty() && Size == U.size() &&
+             MD.GetRand().RandBool())
+      NewSize = MD.MutateWithMask(CurrentUnitData, Size, Size, II.EffectorMask);
 
     // If MutateWithMask either failed or wasn't called, call default Mutate.
     if (!NewSize)
@@ -793,8 +1025,14 @@ void Fuzzer::MutateAndTestOne() {
 
     // cjc: 新覆盖点
     bool FoundUniqFeatures = false;
+    size_t NumFeaturesBefore = Corpus.NumFeatures();
     bool NewCov = RunOne(CurrentUnitData, Size, /*MayDeleteFile=*/true, &II,
                          /*ForceAddToCorpus*/ false, &FoundUniqFeatures);
+    if (Options.AdaptiveLenControl)
+      LenController.Record(
+          Size,
+          duration_cast<nanoseconds>(UnitStopTime - UnitStartTime).count(),
+          Corpus.NumFeatures() - NumFeaturesBefore);
     TryDetectingAMemoryLeak(CurrentUnitData, Size,
                             /*DuringInitialCorpusExecution*/ false);
     if (NewCov) {
@@ -829,7 +1067,6 @@ void Fuzzer::PurgeAllocator() {
 }
 
 void Fuzzer::ReadAndExecuteSeedCorpora(std::vector<SizedFile> &CorporaFiles) {
-  const size_t kMaxSaneLen = 1 << 20;
   const size_t kMinDefaultLen = 4096;
   size_t MaxSize = 0;
   size_t MinSize = -1;
@@ -863,13 +1100,17 @@ void Fuzzer::ReadAndExecuteSeedCorpora(std::vector<SizedFile> &CorporaFiles) {
       assert(CorporaFiles.front().Size <= CorporaFiles.back().Size);
     }
 
-    // Load and execute inputs one by one.
-    for (auto &SF : CorporaFiles) {
-      auto U = FileToVector(SF.File, MaxInputLen, /*ExitOnError=*/false);
+    // Load and execute inputs one by one, the next ones are read meanwhile.
+    FilePrefetcher Prefetcher(
+        CorporaFiles, MaxInputLen,
+        static_cast<size_t>(std::max(Options.SeedPrefetchThreads, 0)));
+    for (size_t i = 0; i < CorporaFiles.size(); i++) {
+      auto U = Prefetcher.Take(i);
       assert(U.size() <= MaxInputLen);
       RunOne(U.data(), U.size(), /*MayDeleteFile*/ false, /*II*/ nullptr,
              /*ForceAddToCorpus*/ Options.KeepSeed,
              /*FoundUniqFeatures*/ nullptr);
+      Corpus.CompressColdUnits();
       CheckExitOnSrcPosOrItem();
       TryDetectingAMemoryLeak(U.data(), U.size(),
                               /*DuringInitialCorpusExecution*/ true);
@@ -877,6 +1118,9 @@ void Fuzzer::ReadAndExecuteSeedCorpora(std::vector<SizedFile> &CorporaFiles) {
   }
 
   PrintStats("INITED");
+  InitTimeMs = static_cast<size_t>(
+      duration_cast<milliseconds>(system_clock::now() - ProcessStartTime)
+          .count());
   if (!Options.FocusFunction.empty()) {
     Printf("INFO: %zd/%zd inputs touch the focus function\n",
            Corpus.NumInputsThatTouchFocusFunction(), Corpus.size());
@@ -906,12 +1150,23 @@ void Fuzzer::Loop(std::vector<SizedFile> &CorporaFiles) {
   DFT.Init(Options.DataFlowTrace, &FocusFunctionOrAuto, CorporaFiles,
            MD.GetRand());
   TPC.SetFocusFunction(FocusFunctionOrAuto);
+  // cjc: 启动后台写文件线程
+  if (Options.AsyncWrites)
+    GetAsyncWriter().Start(kMaxQueuedWriteBytes,
+                           Options.AsyncWritesFsync ? AsyncWriter::kSyncFiles
+                                                    : AsyncWriter::kNoSync);
   // cjc: 执行种子
   ReadAndExecuteSeedCorpora(CorporaFiles);
   DFT.Clear();  // No need for DFT any more.
+  // cjc: 连接调度客户端, 只同步之后发现的种子
+  if (!Options.SyncSocket.empty()) {
+    Sync = new SyncAgent;
+    Sync->Start(Options.SyncSocket, kMaxQueuedSyncBytes);
+  }
   TPC.SetPrintNewPCs(Options.PrintNewCovPcs);
   TPC.SetPrintNewFuncs(Options.PrintNewCovFuncs);
   system_clock::time_point LastCorpusReload = system_clock::now();
+  system_clock::time_point LastCoverageSync = system_clock::now();
 
   TmpMaxMutationLen =
       Min(MaxMutationLen, Max(size_t(4), Corpus.MaxInputSize()));
@@ -929,6 +1184,15 @@ void Fuzzer::Loop(std::vector<SizedFile> &CorporaFiles) {
       RereadOutputCorpus(MaxInputLen);
       LastCorpusReload = system_clock::now();
     }
+    // cjc: 执行调度客户端同步来的种子
+    if (Sync && Sync->HasSeeds())
+      RunSyncedSeeds();
+    // cjc: 向调度客户端发送新增的覆盖率
+    if (Sync && duration_cast<seconds>(Now - LastCoverageSync).count() >=
+                    kCoverageSyncIntervalSec) {
+      SyncCoverage();
+      LastCoverageSync = Now;
+    }
     
     // cjc: 最大运行次数
     if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
@@ -940,7 +1204,26 @@ void Fuzzer::Loop(std::vector<SizedFile> &CorporaFiles) {
     
 
     // cjc: Update TmpMaxMutationLen, 更新突变的最大长度
-    if (Options.LenControl) {
+    if (Options.AdaptiveLenControl) {
+      // Without -max_len the default taken from the largest seed is only a
+      // start: the limit goes past it, up to kMaxSaneLen, as long as the
+      // longest mutants find new features.
+      size_t Cap = Options.MaxLen ? MaxMutationLen
+                                  : Max(MaxMutationLen, kMaxSaneLen);
+      size_t NewLimit = LenController.Update(TmpMaxMutationLen, Cap);
+      if (NewLimit > MaxMutationLen) {
+        if (LenController.LongYield() > 0)
+          GrowMaxInputLen(NewLimit);
+        else
+          NewLimit = MaxMutationLen;
+      }
+      if (NewLimit != TmpMaxMutationLen && Options.Verbosity >= 2)
+        Printf("INFO: len_control: lim %zd -> %zd "
+               "(ft/s long: %.1f short: %.1f)\n",
+               TmpMaxMutationLen, NewLimit, LenController.LongYield(),
+               LenController.ShortYield());
+      TmpMaxMutationLen = NewLimit;
+    } else if (Options.LenControl) {
       if (TmpMaxMutationLen < MaxMutationLen &&
           TotalNumberOfRuns - LastCorpusUpdateRun >
               Options.LenControl * Log(TmpMaxMutationLen)) {
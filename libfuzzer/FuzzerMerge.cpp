@@ -14,22 +14,45 @@
 #include "FuzzerMerge.h"
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
+#include "FuzzerPack.h"
+#include "FuzzerSHA1.h"
 #include "FuzzerTracePC.h"
 #include "FuzzerUtil.h"
 
+#include <cstring>
 #include <fstream>
 #include <iterator>
+#include <mutex>
+#include <queue>
 #include <set>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace fuzzer {
 
 bool Merger::Parse(const std::string &Str, bool ParseCoverage) {
+  auto Data = reinterpret_cast<const uint8_t *>(Str.data());
+  if (IsBinaryMergeControlFile(Data, Str.size()))
+    return ParseBinary(Data, Str.size(), ParseCoverage);
   std::istringstream SS(Str);
   return Parse(SS, ParseCoverage);
 }
 
+bool Merger::ParseFile(const std::string &Path, bool ParseCoverage) {
+  size_t Size = 0;
+  const uint8_t *Data = MapFile(Path, &Size);
+  if (IsBinaryMergeControlFile(Data, Size)) {
+    bool Res = ParseBinary(Data, Size, ParseCoverage);
+    UnmapFile(Data, Size);
+    return Res;
+  }
+  UnmapFile(Data, Size);
+  std::ifstream IF(Path);
+  return Parse(IF, ParseCoverage);
+}
+
 void Merger::ParseOrExit(std::istream &IS, bool ParseCoverage) {
   if (!Parse(IS, ParseCoverage)) {
     Printf("MERGE: failed to parse the control file (unexpected error)\n");
@@ -37,6 +60,203 @@ void Merger::ParseOrExit(std::istream &IS, bool ParseCoverage) {
   }
 }
 
+void Merger::ParseFileOrExit(const std::string &Path, bool ParseCoverage) {
+  if (!ParseFile(Path, ParseCoverage)) {
+    Printf("MERGE: failed to parse the control file (unexpected error)\n");
+    exit(1);
+  }
+}
+
+bool IsBinaryMergeControlFile(const uint8_t *Data, size_t Size) {
+  return Size >= kMergeControlFileMagicSize &&
+         !memcmp(Data, kMergeControlFileMagic, kMergeControlFileMagicSize);
+}
+
+void AppendMergeControlFileHeader(const std::vector<std::string> &Files,
+                                  size_t NumFilesInFirstCorpus, Unit *Out) {
+  Out->insert(Out->end(), kMergeControlFileMagic,
+              kMergeControlFileMagic + kMergeControlFileMagicSize);
+  AppendVarint(kMergeControlFileVersion, Out);
+  AppendVarint(Files.size(), Out);
+  AppendVarint(NumFilesInFirstCorpus, Out);
+  for (auto &Name : Files) {
+    AppendVarint(Name.size(), Out);
+    Out->insert(Out->end(), Name.begin(), Name.end());
+  }
+}
+
+static void AppendMergeRecord(MergeRecordMarker Marker, size_t FileIdx,
+                              const Unit &Payload, Unit *Out) {
+  Out->push_back(Marker);
+  AppendVarint(FileIdx, Out);
+  AppendVarint(Payload.size(), Out);
+  Out->insert(Out->end(), Payload.begin(), Payload.end());
+}
+
+void AppendMergeStartedRecord(size_t FileIdx, size_t FileSize, Unit *Out) {
+  Unit Payload;
+  AppendVarint(FileSize, &Payload);
+  AppendMergeRecord(kMergeRecordStarted, FileIdx, Payload, Out);
+}
+
+// Appends the count and the delta-encoded sorted values.
+static void AppendMergeValues(const std::vector<uint32_t> &Values, Unit *Out) {
+  assert(std::is_sorted(Values.begin(), Values.end()));
+  AppendVarint(Values.size(), Out);
+  uint32_t Prev = 0;
+  for (uint32_t V : Values) {
+    AppendVarint(V - Prev, Out);
+    Prev = V;
+  }
+}
+
+void AppendMergeValuesRecord(MergeRecordMarker Marker, size_t FileIdx,
+                             const std::vector<uint32_t> &Values, Unit *Out) {
+  Unit Payload;
+  AppendMergeValues(Values, &Payload);
+  AppendMergeRecord(Marker, FileIdx, Payload, Out);
+}
+
+// Reads Count sorted delta-encoded values.
+static bool ReadMergeValues(const uint8_t *P, const uint8_t *End,
+                            std::vector<uint32_t> *Values) {
+  uint64_t Count, Delta, V = 0;
+  if (!ReadVarint(&P, End, &Count) || Count > static_cast<size_t>(End - P))
+    return false;
+  Values->clear();
+  Values->reserve(Count);
+  for (uint64_t i = 0; i < Count; i++) {
+    if (!ReadVarint(&P, End, &Delta))
+      return false;
+    V += Delta;
+    if (V > UINT32_MAX)
+      return false;
+    Values->push_back(static_cast<uint32_t>(V));
+  }
+  return true;
+}
+
+void AppendMergeFeatureCacheHeader(Unit *Out) {
+  Out->insert(Out->end(), kMergeFeatureCacheMagic,
+              kMergeFeatureCacheMagic + kMergeControlFileMagicSize);
+  AppendVarint(kMergeControlFileVersion, Out);
+}
+
+void AppendMergeFeatureCacheRecord(const uint8_t Sha1[kSHA1NumBytes],
+                                   const std::vector<uint32_t> &Features,
+                                   Unit *Out) {
+  Unit Payload;
+  AppendMergeValues(Features, &Payload);
+  Out->insert(Out->end(), Sha1, Sha1 + kSHA1NumBytes);
+  AppendVarint(Payload.size(), Out);
+  Out->insert(Out->end(), Payload.begin(), Payload.end());
+}
+
+bool ParseMergeFeatureCache(
+    const uint8_t *Data, size_t Size,
+    std::unordered_map<std::string, std::vector<uint32_t>> *Cache) {
+  const uint8_t *P = Data, *End = Data + Size;
+  uint64_t Version;
+  if (Size < kMergeControlFileMagicSize ||
+      memcmp(P, kMergeFeatureCacheMagic, kMergeControlFileMagicSize))
+    return false;
+  P += kMergeControlFileMagicSize;
+  if (!ReadVarint(&P, End, &Version) || Version != kMergeControlFileVersion)
+    return false;
+  std::vector<uint32_t> Features;
+  while (End - P >= kSHA1NumBytes) {
+    std::string Sha1(reinterpret_cast<const char *>(P), kSHA1NumBytes);
+    P += kSHA1NumBytes;
+    uint64_t Len;
+    if (!ReadVarint(&P, End, &Len) || Len > static_cast<size_t>(End - P))
+      break;  // Truncated record.
+    if (!ReadMergeValues(P, P + Len, &Features))
+      return false;
+    (*Cache)[Sha1] = Features;
+    P += Len;
+  }
+  return true;
+}
+
+// The same checks as in the text parser below. The last record may be
+// incomplete if the inner process died while writing it, it is ignored.
+bool Merger::ParseBinary(const uint8_t *Data, size_t Size,
+                         bool ParseCoverage) {
+  LastFailure.clear();
+  IsBinary = true;
+  if (!IsBinaryMergeControlFile(Data, Size))
+    return false;
+  const uint8_t *P = Data + kMergeControlFileMagicSize, *End = Data + Size;
+  uint64_t Version, NumFiles, NumFirst;
+  if (!ReadVarint(&P, End, &Version) || Version != kMergeControlFileVersion)
+    return false;
+  if (!ReadVarint(&P, End, &NumFiles) || NumFiles == 0 || NumFiles > 10000000)
+    return false;
+  if (!ReadVarint(&P, End, &NumFirst) || NumFirst > NumFiles)
+    return false;
+  NumFilesInFirstCorpus = NumFirst;
+  Files.resize(NumFiles);
+  for (auto &F : Files) {
+    uint64_t Len;
+    if (!ReadVarint(&P, End, &Len) || Len > static_cast<size_t>(End - P))
+      return false;
+    F.Name.assign(reinterpret_cast<const char *>(P), Len);
+    P += Len;
+  }
+
+  size_t ExpectedStartMarker = 0;
+  const size_t kInvalidStartMarker = -1;
+  size_t LastSeenStartMarker = kInvalidStartMarker;
+  bool HaveFtMarker = true;
+  std::vector<uint32_t> Values;
+  std::set<uint32_t> PCs;
+  while (P < End) {
+    uint8_t Marker = *P++;
+    uint64_t Idx, Len;
+    if (!ReadVarint(&P, End, &Idx) || !ReadVarint(&P, End, &Len) ||
+        Len > static_cast<size_t>(End - P))
+      break;  // Truncated record.
+    const uint8_t *Payload = P;
+    P += Len;
+    if (Marker == kMergeRecordStarted) {
+      uint64_t FileSize;
+      if (ExpectedStartMarker != Idx || Idx >= Files.size() ||
+          !ReadVarint(&Payload, P, &FileSize))
+        return false;
+      Files[Idx].Size = FileSize;
+      LastSeenStartMarker = ExpectedStartMarker;
+      ExpectedStartMarker++;
+      HaveFtMarker = false;
+    } else if (Marker == kMergeRecordFeatures) {
+      if (Idx != LastSeenStartMarker)
+        return false;
+      HaveFtMarker = true;
+      if (ParseCoverage) {
+        if (!ReadMergeValues(Payload, P, &Values))
+          return false;
+        Files[Idx].Features = Values;
+      }
+    } else if (Marker == kMergeRecordCoverage) {
+      if (Idx != LastSeenStartMarker)
+        return false;
+      if (ParseCoverage) {
+        if (!ReadMergeValues(Payload, P, &Values))
+          return false;
+        for (uint32_t PC : Values)
+          if (PCs.insert(PC).second)
+            Files[Idx].Cov.push_back(PC);
+      }
+    } else {
+      return false;
+    }
+  }
+  if (!HaveFtMarker && LastSeenStartMarker != kInvalidStartMarker)
+    LastFailure = Files[LastSeenStartMarker].Name;
+
+  FirstNotProcessedFile = ExpectedStartMarker;
+  return true;
+}
+
 // The control file example:
 //
 // 3 # The number of inputs
@@ -53,6 +273,7 @@ void Merger::ParseOrExit(std::istream &IS, bool ParseCoverage) {
 // COV 2 11 12
 bool Merger::Parse(std::istream &IS, bool ParseCoverage) {
   LastFailure.clear();
+  IsBinary = false;
   std::string Line;
 
   // Parse NumFiles.
@@ -147,20 +368,22 @@ size_t Merger::Merge(const std::set<uint32_t> &InitialFeatures,
   NewFeatures->clear();
   NewCov->clear();
   assert(NumFilesInFirstCorpus <= Files.size());
-  std::set<uint32_t> AllFeatures = InitialFeatures;
+  FeatureBitSet AllFeatures;
+  for (auto Fe : InitialFeatures)
+    AllFeatures.insert(Fe);
 
   // What features are in the initial corpus?
-  for (size_t i = 0; i < NumFilesInFirstCorpus; i++) {
-    auto &Cur = Files[i].Features;
-    AllFeatures.insert(Cur.begin(), Cur.end());
-  }
+  for (size_t i = 0; i < NumFilesInFirstCorpus; i++)
+    for (auto Fe : Files[i].Features)
+      AllFeatures.insert(Fe);
   // Remove all features that we already know from all other inputs.
   for (size_t i = NumFilesInFirstCorpus; i < Files.size(); i++) {
     auto &Cur = Files[i].Features;
-    std::vector<uint32_t> Tmp;
-    std::set_difference(Cur.begin(), Cur.end(), AllFeatures.begin(),
-                        AllFeatures.end(), std::inserter(Tmp, Tmp.begin()));
-    Cur.swap(Tmp);
+    Cur.erase(std::remove_if(Cur.begin(), Cur.end(),
+                             [&](uint32_t Fe) {
+                               return AllFeatures.contains(Fe);
+                             }),
+              Cur.end());
   }
 
   // Sort. Give preference to
@@ -173,6 +396,10 @@ size_t Merger::Merge(const std::set<uint32_t> &InitialFeatures,
               return a.Features.size() > b.Features.size();
             });
 
+  FeatureBitSet KnownCov;
+  for (auto Cov : InitialCov)
+    KnownCov.insert(Cov);
+
   // One greedy pass: add the file's features to AllFeatures.
   // If new features were added, add this file to NewFiles.
   for (size_t i = NumFilesInFirstCorpus; i < Files.size(); i++) {
@@ -181,35 +408,70 @@ size_t Merger::Merge(const std::set<uint32_t> &InitialFeatures,
     //       Files[i].Size, Cur.size());
     bool FoundNewFeatures = false;
     for (auto Fe: Cur) {
-      if (AllFeatures.insert(Fe).second) {
+      if (AllFeatures.insert(Fe)) {
         FoundNewFeatures = true;
-        NewFeatures->insert(Fe);
+        NewFeatures->insert(NewFeatures->end(), Fe);
       }
     }
     if (FoundNewFeatures)
       NewFiles->push_back(Files[i].Name);
     for (auto Cov : Files[i].Cov)
-      if (InitialCov.find(Cov) == InitialCov.end())
+      if (KnownCov.insert(Cov))
         NewCov->insert(Cov);
   }
   return NewFeatures->size();
 }
 
 std::set<uint32_t> Merger::AllFeatures() const {
-  std::set<uint32_t> S;
+  FeatureBitSet Features;
   for (auto &File : Files)
-    S.insert(File.Features.begin(), File.Features.end());
+    for (auto Fe : File.Features)
+      Features.insert(Fe);
+  std::set<uint32_t> S;
+  Features.ForEach([&](uint32_t Fe) { S.insert(S.end(), Fe); });
   return S;
 }
 
+// Appends the STARTED record to a control file in the given format.
+static void WriteStartedRecord(std::ostream &OS, bool Binary, size_t FileIdx,
+                               size_t FileSize) {
+  if (Binary) {
+    Unit Record;
+    AppendMergeStartedRecord(FileIdx, FileSize, &Record);
+    OS.write(reinterpret_cast<const char *>(Record.data()), Record.size());
+  } else {
+    OS << "STARTED " << FileIdx << " " << FileSize << "\n";
+  }
+}
+
+// Appends the FT and COV records. Features must be sorted.
+static void WriteCoverageRecords(std::ostream &OS, bool Binary, size_t FileIdx,
+                                 const std::vector<uint32_t> &Features,
+                                 std::vector<uint32_t> Cov) {
+  if (Binary) {
+    std::sort(Cov.begin(), Cov.end());
+    Unit Record;
+    AppendMergeValuesRecord(kMergeRecordFeatures, FileIdx, Features, &Record);
+    AppendMergeValuesRecord(kMergeRecordCoverage, FileIdx, Cov, &Record);
+    OS.write(reinterpret_cast<const char *>(Record.data()), Record.size());
+  } else {
+    OS << "FT " << FileIdx;
+    for (uint32_t F : Features)
+      OS << " " << F;
+    OS << "\n";
+    OS << "COV " << FileIdx;
+    for (uint32_t C : Cov)
+      OS << " " << C;
+    OS << "\n";
+  }
+}
+
 // Inner process. May crash if the target crashes.
 void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath,
                                              bool IsSetCoverMerge) {
   Printf("MERGE-INNER: using the control file '%s'\n", CFPath.c_str());
   Merger M;
-  std::ifstream IF(CFPath);
-  M.ParseOrExit(IF, false);
-  IF.close();
+  M.ParseFileOrExit(CFPath, false);
   if (!M.LastFailure.empty())
     Printf("MERGE-INNER: '%s' caused a failure at the previous merge step\n",
            M.LastFailure.c_str());
@@ -219,7 +481,8 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath,
          M.Files.size(), M.FirstNotProcessedFile,
          M.Files.size() - M.FirstNotProcessedFile);
 
-  std::ofstream OF(CFPath, std::ofstream::out | std::ofstream::app);
+  std::ofstream OF(CFPath, std::ofstream::out | std::ofstream::app |
+                              std::ofstream::binary);
   std::set<size_t> AllFeatures;
   auto PrintStatsWrapper = [this, &AllFeatures](const char* Where) {
     this->PrintStats(Where, "\n", 0, AllFeatures.size());
@@ -234,7 +497,7 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath,
     }
 
     // Write the pre-run marker.
-    OF << "STARTED " << i << " " << U.size() << "\n";
+    WriteStartedRecord(OF, M.IsBinary, i, U.size());
     OF.flush();  // Flush is important since Command::Execute may crash.
     // Run.
     TPC.ResetMaps();
@@ -257,16 +520,15 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath,
     if (TotalNumberOfRuns == M.NumFilesInFirstCorpus)
       PrintStatsWrapper("LOADED");
     // Write the post-run marker and the coverage.
-    OF << "FT " << i;
-    for (size_t F : Features)
-      OF << " " << F;
-    OF << "\n";
-    OF << "COV " << i;
+    std::vector<uint32_t> Cov;
     TPC.ForEachObservedPC([&](const TracePC::PCTableEntry *TE) {
       if (AllPCs.insert(TE).second)
-        OF << " " << TPC.PCTableEntryIdx(TE);
+        Cov.push_back(TPC.PCTableEntryIdx(TE));
     });
-    OF << "\n";
+    WriteCoverageRecords(
+        OF, M.IsBinary, i,
+        std::vector<uint32_t>(Features.begin(), Features.end()),
+        std::move(Cov));
     OF.flush();
   }
   PrintStatsWrapper("DONE  ");
@@ -279,6 +541,12 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath,
 // Generally, this means that files with more features are preferred for
 // merge into the first corpus. When two files have the same number of
 // features, the smaller one is preferred.
+//
+// This is the lazy variant of the greedy algorithm: the number of features
+// a file adds can only go down as more features get covered, so the queue
+// keeps the last computed number for every file and only the top file is
+// recounted. It takes the top file once its number is up to date. Ties are
+// broken as a full rescan would: by smaller size, then by smaller index.
 size_t Merger::SetCoverMerge(const std::set<uint32_t> &InitialFeatures,
                              std::set<uint32_t> *NewFeatures,
                              const std::set<uint32_t> &InitialCov,
@@ -288,116 +556,89 @@ size_t Merger::SetCoverMerge(const std::set<uint32_t> &InitialFeatures,
   NewFiles->clear();
   NewFeatures->clear();
   NewCov->clear();
-  std::set<uint32_t> AllFeatures;
   // 1 << 21 - 1 is the maximum feature index.
   // See 'kFeatureSetSize' in 'FuzzerCorpus.h'.
   const uint32_t kFeatureSetSize = 1 << 21;
-  std::vector<bool> Covered(kFeatureSetSize, false);
-  size_t NumCovered = 0;
-
-  std::set<uint32_t> ExistingFeatures = InitialFeatures;
-  for (size_t i = 0; i < NumFilesInFirstCorpus; ++i)
-    ExistingFeatures.insert(Files[i].Features.begin(), Files[i].Features.end());
+  // Calculate an underestimation of the set of covered features
+  // since the `Covered` bitvector is smaller than the feature range.
+  FeatureBitSet Covered, AllFeatures;
 
   // Mark the existing features as covered.
-  for (const auto &F : ExistingFeatures) {
-    if (!Covered[F % kFeatureSetSize]) {
-      ++NumCovered;
-      Covered[F % kFeatureSetSize] = true;
-    }
-    // Calculate an underestimation of the set of covered features
-    // since the `Covered` bitvector is smaller than the feature range.
+  auto MarkExisting = [&](uint32_t F) {
+    Covered.insert(F % kFeatureSetSize);
     AllFeatures.insert(F % kFeatureSetSize);
-  }
-
-  std::set<size_t> RemainingFiles;
+  };
+  for (auto F : InitialFeatures)
+    MarkExisting(F);
+  for (size_t i = 0; i < NumFilesInFirstCorpus; ++i)
+    for (auto F : Files[i].Features)
+      MarkExisting(F);
+
+  auto CountUncovered = [&](const MergeFileInfo &File) {
+    size_t N = 0;
+    for (const auto &F : File.Features)
+      N += !Covered.contains(F % kFeatureSetSize);
+    return N;
+  };
+  struct Candidate {
+    size_t NumFeatures, Size, Idx;
+    bool operator<(const Candidate &B) const {  // The top is the best.
+      if (NumFeatures != B.NumFeatures)
+        return NumFeatures < B.NumFeatures;
+      if (Size != B.Size)
+        return Size > B.Size;
+      return Idx > B.Idx;
+    }
+  };
+  std::priority_queue<Candidate> Queue;
   for (size_t i = NumFilesInFirstCorpus; i < Files.size(); ++i) {
-    // Construct an incremental sequence which represent the
-    // indices to all files (excluding those in the initial corpus).
-    // RemainingFiles = range(NumFilesInFirstCorpus..Files.size()).
-    RemainingFiles.insert(i);
     // Insert this file's unique features to all features.
     for (const auto &F : Files[i].Features)
       AllFeatures.insert(F % kFeatureSetSize);
+    if (size_t N = CountUncovered(Files[i]))
+      Queue.push({N, Files[i].Size, i});
   }
 
+  FeatureBitSet KnownCov;
+  for (auto C : InitialCov)
+    KnownCov.insert(C);
+
   // Integrate files into Covered until set is complete.
-  while (NumCovered != AllFeatures.size()) {
-    // Index to file with largest number of unique features.
-    size_t MaxFeaturesIndex = NumFilesInFirstCorpus;
-    // Indices to remove from RemainingFiles.
-    std::set<size_t> RemoveIndices;
-    // Running max unique feature count.
-    // Updated upon finding a file with more features.
-    size_t MaxNumFeatures = 0;
-
-    // Iterate over all files not yet integrated into Covered,
-    // to find the file which has the largest number of
-    // features that are not already in Covered.
-    for (const auto &i : RemainingFiles) {
-      const auto &File = Files[i];
-      size_t CurrentUnique = 0;
-      // Count number of features in this file
-      // which are not yet in Covered.
-      for (const auto &F : File.Features)
-        if (!Covered[F % kFeatureSetSize])
-          ++CurrentUnique;
-
-      if (CurrentUnique == 0) {
-        // All features in this file are already in Covered: skip next time.
-        RemoveIndices.insert(i);
-      } else if (CurrentUnique > MaxNumFeatures ||
-                 (CurrentUnique == MaxNumFeatures &&
-                  File.Size < Files[MaxFeaturesIndex].Size)) {
-        // Update the max features file based on unique features
-        // Break ties by selecting smaller files.
-        MaxNumFeatures = CurrentUnique;
-        MaxFeaturesIndex = i;
-      }
-    }
-    // Must be a valid index/
-    assert(MaxFeaturesIndex < Files.size());
-    // Remove any feature-less files found.
-    for (const auto &i : RemoveIndices)
-      RemainingFiles.erase(i);
-    if (MaxNumFeatures == 0) {
-      // Did not find a file that adds unique features.
-      // This means that we should have no remaining files.
-      assert(RemainingFiles.size() == 0);
-      assert(NumCovered == AllFeatures.size());
-      break;
+  while (Covered.size() != AllFeatures.size()) {
+    assert(!Queue.empty());
+    Candidate Top = Queue.top();
+    Queue.pop();
+    size_t N = CountUncovered(Files[Top.Idx]);
+    if (N != Top.NumFeatures) {
+      // Stale: requeue with the current number, unless it adds nothing.
+      if (N)
+        Queue.push({N, Top.Size, Top.Idx});
+      continue;
     }
-
-    // MaxFeaturesIndex must be an element of Remaining.
-    assert(RemainingFiles.find(MaxFeaturesIndex) != RemainingFiles.end());
-    // Remove the file with the most features from Remaining.
-    RemainingFiles.erase(MaxFeaturesIndex);
-    const auto &MaxFeatureFile = Files[MaxFeaturesIndex];
+    const auto &MaxFeatureFile = Files[Top.Idx];
     // Add the features of the max feature file to Covered.
-    for (const auto &F : MaxFeatureFile.Features) {
-      if (!Covered[F % kFeatureSetSize]) {
-        ++NumCovered;
-        Covered[F % kFeatureSetSize] = true;
+    for (const auto &F : MaxFeatureFile.Features)
+      if (Covered.insert(F % kFeatureSetSize))
         NewFeatures->insert(F);
-      }
-    }
     // Add the index to this file to the result.
     NewFiles->push_back(MaxFeatureFile.Name);
     // Update NewCov with the additional coverage
     // that MaxFeatureFile provides.
     for (const auto &C : MaxFeatureFile.Cov)
-      if (InitialCov.find(C) == InitialCov.end())
+      if (KnownCov.insert(C))
         NewCov->insert(C);
   }
 
   return NewFeatures->size();
 }
 
-static size_t
-WriteNewControlFile(const std::string &CFPath,
-                    const std::vector<SizedFile> &OldCorpus,
-                    const std::vector<SizedFile> &NewCorpus,
-                    const std::vector<MergeFileInfo> &KnownFiles) {
+// The inputs that still have to go through the inner process, the ones of
+// the first corpus first.
+static std::vector<std::string>
+FilesToMerge(const std::vector<SizedFile> &OldCorpus,
+             const std::vector<SizedFile> &NewCorpus,
+             const std::vector<MergeFileInfo> &KnownFiles,
+             size_t *NumFilesFromOldCorpus) {
   std::unordered_set<std::string> FilesToSkip;
   for (auto &SF: KnownFiles)
     FilesToSkip.insert(SF.Name);
@@ -409,24 +650,163 @@ WriteNewControlFile(const std::string &CFPath,
   };
   for (auto &SF: OldCorpus)
     MaybeUseFile(SF.File);
-  auto FilesToUseFromOldCorpus = FilesToUse.size();
+  *NumFilesFromOldCorpus = FilesToUse.size();
   for (auto &SF: NewCorpus)
     MaybeUseFile(SF.File);
+  return FilesToUse;
+}
 
+// Writes a fresh control file. If Processed is given, the coverage of every
+// input is written too, as if the inner process had already run it.
+static void WriteNewControlFile(const std::string &CFPath,
+                                const std::vector<std::string> &FilesToUse,
+                                size_t FilesToUseFromOldCorpus, bool Binary,
+                                const std::vector<MergeFileInfo> *Processed =
+                                    nullptr) {
   RemoveFile(CFPath);
-  std::ofstream ControlFile(CFPath);
-  ControlFile << FilesToUse.size() << "\n";
-  ControlFile << FilesToUseFromOldCorpus << "\n";
-  for (auto &FN: FilesToUse)
-    ControlFile << FN << "\n";
+  std::ofstream ControlFile(CFPath, std::ofstream::out | std::ofstream::binary);
+  if (Binary) {
+    Unit Header;
+    AppendMergeControlFileHeader(FilesToUse, FilesToUseFromOldCorpus, &Header);
+    ControlFile.write(reinterpret_cast<const char *>(Header.data()),
+                      Header.size());
+  } else {
+    ControlFile << FilesToUse.size() << "\n";
+    ControlFile << FilesToUseFromOldCorpus << "\n";
+    for (auto &FN: FilesToUse)
+      ControlFile << FN << "\n";
+  }
+  if (Processed) {
+    for (size_t i = 0; i < Processed->size(); i++) {
+      auto &F = (*Processed)[i];
+      WriteStartedRecord(ControlFile, Binary, i, F.Size);
+      WriteCoverageRecords(ControlFile, Binary, i, F.Features, F.Cov);
+    }
+  }
 
   if (!ControlFile) {
     Printf("MERGE-OUTER: failed to write to the control file: %s\n",
            CFPath.c_str());
     exit(1);
   }
+}
+
+// Executes the inner process until it passes.
+// Every inner process should execute at least one input.
+static void RunInnerMergeProcesses(const Command &BaseCmd,
+                                   const std::string &CFPath,
+                                   size_t NumAttempts, bool IsSetCoverMerge,
+                                   bool V, std::string JobName) {
+  for (size_t Attempt = 1; Attempt <= NumAttempts; Attempt++) {
+    Fuzzer::MaybeExitGracefully();
+    VPrintf(V, "MERGE-OUTER: %sattempt %zd\n", JobName.c_str(), Attempt);
+    Command Cmd(BaseCmd);
+    Cmd.addFlag("merge_control_file", CFPath);
+    // If we are going to use the set cover implementation for
+    // minimization add the merge_inner=2 internal flag.
+    Cmd.addFlag("merge_inner", IsSetCoverMerge ? "2" : "1");
+    if (!V) {
+      Cmd.setOutputFile(getDevNull());
+      Cmd.combineOutAndErr();
+    }
+    auto ExitCode = ExecuteCommand(Cmd);
+    if (!ExitCode) {
+      VPrintf(V, "MERGE-OUTER: %ssuccessful in %zd attempt(s)\n",
+              JobName.c_str(), Attempt);
+      break;
+    }
+  }
+}
+
+// Splits the inputs round-robin between NumJobs control files CFPath.0,
+// CFPath.1, ... and runs an inner process on each of them in parallel.
+// A crash only restarts the inner process of its own shard. Round-robin
+// keeps the inputs of the first corpus first in every shard and gives the
+// shards a similar mix of input sizes. The shards are then combined into M,
+// in the original order of the inputs, and into the control file at CFPath.
+static void ParallelMerge(const Command &BaseCmd, const std::string &CFPath,
+                          const std::vector<std::string> &FilesToUse,
+                          size_t FilesToUseFromOldCorpus, size_t NumJobs,
+                          bool IsSetCoverMerge, bool Binary, bool V,
+                          Merger *M) {
+  std::vector<std::string> ShardPaths(NumJobs);
+  std::vector<size_t> ShardSizes(NumJobs);
+  for (size_t Job = 0; Job < NumJobs; Job++) {
+    std::vector<std::string> ShardFiles;
+    for (size_t i = Job; i < FilesToUse.size(); i += NumJobs)
+      ShardFiles.push_back(FilesToUse[i]);
+    ShardPaths[Job] = CFPath + "." + std::to_string(Job);
+    ShardSizes[Job] = ShardFiles.size();
+    WriteNewControlFile(ShardPaths[Job], ShardFiles,
+                        (FilesToUseFromOldCorpus + NumJobs - 1 - Job) / NumJobs,
+                        Binary);
+  }
+  VPrintf(V, "MERGE-OUTER: merging in %zd parallel jobs\n", NumJobs);
+
+  std::vector<std::thread> Threads;
+  for (size_t Job = 0; Job < NumJobs; Job++)
+    Threads.push_back(std::thread(RunInnerMergeProcesses, std::cref(BaseCmd),
+                                  std::cref(ShardPaths[Job]), ShardSizes[Job],
+                                  IsSetCoverMerge, V,
+                                  "job " + std::to_string(Job) + ": "));
+  for (auto &T : Threads)
+    T.join();
+
+  size_t NumBytes = 0;
+  std::vector<Merger> Shards(NumJobs);
+  for (size_t Job = 0; Job < NumJobs; Job++) {
+    NumBytes += FileSize(ShardPaths[Job]);
+    Shards[Job].ParseFileOrExit(ShardPaths[Job], true);
+  }
+  VPrintf(V, "MERGE-OUTER: the control files have %zd bytes\n", NumBytes);
+  M->Files.resize(FilesToUse.size());
+  for (size_t i = 0; i < FilesToUse.size(); i++)
+    M->Files[i] = std::move(Shards[i % NumJobs].Files[i / NumJobs]);
+  M->NumFilesInFirstCorpus = FilesToUseFromOldCorpus;
+  M->FirstNotProcessedFile = FilesToUse.size();
+
+  // Leave a completed control file behind, as a sequential merge does, so
+  // that it can be reused by the next merge.
+  WriteNewControlFile(CFPath, FilesToUse, FilesToUseFromOldCorpus, Binary,
+                      &M->Files);
+  for (auto &Path : ShardPaths)
+    RemoveFile(Path);
+}
+
+// The feature cache of a corpus is shared by all the builds of the target,
+// each build has its own file in it.
+std::string MergeFeatureCacheDir(const std::string &Corpus) {
+  // A packed corpus is a file, its cache lives next to it.
+  if (IsPackedCorpus(Corpus))
+    return Corpus + kMergeFeatureCacheDir;
+  return DirPlusFile(Corpus, kMergeFeatureCacheDir);
+}
+
+// Identifies the build of the target for the feature cache. Empty if the
+// binary can't be read.
+static std::string TargetBuildId(const std::string &Binary) {
+  static std::mutex Mu;
+  static std::unordered_map<std::string, std::string> Ids;
+  std::lock_guard<std::mutex> Lock(Mu);
+  auto &Id = Ids[Binary];
+  if (Id.empty()) {
+    // The inner processes run argv[0], i.e. this binary, but argv[0] itself
+    // may be a bare name from $PATH or a relative path that can't be opened.
+#if LIBFUZZER_LINUX
+    auto Exe = FileToVector("/proc/self/exe", 0, /*ExitOnError=*/false);
+#else
+    auto Exe = FileToVector(Binary, 0, /*ExitOnError=*/false);
+#endif
+    if (!Exe.empty())
+      Id = Hash(Exe);
+  }
+  return Id;
+}
 
-  return FilesToUse.size();
+static std::string RawSha1(const Unit &U) {
+  uint8_t Sha1[kSHA1NumBytes];
+  ComputeSHA1(U.data(), U.size(), Sha1);
+  return std::string(reinterpret_cast<char *>(Sha1), kSHA1NumBytes);
 }
 
 // Outer process. Does not call the target code and thus should not fail.
@@ -439,7 +819,10 @@ void CrashResistantMerge(const std::vector<std::string> &Args,
                          const std::set<uint32_t> &InitialCov,
                          std::set<uint32_t> *NewCov, const std::string &CFPath,
                          bool V, /*Verbose*/
-                         bool IsSetCoverMerge) {
+                         bool IsSetCoverMerge, bool BinaryControlFile,
+                         size_t NumJobs, const std::string &FeatureCacheDir,
+                         std::unordered_map<std::string, std::vector<uint32_t>>
+                             *NewFileFeatures) {
   if (NewCorpus.empty() && OldCorpus.empty()) return;  // Nothing to merge.
   size_t NumAttempts = 0;
   std::vector<MergeFileInfo> KnownFiles;
@@ -447,8 +830,7 @@ void CrashResistantMerge(const std::vector<std::string> &Args,
     VPrintf(V, "MERGE-OUTER: non-empty control file provided: '%s'\n",
            CFPath.c_str());
     Merger M;
-    std::ifstream IF(CFPath);
-    if (M.Parse(IF, /*ParseCoverage=*/true)) {
+    if (M.ParseFile(CFPath, /*ParseCoverage=*/true)) {
       VPrintf(V, "MERGE-OUTER: control file ok, %zd files total,"
              " first not processed file %zd\n",
              M.Files.size(), M.FirstNotProcessedFile);
@@ -474,6 +856,7 @@ void CrashResistantMerge(const std::vector<std::string> &Args,
         KnownFiles = M.Files;
       } else {
         // There is a merge in progress, continue.
+        // It is resumed by a single inner process.
         NumAttempts = M.Files.size() - M.FirstNotProcessedFile;
       }
     } else {
@@ -481,58 +864,147 @@ void CrashResistantMerge(const std::vector<std::string> &Args,
     }
   }
 
+  // Look the inputs up in the feature cache, unless a merge is in progress.
+  // The cached features are complete, so the inner processes have to record
+  // complete features too, as they do for the set cover merge.
+  std::string CachePath;
+  std::unordered_map<std::string, std::vector<uint32_t>> Cache;
+  std::unordered_map<std::string, std::string> Sha1s;  // File name -> SHA1.
+  std::string BuildId;
+  if (!FeatureCacheDir.empty()) {
+    BuildId = TargetBuildId(Args[0]);
+    if (BuildId.empty())
+      Printf("MERGE-OUTER: can't read the target binary, the feature cache "
+             "is disabled\n");
+  }
+  if (!BuildId.empty() && !NumAttempts) {
+    MkDir(FeatureCacheDir);
+    CachePath = DirPlusFile(FeatureCacheDir, BuildId);
+    size_t Size = 0;
+    const uint8_t *Data = MapFile(CachePath, &Size);
+    if (Data && !ParseMergeFeatureCache(Data, Size, &Cache)) {
+      VPrintf(V, "MERGE-OUTER: bad feature cache, will overwrite it: %s\n",
+              CachePath.c_str());
+      Cache.clear();
+      RemoveFile(CachePath);
+    }
+    UnmapFile(Data, Size);
+    std::unordered_set<std::string> Known;
+    for (auto &F : KnownFiles)
+      Known.insert(F.Name);
+    size_t NumCached = 0;
+    for (auto *Corpus : {&OldCorpus, &NewCorpus}) {
+      for (auto &SF : *Corpus) {
+        if (Known.count(SF.File))
+          continue;
+        auto Sha1 = RawSha1(FileToVector(SF.File, 0, /*ExitOnError=*/false));
+        auto It = Cache.find(Sha1);
+        if (It == Cache.end()) {
+          Sha1s[SF.File] = Sha1;
+          continue;
+        }
+        MergeFileInfo Info;
+        Info.Name = SF.File;
+        Info.Size = SF.Size;
+        Info.Features = It->second;
+        KnownFiles.push_back(std::move(Info));
+        NumCached++;
+      }
+    }
+    VPrintf(V, "MERGE-OUTER: %zd files found in the feature cache %s\n",
+            NumCached, CachePath.c_str());
+  }
+  // NewFileFeatures wants all the features of a file, not only the ones that
+  // no earlier file had.
+  bool FullFeatures = IsSetCoverMerge || !CachePath.empty() || NewFileFeatures;
+
+  std::vector<std::string> FilesToUse;
+  size_t FilesToUseFromOldCorpus = 0;
   if (!NumAttempts) {
     // The supplied control file is empty or bad, create a fresh one.
     VPrintf(V, "MERGE-OUTER: "
             "%zd files, %zd in the initial corpus, %zd processed earlier\n",
             OldCorpus.size() + NewCorpus.size(), OldCorpus.size(),
             KnownFiles.size());
-    NumAttempts = WriteNewControlFile(CFPath, OldCorpus, NewCorpus, KnownFiles);
+    FilesToUse = FilesToMerge(OldCorpus, NewCorpus, KnownFiles,
+                              &FilesToUseFromOldCorpus);
   }
 
-  // Execute the inner process until it passes.
-  // Every inner process should execute at least one input.
   Command BaseCmd(Args);
   BaseCmd.removeFlag("merge");
   BaseCmd.removeFlag("set_cover_merge");
+  BaseCmd.removeFlag("merge_jobs");
   BaseCmd.removeFlag("fork");
   BaseCmd.removeFlag("collect_data_flow");
-  for (size_t Attempt = 1; Attempt <= NumAttempts; Attempt++) {
-    Fuzzer::MaybeExitGracefully();
-    VPrintf(V, "MERGE-OUTER: attempt %zd\n", Attempt);
-    Command Cmd(BaseCmd);
-    Cmd.addFlag("merge_control_file", CFPath);
-    // If we are going to use the set cover implementation for
-    // minimization add the merge_inner=2 internal flag.
-    Cmd.addFlag("merge_inner", IsSetCoverMerge ? "2" : "1");
-    if (!V) {
-      Cmd.setOutputFile(getDevNull());
-      Cmd.combineOutAndErr();
-    }
-    auto ExitCode = ExecuteCommand(Cmd);
-    if (!ExitCode) {
-      VPrintf(V, "MERGE-OUTER: successful in %zd attempt(s)\n", Attempt);
-      break;
+  Merger M;
+  NumJobs = std::min(NumJobs, FilesToUse.size());
+  if (NumJobs > 1) {
+    ParallelMerge(BaseCmd, CFPath, FilesToUse, FilesToUseFromOldCorpus,
+                  NumJobs, FullFeatures, BinaryControlFile, V, &M);
+  } else if (!NumAttempts && FilesToUse.empty()) {
+    VPrintf(V, "MERGE-OUTER: all files are known, nothing to execute\n");
+  } else {
+    if (!NumAttempts) {
+      WriteNewControlFile(CFPath, FilesToUse, FilesToUseFromOldCorpus,
+                          BinaryControlFile);
+      NumAttempts = FilesToUse.size();
     }
+    RunInnerMergeProcesses(BaseCmd, CFPath, NumAttempts, FullFeatures, V, "");
+    // Read the control file and do the merge.
+    VPrintf(V, "MERGE-OUTER: the control file has %zd bytes\n",
+            FileSize(CFPath));
+    M.ParseFileOrExit(CFPath, true);
   }
-  // Read the control file and do the merge.
-  Merger M;
-  std::ifstream IF(CFPath);
-  IF.seekg(0, IF.end);
-  VPrintf(V, "MERGE-OUTER: the control file has %zd bytes\n",
-          (size_t)IF.tellg());
-  IF.seekg(0, IF.beg);
-  M.ParseOrExit(IF, true);
-  IF.close();
   VPrintf(V,
           "MERGE-OUTER: consumed %zdMb (%zdMb rss) to parse the control file\n",
           M.ApproximateMemoryConsumption() >> 20, GetPeakRSSMb());
 
-  M.Files.insert(M.Files.end(), KnownFiles.begin(), KnownFiles.end());
+  if (!CachePath.empty()) {
+    Unit Records;
+    if (!FileSize(CachePath))
+      AppendMergeFeatureCacheHeader(&Records);
+    for (auto &F : M.Files) {
+      auto It = Sha1s.find(F.Name);
+      // Inputs without features most likely crashed, let them be retried.
+      if (It == Sha1s.end() || F.Features.empty())
+        continue;
+      AppendMergeFeatureCacheRecord(
+          reinterpret_cast<const uint8_t *>(It->second.data()), F.Features,
+          &Records);
+    }
+    if (!Records.empty())
+      AppendToFile(Records.data(), Records.size(), CachePath);
+  }
+
+  // The known inputs of the first corpus stay in the first corpus.
+  std::unordered_set<std::string> OldCorpusFiles;
+  for (auto &SF : OldCorpus)
+    OldCorpusFiles.insert(SF.File);
+  std::vector<MergeFileInfo> Files(M.Files.begin(),
+                                   M.Files.begin() + M.NumFilesInFirstCorpus);
+  for (auto &F : KnownFiles)
+    if (OldCorpusFiles.count(F.Name))
+      Files.push_back(F);
+  size_t NumFilesInFirstCorpus = Files.size();
+  Files.insert(Files.end(), M.Files.begin() + M.NumFilesInFirstCorpus,
+               M.Files.end());
+  for (auto &F : KnownFiles)
+    if (!OldCorpusFiles.count(F.Name))
+      Files.push_back(F);
+  M.Files.swap(Files);
+  M.NumFilesInFirstCorpus = NumFilesInFirstCorpus;
+  // Merge drops the features that are already known from Files.
+  std::unordered_map<std::string, std::vector<uint32_t>> AllFileFeatures;
+  if (NewFileFeatures)
+    for (auto &F : M.Files)
+      AllFileFeatures[F.Name] = F.Features;
   if (IsSetCoverMerge)
     M.SetCoverMerge(InitialFeatures, NewFeatures, InitialCov, NewCov, NewFiles);
   else
     M.Merge(InitialFeatures, NewFeatures, InitialCov, NewCov, NewFiles);
+  if (NewFileFeatures)
+    for (auto &Name : *NewFiles)
+      (*NewFileFeatures)[Name] = std::move(AllFileFeatures[Name]);
   VPrintf(V, "MERGE-OUTER: %zd new files with %zd new features added; "
           "%zd new coverage edges\n",
          NewFiles->size(), NewFeatures->size(), NewCov->size());
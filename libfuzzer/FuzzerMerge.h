@@ -29,6 +29,21 @@
 //   file will be "STARTED INPUT_ID" and so the next process will know
 //   where to resume.
 //
+//   By default (-binary_merge_control_file=1) a new control file is binary:
+//   the magic "\x7fLFM" and a format version, the number of inputs, the
+//   number of inputs in the first corpus and the length-prefixed file names,
+//   then the same STARTED, FT and COV records. A record is its marker byte,
+//   the input id and the payload length as varints, then the payload: the
+//   input size for STARTED, the sorted delta-encoded values for FT and COV.
+//   Every record is flushed before the input is run, and a record cut short
+//   by a crash is ignored. The outer process parses it from an mmap-ed file.
+//   Text control files are still read, and the inner process keeps
+//   appending to a control file in the format it was created with.
+//
+//   With -merge_jobs=N the inputs are split round-robin between N control
+//   files (CONTROL_FILE.0 ... CONTROL_FILE.N-1) with an inner process each,
+//   running in parallel and restarted independently.
+//
 //   Once all inputs are processed by the inner process(es) the outer process
 //   reads the control files and does the merge based entirely on the contents
 //   of control file.
@@ -40,31 +55,134 @@
 #ifndef LLVM_FUZZER_MERGE_H
 #define LLVM_FUZZER_MERGE_H
 
+#include "FuzzerBuiltins.h"
+#include "FuzzerBuiltinsMsvc.h"
 #include "FuzzerDefs.h"
 #include "FuzzerIO.h"
+#include "FuzzerSHA1.h"
 
 #include <istream>
+#include <memory>
 #include <ostream>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 namespace fuzzer {
 
+// A set of 32-bit features: a bitmap over the whole feature space that is
+// allocated in 64Kbit chunks on first use, so that it stays small for the
+// sparse feature sets of real targets.
+class FeatureBitSet {
+ public:
+  // Returns true if F was not in the set.
+  bool insert(uint32_t F) {
+    if ((F >> kChunkBits) >= Chunks.size())
+      Chunks.resize((F >> kChunkBits) + 1);
+    auto &Chunk = Chunks[F >> kChunkBits];
+    if (!Chunk) {
+      Chunk.reset(new uint64_t[kChunkWords]());
+      NumChunks++;
+    }
+    uint64_t &Word = Chunk[(F & kChunkMask) / 64];
+    uint64_t Bit = 1ULL << (F % 64);
+    if (Word & Bit)
+      return false;
+    Word |= Bit;
+    Size++;
+    return true;
+  }
+  bool contains(uint32_t F) const {
+    if ((F >> kChunkBits) >= Chunks.size())
+      return false;
+    auto &Chunk = Chunks[F >> kChunkBits];
+    return Chunk && (Chunk[(F & kChunkMask) / 64] >> (F % 64)) & 1;
+  }
+  size_t size() const { return Size; }
+  size_t SizeInBytes() const {
+    return sizeof(*this) + Chunks.size() * sizeof(Chunks[0]) +
+           NumChunks * kChunkWords * sizeof(uint64_t);
+  }
+  // Calls CB on every feature in increasing order.
+  template <class Callback> void ForEach(Callback CB) const {
+    for (size_t C = 0; C < Chunks.size(); C++) {
+      if (!Chunks[C])
+        continue;
+      for (size_t W = 0; W < kChunkWords; W++)
+        for (uint64_t Word = Chunks[C][W]; Word; Word &= Word - 1)
+          CB(static_cast<uint32_t>((C << kChunkBits) + W * 64 +
+                                   Popcountll((Word & -Word) - 1)));
+    }
+  }
+
+ private:
+  static const size_t kChunkBits = 16;
+  static const uint32_t kChunkMask = (1U << kChunkBits) - 1;
+  static const size_t kChunkWords = (1 << kChunkBits) / 64;
+  std::vector<std::unique_ptr<uint64_t[]>> Chunks;
+  size_t NumChunks = 0;
+  size_t Size = 0;
+};
+
 struct MergeFileInfo {
   std::string Name;
   size_t Size = 0;
   std::vector<uint32_t> Features, Cov;
 };
 
+// The binary control file format, see above.
+const char kMergeControlFileMagic[] = "\x7fLFM";
+// The feature cache has the same magic size and version.
+const char kMergeFeatureCacheMagic[] = "\x7fLFC";
+const size_t kMergeControlFileMagicSize = 4;
+const uint64_t kMergeControlFileVersion = 1;
+enum MergeRecordMarker : uint8_t {
+  kMergeRecordStarted = 'S',
+  kMergeRecordFeatures = 'F',
+  kMergeRecordCoverage = 'C',
+};
+
+bool IsBinaryMergeControlFile(const uint8_t *Data, size_t Size);
+void AppendMergeControlFileHeader(const std::vector<std::string> &Files,
+                                  size_t NumFilesInFirstCorpus, Unit *Out);
+void AppendMergeStartedRecord(size_t FileIdx, size_t FileSize, Unit *Out);
+// Values must be sorted.
+void AppendMergeValuesRecord(MergeRecordMarker Marker, size_t FileIdx,
+                             const std::vector<uint32_t> &Values, Unit *Out);
+
+// With -merge_feature_cache=1 the features of every executed input are
+// kept in <first corpus>/.libfuzzer_features/<SHA1 of the target binary>
+// (<pack>.libfuzzer_features/ for a packed corpus), so that later merges
+// with the same binary don't execute it again. The file is the magic
+// "\x7fLFC" and a version, then appended records: the SHA1 of the input,
+// the payload length, the sorted delta-encoded features.
+// -features_log files (the per-job feature sets of -fork=N) use the same
+// format; there a later record of a SHA1 replaces the earlier one.
+const char kMergeFeatureCacheDir[] = ".libfuzzer_features";
+std::string MergeFeatureCacheDir(const std::string &Corpus);
+void AppendMergeFeatureCacheHeader(Unit *Out);
+void AppendMergeFeatureCacheRecord(const uint8_t Sha1[kSHA1NumBytes],
+                                   const std::vector<uint32_t> &Features,
+                                   Unit *Out);
+// Adds the records to Cache, keyed by the raw SHA1 bytes. A truncated last
+// record is ignored.
+bool ParseMergeFeatureCache(
+    const uint8_t *Data, size_t Size,
+    std::unordered_map<std::string, std::vector<uint32_t>> *Cache);
+
 struct Merger {
   std::vector<MergeFileInfo> Files;
   size_t NumFilesInFirstCorpus = 0;
   size_t FirstNotProcessedFile = 0;
   std::string LastFailure;
+  bool IsBinary = false;  // The format of the last parsed control file.
 
   bool Parse(std::istream &IS, bool ParseCoverage);
   bool Parse(const std::string &Str, bool ParseCoverage);
+  bool ParseBinary(const uint8_t *Data, size_t Size, bool ParseCoverage);
+  bool ParseFile(const std::string &Path, bool ParseCoverage);
   void ParseOrExit(std::istream &IS, bool ParseCoverage);
+  void ParseFileOrExit(const std::string &Path, bool ParseCoverage);
   size_t Merge(const std::set<uint32_t> &InitialFeatures,
                std::set<uint32_t> *NewFeatures,
                const std::set<uint32_t> &InitialCov, std::set<uint32_t> *NewCov,
@@ -78,6 +196,9 @@ struct Merger {
   std::set<uint32_t> AllFeatures() const;
 };
 
+// If NewFileFeatures is set, it gets all the features of each of the
+// NewFiles; the inner processes then record complete features, as they do
+// for the set cover merge.
 void CrashResistantMerge(const std::vector<std::string> &Args,
                          const std::vector<SizedFile> &OldCorpus,
                          const std::vector<SizedFile> &NewCorpus,
@@ -86,7 +207,11 @@ void CrashResistantMerge(const std::vector<std::string> &Args,
                          std::set<uint32_t> *NewFeatures,
                          const std::set<uint32_t> &InitialCov,
                          std::set<uint32_t> *NewCov, const std::string &CFPath,
-                         bool Verbose, bool IsSetCoverMerge);
+                         bool Verbose, bool IsSetCoverMerge,
+                         bool BinaryControlFile, size_t NumJobs,
+                         const std::string &FeatureCacheDir,
+                         std::unordered_map<std::string, std::vector<uint32_t>>
+                             *NewFileFeatures = nullptr);
 
 }  // namespace fuzzer
 
@@ -344,10 +344,20 @@ size_t MutationDispatcher::InsertPartOf(const uint8_t *From, size_t FromSize,
   assert(ToInsertPos + CopySize <= MaxToSize);
   size_t TailSize = ToSize - ToInsertPos;
   if (To == From) {
-    MutateInPlaceHere.resize(MaxToSize);
-    memcpy(MutateInPlaceHere.data(), From + FromBeg, CopySize);
+    // Open the gap first, then copy the source range from wherever the gap
+    // has moved it, so that no temporary buffer is needed.
     memmove(To + ToInsertPos + CopySize, To + ToInsertPos, TailSize);
-    memmove(To + ToInsertPos, MutateInPlaceHere.data(), CopySize);
+    if (FromBeg + CopySize <= ToInsertPos) {
+      memmove(To + ToInsertPos, To + FromBeg, CopySize);
+    } else if (FromBeg >= ToInsertPos) {
+      memmove(To + ToInsertPos, To + FromBeg + CopySize, CopySize);
+    } else {
+      // The source range straddles the insertion point.
+      size_t HeadSize = ToInsertPos - FromBeg;
+      memmove(To + ToInsertPos, To + FromBeg, HeadSize);
+      memmove(To + ToInsertPos + HeadSize, To + ToInsertPos + CopySize,
+              CopySize - HeadSize);
+    }
   } else {
     memmove(To + ToInsertPos + CopySize, To + ToInsertPos, TailSize);
     memmove(To + ToInsertPos, From + FromBeg, CopySize);
@@ -447,7 +457,7 @@ size_t MutationDispatcher::Mutate_CrossOver(uint8_t *Data, size_t Size,
   const Unit &O = *CrossOverWith;
   if (O.empty()) return 0;
   size_t NewSize = 0;
-  switch(Rand(3)) {
+  switch(Rand(6)) {
     case 0:
       MutateInPlaceHere.resize(MaxSize);
       NewSize = CrossOver(Data, Size, O.data(), O.size(),
@@ -462,6 +472,15 @@ size_t MutationDispatcher::Mutate_CrossOver(uint8_t *Data, size_t Size,
     case 2:
       NewSize = CopyPartOf(O.data(), O.size(), Data, Size);
       break;
+    case 3:
+      NewSize = SpliceCrossOver(O.data(), O.size(), Data, Size, MaxSize);
+      break;
+    case 4:
+      NewSize = TwoPointCrossOver(O.data(), O.size(), Data, Size, MaxSize);
+      break;
+    case 5:
+      NewSize = AlignedCrossOver(O.data(), O.size(), Data, Size);
+      break;
     default: assert(0);
   }
   assert(NewSize > 0 && "CrossOver returned empty unit");
@@ -561,6 +580,38 @@ size_t MutationDispatcher::MutateImpl(uint8_t *Data, size_t Size,
   return 1;   // Fallback, should not happen frequently.
 }
 
+static void AppendRun(std::vector<MutationMask::Run> *Runs, size_t Begin,
+                      size_t End) {
+  if (Begin < End)
+    Runs->push_back({static_cast<uint32_t>(Begin),
+                     static_cast<uint32_t>(End - Begin)});
+}
+
+MutationMask::MutationMask(const std::vector<uint8_t> &Mask) {
+  uint8_t MaxWeight = 0;
+  size_t Begin = 0;
+  for (size_t I = 0, N = Mask.size(); I <= N; I++) {
+    if (I < N && Mask[I]) {
+      MaxWeight = std::max(MaxWeight, Mask[I]);
+      NumMaskedBytes++;
+      continue;
+    }
+    AppendRun(&Runs, Begin, I);
+    Begin = I + 1;
+  }
+  if (MaxWeight <= 1 ||
+      std::all_of(Mask.begin(), Mask.end(),
+                  [&](uint8_t W) { return !W || W == MaxWeight; }))
+    return;
+  Begin = 0;
+  for (size_t I = 0, N = Mask.size(); I <= N; I++) {
+    if (I < N && Mask[I] == MaxWeight)
+      continue;
+    AppendRun(&HeavyRuns, Begin, I);
+    Begin = I + 1;
+  }
+}
+
 // Mask represents the set of Data bytes that are worth mutating.
 size_t MutationDispatcher::MutateWithMask(uint8_t *Data, size_t Size,
                                           size_t MaxSize,
@@ -569,7 +620,7 @@ size_t MutationDispatcher::MutateWithMask(uint8_t *Data, size_t Size,
   // * Copy the worthy bytes into a temporary array T
   // * Mutate T
   // * Copy T back.
-  // This is totally unoptimized.
+  // This is totally unoptimized, see the MutationMask overload.
   auto &T = MutateWithMaskTemp;
   if (T.size() < Size)
     T.resize(Size);
@@ -590,6 +641,163 @@ size_t MutationDispatcher::MutateWithMask(uint8_t *Data, size_t Size,
   return Size;
 }
 
+size_t MutationDispatcher::MutateWithMask(uint8_t *Data, size_t Size,
+                                          size_t /*MaxSize*/,
+                                          const MutationMask &Mask) {
+  const auto &Runs =
+      !Mask.HeavyRuns.empty() && Rand.RandBool() ? Mask.HeavyRuns : Mask.Runs;
+  // Same as above, but a memcpy per run. The runs are sorted, the ones
+  // beyond Size are ignored.
+  auto &T = MutateWithMaskTemp;
+  if (T.size() < Size)
+    T.resize(Size);
+  size_t OneBits = 0;
+  for (const auto &R : Runs) {
+    if (R.Begin >= Size)
+      break;
+    size_t N = std::min<size_t>(R.Size, Size - R.Begin);
+    memcpy(T.data() + OneBits, Data + R.Begin, N);
+    OneBits += N;
+  }
+
+  if (!OneBits) return 0;
+  size_t NewSize = Mutate(T.data(), OneBits, OneBits);
+  assert(NewSize <= OneBits);
+  (void)NewSize;
+  // Even if NewSize < OneBits we still use all OneBits bytes.
+  for (size_t I = 0, J = 0; J < OneBits; I++) {
+    size_t N = std::min<size_t>(Runs[I].Size, OneBits - J);
+    memcpy(Data + Runs[I].Begin, T.data() + J, N);
+    J += N;
+  }
+  return Size;
+}
+
+// Values tried by the deterministic stage, borrowed from AFL.
+static const int8_t kInteresting8[] = {-128, -1, 0, 1, 16, 32, 64, 100, 127};
+static const int16_t kInteresting16[] = {-32768, -129, 128,  255,  256,
+                                         512,    1000, 1024, 4096, 32767};
+static const int32_t kInteresting32[] = {
+    -2147483647 - 1, -100663046, -32769,    32768,
+    65535,           65536,      100663045, 2147483647};
+static const size_t kNumInteresting8 = sizeof(kInteresting8);
+static const size_t kNumInteresting16 =
+    sizeof(kInteresting16) / sizeof(kInteresting16[0]);
+static const size_t kNumInteresting32 =
+    sizeof(kInteresting32) / sizeof(kInteresting32[0]);
+// The arithmetic walk adds and subtracts 1..kDeterministicArithMax.
+static const size_t kDeterministicArithMax = 16;
+
+static const char *DeterministicWalkName(int Walk) {
+  switch (Walk) {
+    case DeterministicCursor::kBitFlip: return "DetBitFlip";
+    case DeterministicCursor::kByteFlip: return "DetByteFlip";
+    case DeterministicCursor::kArith: return "DetArith";
+    case DeterministicCursor::kInteresting: return "DetInteresting";
+    case DeterministicCursor::kDictionary: return "DetDict";
+  }
+  return "Det";
+}
+
+// Mutations that would not change the data are skipped.
+template <class T>
+static bool StoreInteresting(uint8_t *Data, size_t Size, size_t Pos, T Val,
+                             bool SwapBytes) {
+  if (Pos + sizeof(T) > Size) return false;
+  if (SwapBytes) {
+    // Byte swapping is pointless if it gives the same value.
+    if (Bswap(Val) == Val) return false;
+    Val = Bswap(Val);
+  }
+  if (!memcmp(Data + Pos, &Val, sizeof(Val))) return false;
+  memcpy(Data + Pos, &Val, sizeof(Val));
+  return true;
+}
+
+bool MutationDispatcher::ApplyDeterministicStep(uint8_t *Data, size_t Size,
+                                                int Walk, size_t Pos,
+                                                size_t Step) {
+  switch (Walk) {
+    case DeterministicCursor::kBitFlip:
+      Data[Pos / 8] ^= static_cast<uint8_t>(1 << (Pos % 8));
+      return true;
+    case DeterministicCursor::kByteFlip:
+      Data[Pos] ^= 0xFF;
+      return true;
+    case DeterministicCursor::kArith: {
+      uint8_t Delta = static_cast<uint8_t>(Step / 2 + 1);
+      Data[Pos] = (Step % 2) ? Data[Pos] - Delta : Data[Pos] + Delta;
+      return true;
+    }
+    case DeterministicCursor::kInteresting:
+      if (Step < kNumInteresting8) {
+        uint8_t Val = static_cast<uint8_t>(kInteresting8[Step]);
+        if (Data[Pos] == Val) return false;
+        Data[Pos] = Val;
+        return true;
+      }
+      Step -= kNumInteresting8;
+      if (Step < 2 * kNumInteresting16)
+        return StoreInteresting(Data, Size, Pos,
+                                static_cast<uint16_t>(kInteresting16[Step / 2]),
+                                Step % 2);
+      Step -= 2 * kNumInteresting16;
+      return StoreInteresting(Data, Size, Pos,
+                              static_cast<uint32_t>(kInteresting32[Step / 2]),
+                              Step % 2);
+    case DeterministicCursor::kDictionary: {
+      const Word &W = ManualDictionary[Step].GetW();
+      if (Pos + W.size() > Size || !memcmp(Data + Pos, W.data(), W.size()))
+        return false;
+      memcpy(Data + Pos, W.data(), W.size());
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t MutationDispatcher::MutateDeterministic(
+    uint8_t *Data, size_t Size, DeterministicCursor *C,
+    const std::vector<uint8_t> &EffectorMap) {
+  while (!C->Done()) {
+    size_t NumSteps = 1;
+    if (C->Walk == DeterministicCursor::kArith)
+      NumSteps = 2 * kDeterministicArithMax;
+    else if (C->Walk == DeterministicCursor::kInteresting)
+      NumSteps = kNumInteresting8 + 2 * (kNumInteresting16 + kNumInteresting32);
+    else if (C->Walk == DeterministicCursor::kDictionary)
+      NumSteps = ManualDictionary.size();
+    size_t NumPositions =
+        C->Walk == DeterministicCursor::kBitFlip ? Size * 8 : Size;
+    if (C->Pos >= NumPositions || !NumSteps) {
+      C->Walk++;
+      C->Pos = C->Step = 0;
+      continue;
+    }
+    size_t Pos = C->Pos;
+    size_t Step = C->Step;
+    if (++C->Step == NumSteps) {
+      C->Step = 0;
+      C->Pos++;
+    }
+    // Bytes that did not change the coverage when flipped are not worth
+    // the rest of the deterministic stage.
+    if (C->Walk > DeterministicCursor::kByteFlip && Pos < EffectorMap.size() &&
+        !EffectorMap[Pos]) {
+      C->Step = 0;
+      C->Pos = Pos + 1;
+      continue;
+    }
+    if (!ApplyDeterministicStep(Data, Size, C->Walk, Pos, Step))
+      continue;
+    C->LastWalk = C->Walk;
+    C->LastPos = C->Walk == DeterministicCursor::kBitFlip ? Pos / 8 : Pos;
+    CurrentMutatorSequence.push_back({nullptr, DeterministicWalkName(C->Walk)});
+    return Size;
+  }
+  return 0;
+}
+
 void MutationDispatcher::AddWordToManualDictionary(const Word &W) {
   ManualDictionary.push_back(
       {W, std::numeric_limits<size_t>::max()});
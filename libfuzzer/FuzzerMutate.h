@@ -18,6 +18,46 @@
 
 namespace fuzzer {
 
+// Position of a single input in the deterministic mutation stage.
+// The stage consists of several walks over the input; Pos is the bit (for
+// kBitFlip) or byte offset inside the current walk and Step enumerates the
+// variants tried at that offset.
+struct DeterministicCursor {
+  enum WalkKind { kBitFlip, kByteFlip, kArith, kInteresting, kDictionary,
+                  kDone };
+  int Walk = kBitFlip;
+  size_t Pos = 0;
+  size_t Step = 0;
+  // The walk and the byte offset of the last applied mutation.
+  int LastWalk = kBitFlip;
+  size_t LastPos = 0;
+  bool Done() const { return Walk == kDone; }
+};
+
+// A byte mask for MutateWithMask, precomputed once per input. The bytes with
+// a non-zero weight in the source mask are kept as runs of consecutive
+// offsets, so gathering and scattering them costs a memcpy per run instead
+// of a walk over the whole mask. If the weights differ, the bytes with the
+// largest weight get a second set of runs.
+class MutationMask {
+public:
+  MutationMask() {}
+  explicit MutationMask(const std::vector<uint8_t> &Mask);
+  bool empty() const { return Runs.empty(); }
+  size_t NumBytes() const { return NumMaskedBytes; }
+
+  struct Run {
+    uint32_t Begin;
+    uint32_t Size;
+  };
+
+private:
+  friend class MutationDispatcher;
+  std::vector<Run> Runs;
+  std::vector<Run> HeavyRuns;
+  size_t NumMaskedBytes = 0;
+};
+
 class MutationDispatcher {
 public:
   MutationDispatcher(Random &Rand, const FuzzingOptions &Options);
@@ -79,6 +119,19 @@ public:
   size_t MutateWithMask(uint8_t *Data, size_t Size, size_t MaxSize,
                         const std::vector<uint8_t> &Mask);
 
+  /// Same as above, with the mask precomputed. Half of the time only the
+  /// bytes with the largest weight are mutated.
+  size_t MutateWithMask(uint8_t *Data, size_t Size, size_t MaxSize,
+                        const MutationMask &Mask);
+
+  /// Applies the next mutation of the deterministic stage described by C
+  /// and advances C. The walks after the byte flip walk skip the bytes that
+  /// have '0' in EffectorMap (an empty map means all bytes are effective).
+  /// Returns Size, or 0 once the stage is exhausted.
+  size_t MutateDeterministic(uint8_t *Data, size_t Size,
+                             DeterministicCursor *C,
+                             const std::vector<uint8_t> &EffectorMap);
+
   /// Applies one of the default mutations. Provided as a service
   /// to mutation authors.
   size_t DefaultMutate(uint8_t *Data, size_t Size, size_t MaxSize);
@@ -87,6 +140,20 @@ public:
   size_t CrossOver(const uint8_t *Data1, size_t Size1, const uint8_t *Data2,
                    size_t Size2, uint8_t *Out, size_t MaxOutSize);
 
+  /// Block-oriented cross-overs of From into To, done in place in To
+  /// (From must not alias To). Return the new size of To or 0 on failure.
+  ///
+  /// Keeps a prefix of To and appends a suffix of From.
+  size_t SpliceCrossOver(const uint8_t *From, size_t FromSize, uint8_t *To,
+                         size_t ToSize, size_t MaxToSize);
+  /// Replaces a range of To with a range of From.
+  size_t TwoPointCrossOver(const uint8_t *From, size_t FromSize, uint8_t *To,
+                           size_t ToSize, size_t MaxToSize);
+  /// Copies a run of power-of-two aligned blocks of From into the same
+  /// offset of To, preserving the layout of fixed-size records.
+  size_t AlignedCrossOver(const uint8_t *From, size_t FromSize, uint8_t *To,
+                          size_t ToSize);
+
   void AddWordToManualDictionary(const Word &W);
 
   void PrintRecommendedDictionary();
@@ -112,6 +179,8 @@ public:
                     size_t ToSize);
   size_t ApplyDictionaryEntry(uint8_t *Data, size_t Size, size_t MaxSize,
                               DictionaryEntry &DE);
+  bool ApplyDeterministicStep(uint8_t *Data, size_t Size, int Walk, size_t Pos,
+                              size_t Step);
 
   template <class T>
   DictionaryEntry MakeDictionaryEntryFromCMP(T Arg1, T Arg2,
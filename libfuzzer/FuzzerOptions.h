@@ -18,7 +18,9 @@ struct FuzzingOptions {
   int Verbosity = 1;
   size_t MaxLen = 0;
   size_t LenControl = 1000;
+  bool AdaptiveLenControl = false;
   bool KeepSeed = false;
+  int SeedPrefetchThreads = 4;
   int UnitTimeoutSec = 300;
   int TimeoutExitCode = 70;
   int OOMExitCode = 71;
@@ -34,6 +36,7 @@ struct FuzzingOptions {
   bool CrossOverUniformDist = false;
   int MutateDepth = 5;
   bool ReduceDepth = false;
+  int DeterministicStage = 0;
   bool UseCounters = false;
   bool UseMemmem = true;
   bool UseCmp = false;
@@ -41,6 +44,10 @@ struct FuzzingOptions {
   bool Shrink = false;
   bool ReduceInputs = false;
   int ReloadIntervalSec = 1;
+  bool ReloadWatch = true;
+  bool AsyncWrites = true;
+  bool AsyncWritesFsync = false;
+  std::string SyncSocket;
   bool ShuffleAtStartUp = true;
   bool PreferSmall = true;
   size_t MaxNumberOfRuns = -1L;
@@ -48,6 +55,12 @@ struct FuzzingOptions {
   bool OnlyASCII = false;
   bool Entropic = true;
   bool ForkCorpusGroups = false;
+  int ForkMergeThreads = 0;
+  int ForkDftThreads = 1;
+  bool ForkAdaptiveJobs = false;
+  bool ForkCoverageAwareSeeds = false;
+  bool BinaryMergeControlFile = true;
+  bool MergeFeatureCache = false;
   size_t EntropicFeatureFrequencyThreshold = 0xFF;
   size_t EntropicNumberOfRarestFeatures = 100;
   bool EntropicScalePerExecTime = false;
@@ -60,6 +73,7 @@ struct FuzzingOptions {
   std::string DataFlowTrace;
   std::string CollectDataFlow;
   std::string FeaturesDir;
+  std::string FeaturesLog;
   std::string MutationGraphFile;
   std::string StopFile;
   bool SaveArtifacts = true;
@@ -67,6 +81,8 @@ struct FuzzingOptions {
   bool PrintNewCovPcs = false;
   int PrintNewCovFuncs = 0;
   bool PrintFinalStats = false;
+  bool CompressCorpus = false;
+  int CompressCorpusHotUnits = 1024;
   bool PrintCorpusStats = false;
   bool PrintCoverage = false;
   bool PrintFullCoverage = false;
@@ -0,0 +1,380 @@
+//===- FuzzerPack.cpp - packed corpora ------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// Packed corpora, see FuzzerPack.h.
+//===----------------------------------------------------------------------===//
+// cjc: 打包语料库, 单个文件保存整个语料库
+
+#include "FuzzerPack.h"
+#include "FuzzerIO.h"
+#include "FuzzerSHA1.h"
+#include "FuzzerUtil.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace fuzzer {
+
+size_t PackedCorpusHeaderSize(const uint8_t *Data, size_t Size) {
+  if (!Data || Size < kPackedCorpusMagicSize ||
+      memcmp(Data, kPackedCorpusMagic, kPackedCorpusMagicSize))
+    return 0;
+  const uint8_t *P = Data + kPackedCorpusMagicSize;
+  uint64_t Version;
+  if (!ReadVarint(&P, Data + Size, &Version) ||
+      Version != kPackedCorpusVersion)
+    return 0;
+  return static_cast<size_t>(P - Data);
+}
+
+bool ParsePackedUnitRecord(const uint8_t *Data, size_t Size, size_t Offset,
+                           PackedUnitRecord *R) {
+  if (Offset >= Size)
+    return false;
+  const uint8_t *P = Data + Offset, *End = Data + Size;
+  R->Offset = Offset;
+  R->Codec = *P++;
+  uint64_t StoredSize, UnitSize;
+  if (!ReadVarint(&P, End, &StoredSize) || !ReadVarint(&P, End, &UnitSize))
+    return false;
+  if (End - P < kSHA1NumBytes)
+    return false;
+  R->Sha1 = P;
+  P += kSHA1NumBytes;
+  if (static_cast<uint64_t>(End - P) < StoredSize)
+    return false;
+  R->Stored = P;
+  R->StoredSize = StoredSize;
+  R->UnitSize = UnitSize;
+  R->End = static_cast<size_t>(P + StoredSize - Data);
+  return true;
+}
+
+bool DecodePackedUnit(const PackedUnitRecord &R, Unit *U) {
+  if (R.Codec != kPackedUnitRaw || R.StoredSize != R.UnitSize)
+    return false;
+  U->assign(R.Stored, R.Stored + R.StoredSize);
+  uint8_t Sha1[kSHA1NumBytes];
+  ComputeSHA1(U->data(), U->size(), Sha1);
+  return !memcmp(Sha1, R.Sha1, kSHA1NumBytes);
+}
+
+void AppendPackedCorpusHeader(Unit *Out) {
+  Out->insert(Out->end(), kPackedCorpusMagic,
+              kPackedCorpusMagic + kPackedCorpusMagicSize);
+  AppendVarint(kPackedCorpusVersion, Out);
+}
+
+static void AppendPackedUnitRecord(const Unit &U,
+                                   const uint8_t Sha1[kSHA1NumBytes],
+                                   Unit *Out) {
+  Out->push_back(kPackedUnitRaw);
+  AppendVarint(U.size(), Out);
+  AppendVarint(U.size(), Out);
+  Out->insert(Out->end(), Sha1, Sha1 + kSHA1NumBytes);
+  Out->insert(Out->end(), U.begin(), U.end());
+}
+
+void AppendPackedUnitRecord(const Unit &U, Unit *Out) {
+  uint8_t Sha1[kSHA1NumBytes];
+  ComputeSHA1(U.data(), U.size(), Sha1);
+  AppendPackedUnitRecord(U, Sha1, Out);
+}
+
+std::string PackedUnitPath(const std::string &Pack, size_t Offset) {
+  return Pack + "#" + std::to_string(Offset);
+}
+
+bool ParsePackedUnitPath(const std::string &Path, std::string *Pack,
+                         size_t *Offset) {
+  size_t Pos = Path.rfind('#');
+  if (Pos == std::string::npos || Pos == 0 || Pos + 1 == Path.size())
+    return false;
+  size_t Res = 0;
+  for (size_t i = Pos + 1; i < Path.size(); i++) {
+    if (Path[i] < '0' || Path[i] > '9')
+      return false;
+    Res = Res * 10 + static_cast<size_t>(Path[i] - '0');
+  }
+  *Pack = Path.substr(0, Pos);
+  *Offset = Res;
+  return true;
+}
+
+namespace {
+
+// A mapped pack. Every access goes through PacksMutex: the mapping is
+// replaced when the pack grows.
+struct MappedPack {
+  const uint8_t *Data = nullptr;
+  size_t Size = 0;
+  size_t HeaderSize = 0;
+  // Raw SHA1 -> record offset, for the records before IndexedSize.
+  // Only built for the packs we append to.
+  std::unordered_map<std::string, size_t> Offsets;
+  size_t IndexedSize = 0;
+};
+
+std::mutex PacksMutex;
+std::unordered_map<std::string, MappedPack> Packs;
+
+}  // namespace
+
+// FileSize falls back to PackedUnitSize, which takes PacksMutex.
+static size_t SizeOfPackFile(const std::string &Path) {
+  struct stat St;
+  if (stat(Path.c_str(), &St))
+    return 0;
+  return static_cast<size_t>(St.st_size);
+}
+
+// Returns nullptr if Path is not a packed corpus. With Refresh, maps the pack
+// again if its size has changed since it was mapped.
+static MappedPack *GetPack(const std::string &Path, bool Refresh) {
+  auto It = Packs.find(Path);
+  if (It != Packs.end() &&
+      (!Refresh || SizeOfPackFile(Path) == It->second.Size))
+    return &It->second;
+  size_t Size = 0;
+  const uint8_t *Data = MapFile(Path, &Size);
+  size_t HeaderSize = PackedCorpusHeaderSize(Data, Size);
+  if (!HeaderSize) {
+    UnmapFile(Data, Size);
+    return It != Packs.end() ? &It->second : nullptr;
+  }
+  auto &P = Packs[Path];
+  UnmapFile(P.Data, P.Size);
+  P.Data = Data;
+  P.Size = Size;
+  P.HeaderSize = HeaderSize;
+  return &P;
+}
+
+// Parses the record at Offset, maps the pack again if the record is not
+// (completely) in the current mapping.
+static bool GetRecord(const std::string &Path, size_t Offset,
+                      PackedUnitRecord *R) {
+  MappedPack *P = GetPack(Path, /*Refresh=*/false);
+  if (!P || Offset < P->HeaderSize)
+    return false;
+  if (ParsePackedUnitRecord(P->Data, P->Size, Offset, R))
+    return true;
+  P = GetPack(Path, /*Refresh=*/true);
+  return ParsePackedUnitRecord(P->Data, P->Size, Offset, R);
+}
+
+static void IndexPack(MappedPack *P) {
+  PackedUnitRecord R;
+  size_t Offset = std::max(P->IndexedSize, P->HeaderSize);
+  for (; ParsePackedUnitRecord(P->Data, P->Size, Offset, &R); Offset = R.End)
+    P->Offsets.emplace(
+        std::string(reinterpret_cast<const char *>(R.Sha1), kSHA1NumBytes),
+        Offset);
+  P->IndexedSize = Offset;
+}
+
+bool IsPackedCorpus(const std::string &Path) {
+  {
+    std::lock_guard<std::mutex> Lock(PacksMutex);
+    if (Packs.count(Path))
+      return true;
+  }
+  FILE *In = fopen(Path.c_str(), "rb");
+  if (!In)
+    return false;
+  uint8_t Header[kPackedCorpusMagicSize + 10];
+  size_t Size = fread(Header, 1, sizeof(Header), In);
+  fclose(In);
+  return PackedCorpusHeaderSize(Header, Size) != 0;
+}
+
+void ListPackedCorpus(const std::string &Pack, std::vector<SizedFile> *V) {
+  std::lock_guard<std::mutex> Lock(PacksMutex);
+  MappedPack *P = GetPack(Pack, /*Refresh=*/true);
+  if (!P)
+    return;
+  PackedUnitRecord R;
+  for (size_t Offset = P->HeaderSize;
+       ParsePackedUnitRecord(P->Data, P->Size, Offset, &R); Offset = R.End)
+    if (R.UnitSize)
+      V->push_back({PackedUnitPath(Pack, Offset), R.UnitSize});
+}
+
+void ReadPackedCorpus(const std::string &Pack, size_t *Offset, size_t MaxSize,
+                      std::vector<Unit> *V, std::vector<std::string> *VPaths) {
+  std::lock_guard<std::mutex> Lock(PacksMutex);
+  MappedPack *P = GetPack(Pack, /*Refresh=*/true);
+  if (!P)
+    return;
+  PackedUnitRecord R;
+  size_t Pos = std::max(*Offset, P->HeaderSize);
+  for (; ParsePackedUnitRecord(P->Data, P->Size, Pos, &R); Pos = R.End) {
+    Unit U;
+    if (!DecodePackedUnit(R, &U)) {
+      Printf("WARNING: damaged unit %s\n", PackedUnitPath(Pack, Pos).c_str());
+      continue;
+    }
+    if (U.empty())
+      continue;
+    if (MaxSize && U.size() > MaxSize)
+      U.resize(MaxSize);
+    V->push_back(std::move(U));
+    if (VPaths)
+      VPaths->push_back(PackedUnitPath(Pack, Pos));
+  }
+  *Offset = Pos;
+}
+
+bool ReadPackedUnit(const std::string &Path, size_t MaxSize, Unit *U) {
+  std::string Pack;
+  size_t Offset;
+  if (!ParsePackedUnitPath(Path, &Pack, &Offset))
+    return false;
+  std::lock_guard<std::mutex> Lock(PacksMutex);
+  if (!GetPack(Pack, /*Refresh=*/false))
+    return false;
+  PackedUnitRecord R;
+  U->clear();
+  if (!GetRecord(Pack, Offset, &R) || !DecodePackedUnit(R, U)) {
+    Printf("WARNING: damaged unit %s\n", Path.c_str());
+    U->clear();
+    return true;
+  }
+  if (MaxSize && U->size() > MaxSize)
+    U->resize(MaxSize);
+  return true;
+}
+
+size_t PackedUnitSize(const std::string &Path) {
+  std::string Pack;
+  size_t Offset;
+  if (!ParsePackedUnitPath(Path, &Pack, &Offset))
+    return 0;
+  std::lock_guard<std::mutex> Lock(PacksMutex);
+  PackedUnitRecord R;
+  return GetRecord(Pack, Offset, &R) ? R.UnitSize : 0;
+}
+
+std::vector<std::string> AppendToPackedCorpus(const std::vector<Unit> &Units,
+                                              const std::string &Pack) {
+  std::lock_guard<std::mutex> Lock(PacksMutex);
+  std::vector<std::string> Paths(Units.size());
+  MappedPack *P = GetPack(Pack, /*Refresh=*/true);
+  Unit Records;
+  if (P) {
+    IndexPack(P);
+  } else if (SizeOfPackFile(Pack)) {
+    // Not exit(): this runs on the AsyncWriter thread, and the atexit Flush
+    // would wait for it forever.
+    Printf("ERROR: %s is not a packed corpus\n", Pack.c_str());
+    return Paths;
+  } else {
+    AppendPackedCorpusHeader(&Records);
+  }
+  // Offsets in Records of the units that will be appended; the units that
+  // are already in the pack get their paths right away.
+  std::unordered_map<std::string, size_t> New;
+  std::vector<std::pair<size_t, size_t>> UnitToRecord;
+  for (size_t i = 0; i < Units.size(); i++) {
+    uint8_t Sha1[kSHA1NumBytes];
+    ComputeSHA1(Units[i].data(), Units[i].size(), Sha1);
+    std::string Key(reinterpret_cast<char *>(Sha1), kSHA1NumBytes);
+    if (P) {
+      auto It = P->Offsets.find(Key);
+      if (It != P->Offsets.end()) {
+        Paths[i] = PackedUnitPath(Pack, It->second);
+        continue;
+      }
+    }
+    auto It = New.find(Key);
+    if (It == New.end()) {
+      It = New.emplace(Key, Records.size()).first;
+      AppendPackedUnitRecord(Units[i], Sha1, &Records);
+    }
+    UnitToRecord.push_back({i, It->second});
+  }
+  if (Records.empty())
+    return Paths;
+  // A single write in append mode: the records of concurrent writers don't
+  // interleave, and the end of the file tells where ours start.
+  FILE *Out = fopen(Pack.c_str(), "ab");
+  if (!Out)
+    return Paths;
+  bool Ok = fwrite(Records.data(), 1, Records.size(), Out) == Records.size() &&
+            !fflush(Out);
+  long End = ftell(Out);
+  fclose(Out);
+  if (!Ok || End < static_cast<long>(Records.size()))
+    return Paths;
+  size_t Base = static_cast<size_t>(End) - Records.size();
+  for (auto &UR : UnitToRecord)
+    Paths[UR.first] = PackedUnitPath(Pack, Base + UR.second);
+  return Paths;
+}
+
+std::string AppendToPackedCorpus(const Unit &U, const std::string &Pack) {
+  return AppendToPackedCorpus(std::vector<Unit>{U}, Pack)[0];
+}
+
+int PackCorpus(const std::string &Pack,
+               const std::vector<std::string> &Corpora) {
+  const size_t kBatchBytes = 1 << 24;
+  if (SizeOfPackFile(Pack) && !IsPackedCorpus(Pack)) {
+    Printf("ERROR: %s is not a packed corpus\n", Pack.c_str());
+    return 1;
+  }
+  std::vector<SizedFile> Files;
+  for (auto &Corpus : Corpora)
+    if (Corpus != Pack)
+      GetSizedFilesFromDir(Corpus, &Files);
+  Printf("INFO: packing %zd files into %s\n", Files.size(), Pack.c_str());
+  std::vector<Unit> Batch;
+  size_t BatchBytes = 0;
+  for (size_t i = 0; i < Files.size(); i++) {
+    Batch.push_back(FileToVector(Files[i].File, 0, /*ExitOnError=*/false));
+    BatchBytes += Batch.back().size();
+    if (BatchBytes < kBatchBytes && i + 1 < Files.size())
+      continue;
+    AppendToPackedCorpus(Batch, Pack);
+    Batch.clear();
+    BatchBytes = 0;
+  }
+  // Creates an empty pack if there was nothing to pack.
+  AppendToPackedCorpus(Batch, Pack);
+  std::vector<SizedFile> Packed;
+  ListPackedCorpus(Pack, &Packed);
+  Printf("INFO: %s has %zd units, %zd bytes\n", Pack.c_str(), Packed.size(),
+         FileSize(Pack));
+  return 0;
+}
+
+int UnpackCorpus(const std::string &Dir,
+                 const std::vector<std::string> &Corpora) {
+  if (!IsDirectory(Dir) && !MkDirRecursive(Dir)) {
+    Printf("ERROR: Failed to create directory \"%s\"\n", Dir.c_str());
+    return 1;
+  }
+  std::vector<SizedFile> Files;
+  for (auto &Corpus : Corpora)
+    GetSizedFilesFromDir(Corpus, &Files);
+  size_t NumWritten = 0;
+  for (auto &F : Files) {
+    Unit U = FileToVector(F.File, 0, /*ExitOnError=*/false);
+    if (U.empty())
+      continue;
+    WriteToFile(U, DirPlusFile(Dir, Hash(U)));
+    NumWritten++;
+  }
+  Printf("INFO: wrote %zd files into %s\n", NumWritten, Dir.c_str());
+  return 0;
+}
+
+}  // namespace fuzzer
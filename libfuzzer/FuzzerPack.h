@@ -0,0 +1,104 @@
+//===- FuzzerPack.h - Internal header for the Fuzzer ------------*- C++ -* ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// Packed corpora.
+//
+// A packed corpus is a single append-only file that holds the units of a
+// corpus dir. It is accepted wherever a corpus dir is: the fuzzing loop,
+// -merge=1, -fork=N, -analyze_dict=1. Startup then maps one file instead of
+// opening every unit, and -reload=1 only reads the records appended since the
+// last reload.
+//
+// The file starts with the magic "\x7fLFP" and a varint version, followed by
+// the records:
+//   codec byte, varint stored size, varint unit size, SHA1 of the unit,
+//   stored bytes.
+// The record headers are the index: the pack is listed by skipping from one
+// header to the next without touching the data. The SHA1 is checked when a
+// unit is read. A truncated last record (a killed writer) is ignored.
+//
+// A unit of a pack is referred to as <pack path>#<record offset>, the other
+// IO functions (FileToVector, FileSize, GetSizedFilesFromDir,
+// ReadDirToVectorOfUnits) understand such paths.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_PACK_H
+#define LLVM_FUZZER_PACK_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerIO.h"
+#include "FuzzerSHA1.h"
+
+namespace fuzzer {
+
+const char kPackedCorpusMagic[] = "\x7fLFP";
+const size_t kPackedCorpusMagicSize = 4;
+const uint64_t kPackedCorpusVersion = 1;
+// Only raw records are written for now, the codec byte keeps the format open
+// for compressed ones.
+enum PackedUnitCodec : uint8_t {
+  kPackedUnitRaw = 0,
+};
+
+struct PackedUnitRecord {
+  size_t Offset = 0;  // Of the record in the pack.
+  size_t End = 0;     // Offset of the next record.
+  uint8_t Codec = kPackedUnitRaw;
+  size_t UnitSize = 0;
+  const uint8_t *Sha1 = nullptr;
+  const uint8_t *Stored = nullptr;
+  size_t StoredSize = 0;
+};
+
+// Returns the size of the pack header, 0 if Data is not a packed corpus.
+size_t PackedCorpusHeaderSize(const uint8_t *Data, size_t Size);
+// Parses the record at Offset. Returns false if it is truncated or malformed.
+bool ParsePackedUnitRecord(const uint8_t *Data, size_t Size, size_t Offset,
+                           PackedUnitRecord *R);
+// Decodes the unit of R and checks its SHA1.
+bool DecodePackedUnit(const PackedUnitRecord &R, Unit *U);
+void AppendPackedCorpusHeader(Unit *Out);
+void AppendPackedUnitRecord(const Unit &U, Unit *Out);
+
+bool IsPackedCorpus(const std::string &Path);
+std::string PackedUnitPath(const std::string &Pack, size_t Offset);
+// Splits <pack>#<offset>. Does not check that Pack is a packed corpus.
+bool ParsePackedUnitPath(const std::string &Path, std::string *Pack,
+                         size_t *Offset);
+
+// Adds {<pack>#<offset>, size} of every non-empty unit of Pack to V.
+void ListPackedCorpus(const std::string &Pack, std::vector<SizedFile> *V);
+// Reads the units of the records at or after *Offset (all of them if 0) and
+// sets *Offset to the end of the last one.
+void ReadPackedCorpus(const std::string &Pack, size_t *Offset, size_t MaxSize,
+                      std::vector<Unit> *V,
+                      std::vector<std::string> *VPaths = nullptr);
+// Returns false if Path is not a unit of a packed corpus. Otherwise reads it
+// into U (leaves U empty if the record is damaged) and returns true.
+bool ReadPackedUnit(const std::string &Path, size_t MaxSize, Unit *U);
+// Returns 0 if Path is not a unit of a packed corpus.
+size_t PackedUnitSize(const std::string &Path);
+
+// Appends the units to Pack, creating it if needed, and returns their paths.
+// Units that are already in the pack are not appended again, their existing
+// path is returned. Every call is a single append, so that processes sharing
+// an output corpus (-jobs=N) don't interleave their records. The paths are
+// empty if the units could not be appended (e.g. Pack is not a pack).
+std::vector<std::string> AppendToPackedCorpus(const std::vector<Unit> &Units,
+                                              const std::string &Pack);
+std::string AppendToPackedCorpus(const Unit &U, const std::string &Pack);
+
+// -pack_corpus and -unpack_corpus: copy the units of Corpora (dirs or packs)
+// into the pack, or into the dir one file per unit.
+int PackCorpus(const std::string &Pack,
+               const std::vector<std::string> &Corpora);
+int UnpackCorpus(const std::string &Dir,
+                 const std::vector<std::string> &Corpora);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_PACK_H
@@ -0,0 +1,123 @@
+//===- FuzzerPrefetch.h - Internal header for the Fuzzer --------*- C++ -* ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::FilePrefetcher
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_PREFETCH_H
+#define LLVM_FUZZER_PREFETCH_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace fuzzer {
+
+// Reads the files of a corpus ahead of their use on a few threads, so that
+// executing the seed corpus (-seed_prefetch_threads) does not wait for the
+// file system. The files are handed out in order. At most MaxFilesAhead files
+// and about MaxBytesAhead bytes are read but not taken yet.
+class FilePrefetcher {
+ public:
+  FilePrefetcher(const std::vector<SizedFile> &Files, size_t MaxSize,
+                 size_t NumThreads, size_t MaxBytesAhead = 64 << 20,
+                 size_t MaxFilesAhead = 1024)
+      : Files(Files), MaxSize(MaxSize), MaxBytesAhead(MaxBytesAhead),
+        Slots(std::max<size_t>(1, std::min(MaxFilesAhead, Files.size()))) {
+    for (size_t i = 0; i < NumThreads && i < Files.size(); i++)
+      Threads.emplace_back([this] { ReadFiles(); });
+  }
+
+  ~FilePrefetcher() {
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Stopped = true;
+    }
+    CanRead.notify_all();
+    for (auto &T : Threads)
+      T.join();
+  }
+
+  // Returns the contents of Files[Idx]. Must be called for Idx = 0, 1, ...
+  Unit Take(size_t Idx) {
+    assert(Idx == Taken && Idx < Files.size());
+    if (Threads.empty()) {
+      Taken++;
+      return FileToVector(Files[Idx].File, MaxSize, /*ExitOnError=*/false);
+    }
+    std::unique_lock<std::mutex> Lock(Mu);
+    auto &S = Slots[Idx % Slots.size()];
+    if (!S.Ready)
+      Stalls++;
+    IsReady.wait(Lock, [&] { return S.Ready; });
+    Unit U = std::move(S.U);
+    S.Ready = false;
+    BytesAhead -= Files[Idx].Size;
+    Taken++;
+    Lock.unlock();
+    // One more file may be read now.
+    CanRead.notify_one();
+    return U;
+  }
+
+  // How many times Take had to wait for a reader.
+  size_t NumStalls() const { return Stalls; }
+
+ private:
+  struct Slot {
+    Unit U;
+    bool Ready = false;
+  };
+
+  bool MayReadNext() const {
+    if (Next >= Files.size() || Next - Taken >= Slots.size())
+      return false;
+    // The next file to take is always read, however large it is.
+    return Next == Taken || BytesAhead + Files[Next].Size <= MaxBytesAhead;
+  }
+
+  void ReadFiles() {
+    IsInternalThread = true;
+    std::unique_lock<std::mutex> Lock(Mu);
+    while (true) {
+      CanRead.wait(Lock, [&] { return Stopped || MayReadNext(); });
+      if (Stopped)
+        return;
+      size_t Idx = Next++;
+      BytesAhead += Files[Idx].Size;
+      Lock.unlock();
+      Unit U = FileToVector(Files[Idx].File, MaxSize, /*ExitOnError=*/false);
+      Lock.lock();
+      auto &S = Slots[Idx % Slots.size()];
+      S.U = std::move(U);
+      S.Ready = true;
+      IsReady.notify_one();
+    }
+  }
+
+  const std::vector<SizedFile> &Files;
+  const size_t MaxSize;
+  const size_t MaxBytesAhead;
+  std::vector<Slot> Slots;
+  std::vector<std::thread> Threads;
+  std::mutex Mu;
+  std::condition_variable CanRead, IsReady;
+  size_t Next = 0;   // The next file to read.
+  size_t Taken = 0;  // The next file to take.
+  size_t BytesAhead = 0;
+  size_t Stalls = 0;
+  bool Stopped = false;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_PREFETCH_H
@@ -0,0 +1,314 @@
+//===- FuzzerSync.cpp - corpus exchange with a local peer -----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// Corpus exchange with a local peer, see FuzzerSync.h.
+//===----------------------------------------------------------------------===//
+// cjc: 通过本地套接字与调度客户端交换种子
+
+#include "FuzzerSync.h"
+#include "FuzzerCoverageDelta.h"
+#include "FuzzerIO.h"
+#include "FuzzerPlatform.h"
+#include "FuzzerUtil.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if LIBFUZZER_POSIX
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace fuzzer {
+
+void AppendSyncFrame(uint8_t Type, const Unit &Payload, Unit *Out) {
+  uint32_t Size = static_cast<uint32_t>(Payload.size());
+  for (size_t i = 0; i < 4; i++)
+    Out->push_back(static_cast<uint8_t>(Size >> (8 * i)));
+  Out->push_back(Type);
+  Out->insert(Out->end(), Payload.begin(), Payload.end());
+}
+
+size_t ParseSyncFrame(const uint8_t *Data, size_t Size, uint8_t *Type,
+                      const uint8_t **Payload, size_t *PayloadSize) {
+  const size_t kHeaderSize = 5;
+  if (Size < kHeaderSize)
+    return 0;
+  size_t N = 0;
+  for (size_t i = 0; i < 4; i++)
+    N |= static_cast<size_t>(Data[i]) << (8 * i);
+  *PayloadSize = N;
+  if (Size - kHeaderSize < N)
+    return 0;
+  *Type = Data[4];
+  *Payload = Data + kHeaderSize;
+  return kHeaderSize + N;
+}
+
+void AppendSyncSeed(const uint8_t *Data, size_t Size,
+                    const std::vector<uint32_t> &Features, Unit *Out) {
+  AppendVarint(Features.size(), Out);
+  uint32_t Prev = 0;
+  for (auto F : Features) {
+    AppendVarint(F - Prev, Out);
+    Prev = F;
+  }
+  Out->insert(Out->end(), Data, Data + Size);
+}
+
+bool ParseSyncSeed(const uint8_t *Data, size_t Size, SyncSeed *S) {
+  const uint8_t *P = Data, *End = Data + Size;
+  uint64_t NumFeatures, Delta, F = 0;
+  if (!ReadVarint(&P, End, &NumFeatures) ||
+      NumFeatures > static_cast<uint64_t>(End - P))
+    return false;
+  S->Features.clear();
+  for (uint64_t i = 0; i < NumFeatures; i++) {
+    if (!ReadVarint(&P, End, &Delta))
+      return false;
+    F += Delta;
+    if (F > UINT32_MAX)
+      return false;
+    S->Features.push_back(static_cast<uint32_t>(F));
+  }
+  S->U.assign(P, End);
+  return true;
+}
+
+#if LIBFUZZER_POSIX
+
+static int ConnectToPeer(const std::string &Path) {
+  sockaddr_un Addr = {};
+  Addr.sun_family = AF_UNIX;
+  if (Path.size() >= sizeof(Addr.sun_path))
+    return -1;
+  memcpy(Addr.sun_path, Path.c_str(), Path.size() + 1);
+  int Fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Fd < 0)
+    return -1;
+  // The targets that fork must not keep the connection open.
+  fcntl(Fd, F_SETFD, FD_CLOEXEC);
+  if (connect(Fd, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr))) {
+    close(Fd);
+    return -1;
+  }
+  return Fd;
+}
+
+static bool WriteAll(int Fd, const uint8_t *Data, size_t Size) {
+  int Flags = 0;
+#ifdef MSG_NOSIGNAL
+  Flags = MSG_NOSIGNAL;  // A closed peer is an error, not a SIGPIPE.
+#endif
+  while (Size) {
+    ssize_t N = send(Fd, Data, Size, Flags);
+    if (N <= 0)
+      return false;
+    Data += N;
+    Size -= static_cast<size_t>(N);
+  }
+  return true;
+}
+
+void SyncAgent::Start(const std::string &Path, size_t MaxQueuedBytes) {
+  this->Path = Path;
+  this->MaxQueuedBytes = MaxQueuedBytes;
+  // Never stopped, like the writer of AsyncWriter.
+  std::thread([this] { ReaderThread(); }).detach();
+  std::thread([this] { WriterThread(); }).detach();
+}
+
+void SyncAgent::Disconnect(int OldFd) {
+  std::unique_lock<std::mutex> Lock(Mu);
+  Fd = -1;
+  // The writer may still be sending on OldFd, make it fail.
+  shutdown(OldFd, SHUT_RDWR);
+  WriteDone.wait(Lock, [&] { return !Writing; });
+  close(OldFd);
+}
+
+void SyncAgent::ReaderThread() {
+  IsInternalThread = true;
+  const size_t kReadSize = 1 << 16;
+  Unit Buf;
+  while (true) {
+    int NewFd = ConnectToPeer(Path);
+    if (NewFd < 0) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      continue;
+    }
+    if (!Connections++)
+      Printf("INFO: -sync_socket: connected to %s\n", Path.c_str());
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Unit Hello, Frame;
+      AppendVarint(kSyncProtocolVersion, &Hello);
+      AppendVarint(static_cast<uint64_t>(GetPid()), &Hello);
+      AppendSyncFrame(kSyncHello, Hello, &Frame);
+      // The new peer starts at epoch 0, the queued deltas are of no use.
+      for (auto It = Outgoing.begin(); It != Outgoing.end();) {
+        if ((*It)[4] == kSyncCoverage) {
+          OutgoingBytes -= It->size();
+          It = Outgoing.erase(It);
+        } else {
+          ++It;
+        }
+      }
+      PeerCoverageEpoch = 0;
+      OutgoingBytes += Frame.size();
+      Outgoing.push_front(std::move(Frame));
+      Fd = NewFd;
+    }
+    HasOutgoing.notify_one();
+    Buf.clear();
+    size_t Beg = 0;
+    while (true) {
+      {
+        // Stop reading while the fuzzing loop is behind: the peer then
+        // blocks on a full socket.
+        std::unique_lock<std::mutex> Lock(Mu);
+        HasRoom.wait(Lock, [&] { return IncomingBytes < MaxQueuedBytes; });
+      }
+      size_t End = Buf.size();
+      Buf.resize(End + kReadSize);
+      ssize_t N = read(NewFd, Buf.data() + End, kReadSize);
+      if (N <= 0)
+        break;
+      Buf.resize(End + static_cast<size_t>(N));
+      uint8_t Type;
+      const uint8_t *Payload;
+      size_t PayloadSize, FrameSize;
+      bool Broken = false;
+      while ((FrameSize = ParseSyncFrame(Buf.data() + Beg, Buf.size() - Beg,
+                                         &Type, &Payload, &PayloadSize))) {
+        Beg += FrameSize;
+        SyncSeed S;
+        if (Type != kSyncSeed)
+          continue;  // Unknown frames are for newer agents.
+        if (!ParseSyncSeed(Payload, PayloadSize, &S)) {
+          Broken = true;
+          break;
+        }
+        Received++;
+        std::lock_guard<std::mutex> Lock(Mu);
+        IncomingBytes += S.U.size();
+        Incoming.push_back(std::move(S));
+        NumIncoming++;
+      }
+      if (Broken || (Buf.size() - Beg >= 5 && PayloadSize > kMaxSyncFrameSize))
+        break;
+      Buf.erase(Buf.begin(), Buf.begin() + Beg);
+      Beg = 0;
+    }
+    Printf("INFO: -sync_socket: lost the connection to %s\n", Path.c_str());
+    Disconnect(NewFd);
+  }
+}
+
+void SyncAgent::WriterThread() {
+  IsInternalThread = true;
+  while (true) {
+    int MyFd;
+    Unit *Frame;
+    {
+      std::unique_lock<std::mutex> Lock(Mu);
+      HasOutgoing.wait(Lock, [&] { return Fd >= 0 && !Outgoing.empty(); });
+      MyFd = Fd;
+      // Only this thread pops, the front stays put while it is sent.
+      Frame = &Outgoing.front();
+      Writing = true;
+    }
+    bool Ok = WriteAll(MyFd, Frame->data(), Frame->size());
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Writing = false;
+      if (Ok) {
+        if ((*Frame)[4] == kSyncPutSeed)
+          Sent++;
+        else if ((*Frame)[4] == kSyncCoverage)
+          CoverageBytes += Frame->size();
+        OutgoingBytes -= Frame->size();
+        Outgoing.pop_front();
+      } else {
+        // Wakes up the reader, which reconnects. The frame is sent again.
+        shutdown(MyFd, SHUT_RDWR);
+        Fd = -1;
+      }
+    }
+    WriteDone.notify_all();
+  }
+}
+
+#else
+
+void SyncAgent::Start(const std::string &Path, size_t MaxQueuedBytes) {
+  Printf("WARNING: -sync_socket is not supported on this platform\n");
+}
+
+void SyncAgent::Disconnect(int OldFd) {}
+void SyncAgent::ReaderThread() {}
+void SyncAgent::WriterThread() {}
+
+#endif  // LIBFUZZER_POSIX
+
+void SyncAgent::PutSeed(const Unit &U, const uint8_t Sha1[kSHA1NumBytes],
+                        const std::vector<uint32_t> &Features) {
+  Unit Payload(Sha1, Sha1 + kSHA1NumBytes), Frame;
+  AppendSyncSeed(U.data(), U.size(), Features, &Payload);
+  AppendSyncFrame(kSyncPutSeed, Payload, &Frame);
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    if (Path.empty() || OutgoingBytes + Frame.size() > MaxQueuedBytes) {
+      Dropped++;
+      return;
+    }
+    OutgoingBytes += Frame.size();
+    Outgoing.push_back(std::move(Frame));
+  }
+  HasOutgoing.notify_one();
+}
+
+size_t SyncAgent::CoverageEpoch() {
+  std::lock_guard<std::mutex> Lock(Mu);
+  return PeerCoverageEpoch;
+}
+
+void SyncAgent::PutCoverage(size_t BaseEpoch, size_t Epoch,
+                            const std::vector<uint32_t> &Features) {
+  Unit Payload, Frame;
+  AppendVarint(BaseEpoch, &Payload);
+  AppendVarint(Epoch, &Payload);
+  EncodeCoverageDelta(Features, &Payload);
+  AppendSyncFrame(kSyncCoverage, Payload, &Frame);
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    // A reconnect since the caller read the epoch: the delta is too short.
+    if (Path.empty() || BaseEpoch != PeerCoverageEpoch ||
+        OutgoingBytes + Frame.size() > MaxQueuedBytes)
+      return;
+    PeerCoverageEpoch = Epoch;
+    OutgoingBytes += Frame.size();
+    Outgoing.push_back(std::move(Frame));
+  }
+  HasOutgoing.notify_one();
+}
+
+void SyncAgent::TakeSeeds(std::vector<SyncSeed> *V) {
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    for (auto &S : Incoming)
+      V->push_back(std::move(S));
+    Incoming.clear();
+    IncomingBytes = 0;
+    NumIncoming = 0;
+  }
+  HasRoom.notify_all();
+}
+
+}  // namespace fuzzer
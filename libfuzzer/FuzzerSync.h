@@ -0,0 +1,131 @@
+//===- FuzzerSync.h - Internal header for the Fuzzer ------------*- C++ -* ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::SyncAgent
+//
+// Exchanges corpus inputs with a local peer over a Unix domain socket
+// (-sync_socket=<path>). The peer is the scheduler client, which relays them
+// to the scheduler service (client/protos/grpc_scheduler.proto), or
+// scripts/sync_server.py for a local setup.
+//
+// The peer listens, the agent connects and reconnects if the connection
+// drops. Both sides send frames:
+//   4-byte little-endian payload size, 1-byte type, payload.
+// Types:
+//   kSyncHello, agent -> peer, first frame of a connection:
+//     varint protocol version, varint pid.
+//   kSyncPutSeed, agent -> peer, a new input of the corpus:
+//     20-byte SHA1 of the unit, seed.
+//   kSyncSeed, peer -> agent, an input found elsewhere:
+//     seed.
+//   kSyncCoverage, agent -> peer, the features found since the last one:
+//     varint base epoch, varint epoch, the features (FuzzerCoverageDelta.h).
+// A seed is: varint number of features, the sorted features as varint
+// deltas, the unit (the rest of the payload). The features of a put seed are
+// the ones no smaller input of the corpus has (InputInfo::UniqFeatureSet).
+// The peer may send seeds without features. The agent's fuzzer does not run
+// a received seed when its corpus has all of the seed's features already: the
+// seed was added elsewhere for coverage that is known here.
+//
+// A coverage epoch is the number of features the corpus has found
+// (InputCorpus::CoverageEpoch). Every connection starts at epoch 0, so the
+// first kSyncCoverage has all the features and every later one only the new
+// ones. A peer that did not see the base epoch of a frame has lost frames and
+// should reconnect to start over.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SYNC_H
+#define LLVM_FUZZER_SYNC_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerSHA1.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace fuzzer {
+
+const uint64_t kSyncProtocolVersion = 1;
+// Larger frames are taken for a broken peer.
+const size_t kMaxSyncFrameSize = 1 << 28;
+
+enum SyncMessageType : uint8_t {
+  kSyncHello = 1,
+  kSyncPutSeed = 2,
+  kSyncSeed = 3,
+  kSyncCoverage = 4,
+};
+
+struct SyncSeed {
+  Unit U;
+  std::vector<uint32_t> Features;
+};
+
+void AppendSyncFrame(uint8_t Type, const Unit &Payload, Unit *Out);
+// Parses the frame at the start of Data. Returns its size, or 0 if Data does
+// not hold a whole frame yet.
+size_t ParseSyncFrame(const uint8_t *Data, size_t Size, uint8_t *Type,
+                      const uint8_t **Payload, size_t *PayloadSize);
+void AppendSyncSeed(const uint8_t *Data, size_t Size,
+                    const std::vector<uint32_t> &Features, Unit *Out);
+bool ParseSyncSeed(const uint8_t *Data, size_t Size, SyncSeed *S);
+
+class SyncAgent {
+ public:
+  // Connects to the peer at Path on a background thread. At most about
+  // MaxQueuedBytes of seeds wait in either direction.
+  void Start(const std::string &Path, size_t MaxQueuedBytes);
+
+  // Queues a new input of the corpus for the peer. Does not block, the
+  // seed is dropped if the queue is full.
+  void PutSeed(const Unit &U, const uint8_t Sha1[kSHA1NumBytes],
+               const std::vector<uint32_t> &Features);
+
+  // The coverage epoch the peer has once the queued frames are sent. 0 after
+  // a reconnect.
+  size_t CoverageEpoch();
+  // Queues the Features found between BaseEpoch (the CoverageEpoch() the
+  // caller saw) and Epoch. Does not block, the frame is dropped if the queue
+  // is full and the peer stays at BaseEpoch.
+  void PutCoverage(size_t BaseEpoch, size_t Epoch,
+                   const std::vector<uint32_t> &Features);
+
+  // For the fuzzing loop: are there seeds from the peer.
+  bool HasSeeds() const { return NumIncoming.load(std::memory_order_relaxed); }
+  void TakeSeeds(std::vector<SyncSeed> *V);
+
+  size_t NumSent() const { return Sent; }
+  size_t NumReceived() const { return Received; }
+  size_t NumDropped() const { return Dropped; }
+  size_t NumConnections() const { return Connections; }
+  size_t NumCoverageBytes() const { return CoverageBytes; }
+
+ private:
+  void ReaderThread();
+  void WriterThread();
+  void Disconnect(int OldFd);
+
+  std::string Path;
+  size_t MaxQueuedBytes = 0;
+  std::mutex Mu;
+  std::condition_variable HasOutgoing, HasRoom, WriteDone;
+  int Fd = -1;
+  bool Writing = false;  // The writer is sending the front of Outgoing.
+  std::deque<Unit> Outgoing;  // Frames.
+  size_t OutgoingBytes = 0;
+  size_t PeerCoverageEpoch = 0;
+  std::deque<SyncSeed> Incoming;
+  size_t IncomingBytes = 0;
+  std::atomic<size_t> NumIncoming{0};
+  std::atomic<size_t> Sent{0}, Received{0}, Dropped{0}, Connections{0};
+  std::atomic<size_t> CoverageBytes{0};
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SYNC_H
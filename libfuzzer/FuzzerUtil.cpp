@@ -26,6 +26,8 @@
 
 namespace fuzzer {
 
+thread_local bool IsInternalThread;
+
 void PrintHexArray(const uint8_t *Data, size_t Size,
                    const char *PrintAfter) {
   for (size_t i = 0; i < Size; i++)
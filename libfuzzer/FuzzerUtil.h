@@ -47,6 +47,12 @@ void PrintMemoryProfile();
 
 unsigned NumberOfCpuCores();
 
+// Set on the threads libFuzzer starts for its own work while the target runs
+// (seed prefetching, async writes, -reload_watch, -sync_socket). The malloc
+// hooks ignore these threads: their allocations are not the target's and
+// would look like leaks to -detect_leaks.
+extern thread_local bool IsInternalThread;
+
 // Platform specific functions.
 void SetSignalHandler(const FuzzingOptions& Options);
 
@@ -92,6 +98,30 @@ std::string SearchRegexCmd(const std::string &Regex);
 
 uint64_t SimpleFastHash(const void *Data, size_t Size, uint64_t Initial = 0);
 
+// LEB128 varints, used by the binary files libFuzzer writes for itself.
+inline void AppendVarint(uint64_t X, Unit *Out) {
+  while (X >= 0x80) {
+    Out->push_back(static_cast<uint8_t>(X | 0x80));
+    X >>= 7;
+  }
+  Out->push_back(static_cast<uint8_t>(X));
+}
+
+// Reads a varint at *P and advances *P past it.
+// Returns false if the varint does not end before End.
+inline bool ReadVarint(const uint8_t **P, const uint8_t *End, uint64_t *X) {
+  uint64_t Res = 0;
+  for (size_t Shift = 0; *P < End && Shift < 64; Shift += 7) {
+    uint8_t B = *(*P)++;
+    Res |= static_cast<uint64_t>(B & 0x7f) << Shift;
+    if (!(B & 0x80)) {
+      *X = Res;
+      return true;
+    }
+  }
+  return false;
+}
+
 inline size_t Log(size_t X) {
   return static_cast<size_t>((sizeof(unsigned long long) * 8) - Clzll(X) - 1);
 }
@@ -0,0 +1,161 @@
+//===- FuzzerWriter.cpp - asynchronous file writes ------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// Asynchronous file writes, see FuzzerWriter.h.
+//===----------------------------------------------------------------------===//
+// cjc: 后台线程写语料库等文件
+
+#include "FuzzerWriter.h"
+#include "FuzzerIO.h"
+#include "FuzzerPack.h"
+#include "FuzzerUtil.h"
+#include <chrono>
+#include <cstdlib>
+#include <set>
+#include <thread>
+
+namespace fuzzer {
+
+static thread_local bool IsWriterThread;
+
+AsyncWriter &GetAsyncWriter() {
+  // Never destroyed: the writer thread outlives the static destructors.
+  static AsyncWriter *W = new AsyncWriter;
+  return *W;
+}
+
+void AsyncWriter::Start(size_t MaxQueuedBytes, SyncPolicy Sync) {
+  std::lock_guard<std::mutex> Lock(Mu);
+  if (Started)
+    return;
+  Started = true;
+  this->MaxQueuedBytes = MaxQueuedBytes;
+  this->Sync = Sync;
+  std::thread([this] { WriterThread(); }).detach();
+  // exit() (e.g. at the end of fuzzing) must not lose the queued files.
+  std::atexit([] { GetAsyncWriter().Flush(); });
+}
+
+void AsyncWriter::WriteToFile(const Unit &U, const std::string &Path) {
+  Push({kWrite, Path, "", U});
+}
+
+void AsyncWriter::AppendToFile(const std::string &Data,
+                               const std::string &Path) {
+  Push({kAppend, Path, "", Unit(Data.begin(), Data.end())});
+}
+
+void AsyncWriter::AppendToPackedCorpus(const Unit &U,
+                                       const std::string &Pack) {
+  Push({kAppendPacked, Pack, "", U});
+}
+
+void AsyncWriter::RenameFile(const std::string &OldPath,
+                             const std::string &NewPath) {
+  Push({kRename, OldPath, NewPath, {}});
+}
+
+void AsyncWriter::RemoveFile(const std::string &Path) {
+  Push({kRemove, Path, "", {}});
+}
+
+void AsyncWriter::Push(Request &&R) {
+  std::unique_lock<std::mutex> Lock(Mu);
+  if (!Started) {
+    Lock.unlock();
+    std::vector<Request> Batch;
+    Batch.push_back(std::move(R));
+    DoRequests(Batch);
+    return;
+  }
+  HasRoom.wait(Lock,
+               [&] { return Queue.empty() || QueuedBytes < MaxQueuedBytes; });
+  QueuedBytes += R.Data.size();
+  Pending++;
+  Queue.push_back(std::move(R));
+  HasRequests.notify_one();
+}
+
+void AsyncWriter::Flush() {
+  // exit() on the writer thread: nobody else can finish the requests.
+  if (IsWriterThread)
+    return;
+  std::unique_lock<std::mutex> Lock(Mu);
+  IsIdle.wait(Lock, [&] { return Pending == 0; });
+}
+
+void AsyncWriter::WaitForPendingRequests(int Seconds) {
+  for (int i = 0; i < Seconds * 100 && Pending; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+void AsyncWriter::DoRequests(std::vector<Request> &Batch) {
+  std::set<std::string> Written;
+  for (size_t i = 0; i < Batch.size(); i++) {
+    auto &R = Batch[i];
+    switch (R.K) {
+    case kWrite:
+      fuzzer::WriteToFile(R.Data, R.Path);
+      Written.insert(R.Path);
+      break;
+    case kAppend: {
+      std::string Data(R.Data.begin(), R.Data.end());
+      for (; i + 1 < Batch.size() && Batch[i + 1].K == kAppend &&
+             Batch[i + 1].Path == R.Path;
+           i++)
+        Data.append(Batch[i + 1].Data.begin(), Batch[i + 1].Data.end());
+      fuzzer::AppendToFile(Data, R.Path);
+      Written.insert(R.Path);
+      break;
+    }
+    case kAppendPacked: {
+      std::vector<Unit> Units = {std::move(R.Data)};
+      for (; i + 1 < Batch.size() && Batch[i + 1].K == kAppendPacked &&
+             Batch[i + 1].Path == R.Path;
+           i++)
+        Units.push_back(std::move(Batch[i + 1].Data));
+      fuzzer::AppendToPackedCorpus(Units, R.Path);
+      Written.insert(R.Path);
+      break;
+    }
+    case kRename:
+      fuzzer::RenameFile(R.Path, R.NewPath);
+      break;
+    case kRemove:
+      fuzzer::RemoveFile(R.Path);
+      break;
+    }
+  }
+  if (Sync == kSyncFiles)
+    for (auto &Path : Written)
+      SyncFile(Path);
+}
+
+void AsyncWriter::WriterThread() {
+  IsInternalThread = true;
+  IsWriterThread = true;
+  std::vector<Request> Batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> Lock(Mu);
+      HasRequests.wait(Lock, [&] { return !Queue.empty(); });
+      Batch.swap(Queue);
+      QueuedBytes = 0;
+    }
+    HasRoom.notify_all();
+    DoRequests(Batch);
+    Batches++;
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Pending -= Batch.size();
+    }
+    IsIdle.notify_all();
+    Batch.clear();
+  }
+}
+
+}  // namespace fuzzer
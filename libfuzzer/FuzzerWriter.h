@@ -0,0 +1,79 @@
+//===- FuzzerWriter.h - Internal header for the Fuzzer ----------*- C++ -* ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::AsyncWriter
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_WRITER_H
+#define LLVM_FUZZER_WRITER_H
+
+#include "FuzzerDefs.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace fuzzer {
+
+// Does the file writes of the fuzzing loop (new corpus inputs, -features_dir,
+// -mutation_graph_file) on a background thread (-async_writes=1), so that
+// finding new coverage does not stall fuzzing on a slow disk. The requests are
+// done in order, in batches: consecutive appends to the same file become one.
+// The queue is bounded, a full queue blocks the fuzzing thread.
+//
+// Until Start is called every request is done right away. Crash artifacts
+// don't go through the writer, they are written synchronously.
+class AsyncWriter {
+ public:
+  enum SyncPolicy {
+    kNoSync = 0,
+    kSyncFiles = 1,  // fsync the files of every batch.
+  };
+
+  void Start(size_t MaxQueuedBytes, SyncPolicy Sync);
+
+  void WriteToFile(const Unit &U, const std::string &Path);
+  void AppendToFile(const std::string &Data, const std::string &Path);
+  void AppendToPackedCorpus(const Unit &U, const std::string &Pack);
+  void RenameFile(const std::string &OldPath, const std::string &NewPath);
+  void RemoveFile(const std::string &Path);
+
+  // Waits until all queued requests are done.
+  void Flush();
+  // Flush for the crash handlers: does not lock, gives up after Seconds.
+  void WaitForPendingRequests(int Seconds);
+
+  size_t NumBatches() const { return Batches; }
+
+ private:
+  enum Kind { kWrite, kAppend, kAppendPacked, kRename, kRemove };
+  struct Request {
+    Kind K;
+    std::string Path, NewPath;
+    Unit Data;
+  };
+
+  void Push(Request &&R);
+  void DoRequests(std::vector<Request> &Batch);
+  void WriterThread();
+
+  std::mutex Mu;
+  std::condition_variable HasRequests, HasRoom, IsIdle;
+  std::vector<Request> Queue;
+  size_t QueuedBytes = 0;
+  size_t MaxQueuedBytes = 0;
+  SyncPolicy Sync = kNoSync;
+  bool Started = false;
+  std::atomic<size_t> Pending{0};
+  std::atomic<size_t> Batches{0};
+};
+
+// The writer of the process.
+AsyncWriter &GetAsyncWriter();
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_WRITER_H
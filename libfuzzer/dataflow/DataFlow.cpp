@@ -39,6 +39,12 @@
 //   export DFSAN_OPTIONS=warn_unimplemented=0
 //   ./a.out INPUT_FILE [OUTPUT_FILE]
 //
+//   # Collect data flow and coverage for every unit of a packed corpus (see
+//   # FuzzerPack.h) in one process. Each trace is followed by a line
+//   # "I <sha1 of the unit>" and flushed, so that the traces completed before
+//   # a crash are not lost.
+//   ./a.out PACKED_CORPUS OUTPUT_FILE
+//
 //   # Print all instrumented functions. llvm-symbolizer must be present in PATH
 //   ./a.out
 //
@@ -76,6 +82,10 @@ static size_t InputLen;
 static size_t NumIterations;
 static dfsan_label **FuncLabelsPerIter;  // NumIterations x NumFuncs;
 
+static const char kPackedCorpusMagic[] = "\x7fLFP";
+static const size_t kPackedCorpusMagicSize = 4;
+static const size_t kSHA1NumBytes = 20;
+
 static inline bool BlockIsEntry(size_t BlockIdx) {
   return __dft.PCsBeg[BlockIdx * 2 + 1] & PCFLAG_FUNC_ENTRY;
 }
@@ -153,53 +163,111 @@ static void PrintCoverage(FILE *Out) {
   }
 }
 
-int main(int argc, char **argv) {
-  if (LLVMFuzzerInitialize)
-    LLVMFuzzerInitialize(&argc, &argv);
-  if (argc == 1)
-    return PrintFunctions();
-  assert(argc == 2 || argc == 3);
-
-  const char *Input = argv[1];
-  fprintf(stderr, "INFO: reading '%s'\n", Input);
-  FILE *In = fopen(Input, "r");
-  assert(In);
-  fseek(In, 0, SEEK_END);
-  InputLen = ftell(In);
-  fseek(In, 0, SEEK_SET);
-  unsigned char *Buf = (unsigned char*)malloc(InputLen);
-  size_t NumBytesRead = fread(Buf, 1, InputLen, In);
-  assert(NumBytesRead == InputLen);
-  fclose(In);
-
-  NumIterations = (NumBytesRead + kNumLabels - 1) / kNumLabels;
+// Runs the target on Buf once for every kNumLabels bytes, with those bytes
+// labeled, and prints the data flow and the coverage to Out.
+static void TraceInput(const char *Name, unsigned char *Buf, size_t Len,
+                       FILE *Out) {
+  InputLen = Len;
+  NumIterations = (Len + kNumLabels - 1) / kNumLabels;
   FuncLabelsPerIter =
       (dfsan_label **)calloc(NumIterations, sizeof(dfsan_label *));
   for (size_t Iter = 0; Iter < NumIterations; Iter++)
     FuncLabelsPerIter[Iter] =
         (dfsan_label *)calloc(__dft.NumFuncs, sizeof(dfsan_label));
+  memset(__dft.BBExecuted, 0, __dft.NumGuards * sizeof(bool));
 
   for (size_t Iter = 0; Iter < NumIterations; Iter++) {
-    fprintf(stderr, "INFO: running '%s' %zd/%zd\n", Input, Iter, NumIterations);
+    fprintf(stderr, "INFO: running '%s' %zd/%zd\n", Name, Iter, NumIterations);
     dfsan_flush();
-    dfsan_set_label(0, Buf, InputLen);
+    dfsan_set_label(0, Buf, Len);
     __dft.FuncLabels = FuncLabelsPerIter[Iter];
 
     size_t BaseIdx = Iter * kNumLabels;
-    size_t LastIdx = BaseIdx + kNumLabels < NumBytesRead ? BaseIdx + kNumLabels
-                                                         : NumBytesRead;
+    size_t LastIdx = BaseIdx + kNumLabels < Len ? BaseIdx + kNumLabels : Len;
     assert(BaseIdx < LastIdx);
     for (size_t Idx = BaseIdx; Idx < LastIdx; Idx++)
       dfsan_set_label(1 << (Idx - BaseIdx), Buf + Idx, 1);
-    LLVMFuzzerTestOneInput(Buf, InputLen);
+    LLVMFuzzerTestOneInput(Buf, Len);
   }
-  free(Buf);
+
+  PrintDataFlow(Out);
+  PrintCoverage(Out);
+  for (size_t Iter = 0; Iter < NumIterations; Iter++)
+    free(FuncLabelsPerIter[Iter]);
+  free(FuncLabelsPerIter);
+}
+
+static bool ReadVarint(const unsigned char **P, const unsigned char *End,
+                       uint64_t *X) {
+  uint64_t Res = 0;
+  for (size_t Shift = 0; *P < End && Shift < 64; Shift += 7) {
+    unsigned char B = *(*P)++;
+    Res |= (uint64_t)(B & 0x7f) << Shift;
+    if (!(B & 0x80)) {
+      *X = Res;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Traces every raw record of the packed corpus in Data. A truncated record
+// ends the pack, like in FuzzerPack.cpp.
+static void TracePackedCorpus(unsigned char *Data, size_t Size, FILE *Out) {
+  const unsigned char *P = Data + kPackedCorpusMagicSize, *End = Data + Size;
+  uint64_t Version, StoredSize, UnitSize;
+  if (!ReadVarint(&P, End, &Version))
+    return;
+  while (P < End) {
+    unsigned char Codec = *P++;
+    if (!ReadVarint(&P, End, &StoredSize) ||
+        !ReadVarint(&P, End, &UnitSize) ||
+        (size_t)(End - P) < kSHA1NumBytes + StoredSize)
+      break;
+    char Sha1[kSHA1NumBytes * 2 + 1];
+    for (size_t i = 0; i < kSHA1NumBytes; i++)
+      snprintf(Sha1 + i * 2, 3, "%02x", P[i]);
+    P += kSHA1NumBytes;
+    unsigned char *Unit = Data + (P - Data);
+    P += StoredSize;
+    if (Codec != 0 || StoredSize != UnitSize) {
+      fprintf(stderr, "INFO: skipping '%s': unknown codec %d\n", Sha1, Codec);
+      continue;
+    }
+    TraceInput(Sha1, Unit, UnitSize, Out);
+    fprintf(Out, "I %s\n", Sha1);
+    fflush(Out);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (LLVMFuzzerInitialize)
+    LLVMFuzzerInitialize(&argc, &argv);
+  if (argc == 1)
+    return PrintFunctions();
+  assert(argc == 2 || argc == 3);
+
+  const char *Input = argv[1];
+  fprintf(stderr, "INFO: reading '%s'\n", Input);
+  FILE *In = fopen(Input, "r");
+  assert(In);
+  fseek(In, 0, SEEK_END);
+  size_t Len = ftell(In);
+  fseek(In, 0, SEEK_SET);
+  unsigned char *Buf = (unsigned char*)malloc(Len);
+  size_t NumBytesRead = fread(Buf, 1, Len, In);
+  assert(NumBytesRead == Len);
+  fclose(In);
 
   bool OutIsStdout = argc == 2;
   fprintf(stderr, "INFO: writing dataflow to %s\n",
           OutIsStdout ? "<stdout>" : argv[2]);
   FILE *Out = OutIsStdout ? stdout : fopen(argv[2], "w");
-  PrintDataFlow(Out);
-  PrintCoverage(Out);
+  if (Len >= kPackedCorpusMagicSize &&
+      !memcmp(Buf, kPackedCorpusMagic, kPackedCorpusMagicSize))
+    TracePackedCorpus(Buf, Len, Out);
+  else
+    TraceInput(Input, Buf, Len, Out);
+  free(Buf);
   if (!OutIsStdout) fclose(Out);
 }
@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+# ===- lib/fuzzer/scripts/sync_server.py ------------------------------------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+# ===------------------------------------------------------------------------===#
+#
+# A local peer for -sync_socket (see FuzzerSync.h): relays the new inputs of
+# every connected fuzzer to all the others, so that several fuzzers on one
+# machine share their corpus without the scheduler.
+# Usage:
+#   sync_server.py /tmp/sync.sock &
+#   my_fuzzer -sync_socket=/tmp/sync.sock CORPUS1 &
+#   my_fuzzer -sync_socket=/tmp/sync.sock CORPUS2 &
+#
+# ===------------------------------------------------------------------------===#
+
+import argparse
+import os
+import select
+import socket
+import struct
+import sys
+
+SYNC_PUT_SEED = 2
+SYNC_SEED = 3
+SHA1_SIZE = 20
+# A peer that has this much unsent data gets no more seeds until it reads.
+MAX_QUEUED_BYTES = 64 << 20
+
+
+def Frame(type, payload):
+    return struct.pack("<IB", len(payload), type) + payload
+
+
+class Peer(object):
+    def __init__(self, conn):
+        conn.setblocking(False)
+        self.conn = conn
+        self.inbuf = b""
+        self.outbuf = bytearray()
+
+
+def Serve(path, verbose):
+    if os.path.exists(path):
+        os.unlink(path)
+    listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    listener.bind(path)
+    listener.listen(16)
+    peers = {}  # socket -> Peer.
+    seen = set()  # SHA1 of the relayed seeds.
+
+    def Drop(s):
+        del peers[s]
+        s.close()
+
+    while True:
+        # Nobody waits for a peer that does not read: its data is queued and
+        # sent when the socket is writable.
+        writers = [s for s, p in peers.items() if p.outbuf]
+        readable, writable, _ = select.select(
+            [listener] + list(peers), writers, []
+        )
+        for s in writable:
+            if s not in peers:
+                continue
+            p = peers[s]
+            try:
+                sent = s.send(p.outbuf)
+            except BlockingIOError:
+                continue
+            except OSError:
+                Drop(s)
+                continue
+            del p.outbuf[:sent]
+        for s in readable:
+            if s is listener:
+                conn, _ = listener.accept()
+                peers[conn] = Peer(conn)
+                continue
+            if s not in peers:
+                continue
+            try:
+                data = s.recv(1 << 16)
+            except BlockingIOError:
+                continue
+            except OSError:
+                data = b""
+            if not data:
+                Drop(s)
+                continue
+            p = peers[s]
+            buf = p.inbuf + data
+            while len(buf) >= 5:
+                size, type = struct.unpack("<IB", buf[:5])
+                if len(buf) < 5 + size:
+                    break
+                payload = buf[5 : 5 + size]
+                buf = buf[5 + size :]
+                if type != SYNC_PUT_SEED or len(payload) < SHA1_SIZE:
+                    continue
+                sha1 = payload[:SHA1_SIZE]
+                if sha1 in seen:
+                    continue
+                seen.add(sha1)
+                if verbose:
+                    print("seed %s, %d bytes" % (sha1.hex(), size - SHA1_SIZE))
+                out = Frame(SYNC_SEED, payload[SHA1_SIZE:])
+                for other, q in peers.items():
+                    if other is not s and len(q.outbuf) < MAX_QUEUED_BYTES:
+                        q.outbuf += out
+            p.inbuf = buf
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="-sync_socket relay.")
+    parser.add_argument("path", help="the socket to listen on")
+    parser.add_argument("-v", action="store_true", help="print the seeds")
+    args = parser.parse_args()
+    Serve(args.path, args.v)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,361 @@
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Microbenchmarks for the mutation hot path. This is not a test, it prints
+// the cost of every mutator for a range of input sizes:
+//   Fuzzer-x86_64-Benchmark [NAME_SUBSTRING]
+// ns/op is the time of one mutation, bytes/op is how many bytes of the input
+// a mutation changes on average (a changed size counts as changed bytes).
+//
+// SeedLoading is the startup cost of reading a seed corpus with a number of
+// prefetch threads (-seed_prefetch_threads). It generates a corpus in a temp
+// dir, pass a corpus dir (e.g. on network storage) to measure that instead:
+//   Fuzzer-x86_64-Benchmark SeedLoading [CORPUS_DIR]
+//
+// CoverageDelta compares the bytes on the wire of a coverage update as a
+// full bitmap (GetCoverage.coverage_data), as {index, count} pairs
+// (PutCoverage.bitmap) and as an encoded delta (FuzzerCoverageDelta.h), and
+// times the delta encoding.
+
+#include "FuzzerCoverageDelta.h"
+#include "FuzzerDefs.h"
+#include "FuzzerExtFunctions.h"
+#include "FuzzerIO.h"
+#include "FuzzerMutate.h"
+#include "FuzzerPrefetch.h"
+#include "FuzzerRandom.h"
+#include "FuzzerSHA1.h"
+#include "FuzzerTracePC.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <set>
+
+using namespace fuzzer;
+
+// The benchmark never runs the target, but libFuzzer needs it to link.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  abort();
+}
+
+namespace {
+
+typedef std::function<size_t(uint8_t *Data, size_t Size, size_t MaxSize)>
+    MutatorFn;
+
+const size_t kSizes[] = {4, 64, 1 << 10, 1 << 14, 1 << 18, 1 << 20};
+
+// Every measurement runs for at least this long.
+const std::chrono::milliseconds kMinMeasurementTime(20);
+
+// Keeps the compiler from throwing the mutations away.
+volatile size_t Sink;
+
+// Mutates a Size-byte input over and over. The input is not restored between
+// the iterations, restoring it would cost more than most mutations do.
+double NanosecondsPerMutation(const MutatorFn &M, Unit &Data, size_t Size) {
+  size_t MaxSize = Data.size();
+  for (size_t Iters = 16;; Iters *= 2) {
+    auto Start = std::chrono::steady_clock::now();
+    size_t Res = 0;
+    for (size_t i = 0; i < Iters; i++)
+      Res += M(Data.data(), Size, MaxSize);
+    auto Time = std::chrono::steady_clock::now() - Start;
+    Sink = Res;
+    if (Time >= kMinMeasurementTime)
+      return static_cast<double>(
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(Time)
+                     .count()) /
+             static_cast<double>(Iters);
+  }
+}
+
+// Average number of bytes that differ between the input and the mutant.
+double BytesChangedPerMutation(const MutatorFn &M, const Unit &Data,
+                               size_t Size) {
+  const size_t kSamples = 64;
+  size_t Changed = 0;
+  Unit Mutant;
+  for (size_t i = 0; i < kSamples; i++) {
+    Mutant = Data;
+    size_t NewSize = M(Mutant.data(), Size, Mutant.size());
+    size_t CommonSize = std::min(Size, NewSize);
+    for (size_t j = 0; j < CommonSize; j++)
+      Changed += Mutant[j] != Data[j];
+    Changed += std::max(Size, NewSize) - CommonSize;
+  }
+  return static_cast<double>(Changed) / kSamples;
+}
+
+Unit RandomUnit(Random &Rand, size_t Size) {
+  Unit U(Size);
+  for (auto &B : U)
+    B = static_cast<uint8_t>(Rand(10) ? Rand(256) : '0' + Rand(10));
+  return U;
+}
+
+// Reads the corpus the way ReadAndExecuteSeedCorpora does. Hashing every
+// input stands in for executing it.
+void BenchmarkSeedLoading(Random &Rand, const char *CorpusDir) {
+  const size_t kNumFiles = 1 << 13;
+  const size_t kFileSize = 1 << 10;
+  std::string Dir = CorpusDir ? CorpusDir : TempPath("Benchmark", ".dir");
+  std::vector<SizedFile> Files;
+  if (CorpusDir) {
+    GetSizedFilesFromDir(Dir, &Files);
+  } else {
+    MkDir(Dir);
+    for (size_t i = 0; i < kNumFiles; i++) {
+      Files.push_back({DirPlusFile(Dir, std::to_string(i)), kFileSize});
+      WriteToFile(RandomUnit(Rand, kFileSize), Files.back().File);
+    }
+  }
+  printf("%-28s %10s %14s %12s\n", "seed loading", "threads", "ms", "stalls");
+  for (size_t Threads : {0, 1, 2, 4, 8}) {
+    auto Start = std::chrono::steady_clock::now();
+    FilePrefetcher Prefetcher(Files, 0, Threads);
+    for (size_t i = 0; i < Files.size(); i++) {
+      Unit U = Prefetcher.Take(i);
+      uint8_t Sha1[kSHA1NumBytes];
+      ComputeSHA1(U.data(), U.size(), Sha1);
+      Sink = Sha1[0];
+    }
+    auto Time = std::chrono::steady_clock::now() - Start;
+    printf("%-28s %10zd %14.1f %12zd\n", "SeedLoading", Threads,
+           static_cast<double>(
+               std::chrono::duration_cast<std::chrono::microseconds>(Time)
+                   .count()) /
+               1000,
+           Prefetcher.NumStalls());
+  }
+  if (!CorpusDir)
+    RmDirRecursive(Dir);
+}
+
+// Runs F until kMinMeasurementTime passes, returns microseconds per run.
+double MicrosecondsPerRun(const std::function<void()> &F) {
+  for (size_t Iters = 1;; Iters *= 2) {
+    auto Start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < Iters; i++)
+      F();
+    auto Time = std::chrono::steady_clock::now() - Start;
+    if (Time >= kMinMeasurementTime)
+      return static_cast<double>(
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(Time)
+                     .count()) /
+             1000 / static_cast<double>(Iters);
+  }
+}
+
+size_t VarintSize(uint64_t X) {
+  size_t N = 1;
+  for (; X >= 0x80; X >>= 7)
+    N++;
+  return N;
+}
+
+// Features the way TracePC makes them from edge counters: 8 per edge, one
+// for each counter bucket, and edges of a function are next to each other.
+// Num must be well below the 3 * 2^18 features this can make.
+std::vector<uint32_t> RandomFeatures(Random &Rand, size_t NumEdges,
+                                     size_t Num) {
+  const uint32_t kFeatureSetSize = 1 << 21;
+  std::set<uint32_t> S;
+  while (S.size() < Num) {
+    uint32_t Edge = static_cast<uint32_t>(Rand(NumEdges));
+    for (size_t i = 0, N = 1 + Rand(8); i < N && S.size() < Num; i++, Edge++)
+      S.insert((Edge * 8 + static_cast<uint32_t>(Rand(3))) % kFeatureSetSize);
+  }
+  return std::vector<uint32_t>(S.begin(), S.end());
+}
+
+void BenchmarkCoverageDelta(Random &Rand) {
+  const size_t kBitmapBytes = (1 << 21) / 8;
+  const size_t kNumEdges = 1 << 20;
+  printf("%-28s %10s %10s %10s %10s %10s %10s\n", "coverage", "features",
+         "bitmap B", "pairs B", "delta B", "enc us", "dec us");
+  for (size_t Num : {10, 100, 1000, 10000, 100000, 300000}) {
+    auto Features = RandomFeatures(Rand, kNumEdges, Num);
+    // repeated CoverageData {uint32 index = 1; uint32 count = 2;}, count 1.
+    size_t PairBytes = 0;
+    for (auto F : Features) {
+      size_t Msg = 1 + VarintSize(F) + 2;
+      PairBytes += 1 + VarintSize(Msg) + Msg;
+    }
+    Unit Enc;
+    double EncUs = MicrosecondsPerRun([&] {
+      Enc.clear();
+      EncodeCoverageDelta(Features, &Enc);
+    });
+    std::vector<uint32_t> Dec;
+    double DecUs = MicrosecondsPerRun([&] {
+      Dec.clear();
+      Sink = DecodeCoverageDelta(Enc.data(), Enc.size(), &Dec);
+    });
+    if (Dec != Features)
+      printf("WARNING: CoverageDelta: bad round trip\n");
+    printf("%-28s %10zd %10zd %10zd %10zd %10.1f %10.1f\n", "CoverageDelta",
+           Num, kBitmapBytes, PairBytes, Enc.size(), EncUs, DecUs);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *Filter = argc > 1 ? argv[1] : "";
+  std::unique_ptr<ExternalFunctions> EFPtr(new ExternalFunctions());
+  EF = EFPtr.get();
+  Random Rand(0);
+  FuzzingOptions Options;
+  MutationDispatcher MD(Rand, Options);
+  Unit Other, Out;
+  MD.SetCrossOverWith(&Other);
+  const char *Words[] = {"GIF89a", "IHDR",  "\xff\xd8\xff\xe0",
+                         "%PDF-1.7", "<svg", "\x89PNG"};
+  for (const char *W : Words)
+    MD.AddWordToManualDictionary(
+        Word(reinterpret_cast<const uint8_t *>(W), strlen(W)));
+  // The compares of a target: half of them with an argument that is in the
+  // input, so that the TORC mutation has something to replace.
+  auto FillTORC = [&](const Unit &Data, size_t Size) {
+    for (size_t i = 0; i < TPC.TORC4.kSize; i++) {
+      uint32_t A4 = Rand.Rand<uint32_t>();
+      uint64_t A8 = Rand.Rand<uint64_t>();
+      Word AW(Data.data(), std::min<size_t>(Size, 8));
+      if (i % 2 == 0 && Size >= 8) {
+        size_t Pos = Rand(Size - 7);
+        memcpy(&A4, &Data[Pos], sizeof(A4));
+        memcpy(&A8, &Data[Pos], sizeof(A8));
+        AW.Set(&Data[Pos], 8);
+      }
+      TPC.TORC4.Insert(i, A4, Rand.Rand<uint32_t>());
+      TPC.TORC8.Insert(i, A8, Rand.Rand<uint64_t>());
+      uint8_t B[8];
+      for (auto &X : B)
+        X = static_cast<uint8_t>(Rand(256));
+      TPC.TORCW.Insert(i, AW, Word(B, AW.size()));
+      TPC.MMT.Add(B, sizeof(B));
+    }
+  };
+  // The persistent auto dictionary gets the words of the successful mutation
+  // sequences, here those of a sequence of dictionary and TORC mutations.
+  {
+    Unit Seed = RandomUnit(Rand, 1024);
+    FillTORC(Seed, Seed.size());
+    MD.StartMutationSequence();
+    for (int i = 0; i < 64; i++) {
+      Unit U = Seed;
+      U.resize(2 * Seed.size());
+      MD.Mutate_AddWordFromManualDictionary(U.data(), Seed.size(), U.size());
+      MD.Mutate_AddWordFromTORC(U.data(), Seed.size(), U.size());
+    }
+    MD.RecordSuccessfulMutationSequence();
+  }
+  // Masks as MutateWithMask gets them from the data flow trace: a few
+  // scattered bytes, or long runs of bytes.
+  // The .Cached variants use the masks the way the fuzzing loop does,
+  // precomputed once per input.
+  std::vector<uint8_t> SparseMask, RunsMask;
+  MutationMask SparseMaskCached, RunsMaskCached;
+  auto MakeMasks = [&](size_t Size) {
+    SparseMask.assign(Size, 0);
+    RunsMask.assign(Size, 0);
+    for (size_t i = 0; i < Size; i += 16)
+      SparseMask[i] = 1;
+    for (size_t i = 0; i < Size; i++)
+      RunsMask[i] = (i / 64) % 2 == 0;
+    SparseMaskCached = MutationMask(SparseMask);
+    RunsMaskCached = MutationMask(RunsMask);
+  };
+
+  auto Bind = [&](size_t (MutationDispatcher::*Fn)(uint8_t *, size_t,
+                                                    size_t)) -> MutatorFn {
+    return [&MD, Fn](uint8_t *Data, size_t Size, size_t MaxSize) {
+      return (MD.*Fn)(Data, Size, MaxSize);
+    };
+  };
+  const std::pair<const char *, MutatorFn> Mutators[] = {
+      {"EraseBytes", Bind(&MutationDispatcher::Mutate_EraseBytes)},
+      {"InsertByte", Bind(&MutationDispatcher::Mutate_InsertByte)},
+      {"InsertRepeatedBytes",
+       Bind(&MutationDispatcher::Mutate_InsertRepeatedBytes)},
+      {"ChangeByte", Bind(&MutationDispatcher::Mutate_ChangeByte)},
+      {"ChangeBit", Bind(&MutationDispatcher::Mutate_ChangeBit)},
+      {"ShuffleBytes", Bind(&MutationDispatcher::Mutate_ShuffleBytes)},
+      {"ChangeASCIIInt", Bind(&MutationDispatcher::Mutate_ChangeASCIIInteger)},
+      {"ChangeBinInt", Bind(&MutationDispatcher::Mutate_ChangeBinaryInteger)},
+      {"CopyPart", Bind(&MutationDispatcher::Mutate_CopyPart)},
+      {"CrossOver", Bind(&MutationDispatcher::Mutate_CrossOver)},
+      {"CrossOver.Alternate",
+       [&](uint8_t *Data, size_t Size, size_t MaxSize) {
+         // Mutate_CrossOver has to copy the result back, so do we.
+         Out.resize(MaxSize);
+         size_t NewSize = MD.CrossOver(Data, Size, Other.data(), Other.size(),
+                                       Out.data(), MaxSize);
+         memcpy(Data, Out.data(), NewSize);
+         return NewSize;
+       }},
+      {"CrossOver.Splice",
+       [&](uint8_t *Data, size_t Size, size_t MaxSize) {
+         return MD.SpliceCrossOver(Other.data(), Other.size(), Data, Size,
+                                   MaxSize);
+       }},
+      {"CrossOver.TwoPoint",
+       [&](uint8_t *Data, size_t Size, size_t MaxSize) {
+         return MD.TwoPointCrossOver(Other.data(), Other.size(), Data, Size,
+                                     MaxSize);
+       }},
+      {"CrossOver.Aligned",
+       [&](uint8_t *Data, size_t Size, size_t) {
+         return MD.AlignedCrossOver(Other.data(), Other.size(), Data, Size);
+       }},
+      {"ManualDict",
+       Bind(&MutationDispatcher::Mutate_AddWordFromManualDictionary)},
+      {"TORC", Bind(&MutationDispatcher::Mutate_AddWordFromTORC)},
+      {"PersistentAutoDict",
+       Bind(&MutationDispatcher::Mutate_AddWordFromPersistentAutoDictionary)},
+      {"MutateWithMask.Sparse",
+       [&](uint8_t *Data, size_t Size, size_t) {
+         return MD.MutateWithMask(Data, Size, Size, SparseMask);
+       }},
+      {"MutateWithMask.Runs",
+       [&](uint8_t *Data, size_t Size, size_t) {
+         return MD.MutateWithMask(Data, Size, Size, RunsMask);
+       }},
+      {"MutateWithMask.Sparse.Cached",
+       [&](uint8_t *Data, size_t Size, size_t) {
+         return MD.MutateWithMask(Data, Size, Size, SparseMaskCached);
+       }},
+      {"MutateWithMask.Runs.Cached",
+       [&](uint8_t *Data, size_t Size, size_t) {
+         return MD.MutateWithMask(Data, Size, Size, RunsMaskCached);
+       }},
+      {"Mutate", Bind(&MutationDispatcher::Mutate)},
+  };
+
+  printf("%-28s %10s %14s %12s\n", "mutator", "size", "ns/op", "bytes/op");
+  for (auto &M : Mutators) {
+    if (!strstr(M.first, Filter))
+      continue;
+    for (size_t Size : kSizes) {
+      // Leave room for the mutations that grow the input.
+      Unit Data = RandomUnit(Rand, 2 * Size);
+      Other = RandomUnit(Rand, Size);
+      MakeMasks(Size);
+      FillTORC(Data, Size);
+      double BytesPerOp = BytesChangedPerMutation(M.second, Data, Size);
+      double NsPerOp = NanosecondsPerMutation(M.second, Data, Size);
+      printf("%-28s %10zd %14.1f %12.1f\n", M.first, Size, NsPerOp,
+             BytesPerOp);
+    }
+  }
+  if (strstr("SeedLoading", Filter))
+    BenchmarkSeedLoading(Rand, argc > 2 ? argv[2] : nullptr);
+  if (strstr("CoverageDelta", Filter))
+    BenchmarkCoverageDelta(Rand);
+  return 0;
+}
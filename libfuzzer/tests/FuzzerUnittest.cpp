@@ -9,17 +9,32 @@
 // Do not attempt to use LLVM ostream etc from gtest.
 #define GTEST_NO_LLVM_SUPPORT 1
 
+#include "FuzzerCompress.h"
 #include "FuzzerCorpus.h"
+#include "FuzzerCoverageDelta.h"
 #include "FuzzerDictionary.h"
+#include "FuzzerFork.h"
 #include "FuzzerInternal.h"
 #include "FuzzerMerge.h"
 #include "FuzzerMutate.h"
+#include "FuzzerPack.h"
+#include "FuzzerPrefetch.h"
 #include "FuzzerRandom.h"
+#include "FuzzerSync.h"
 #include "FuzzerTracePC.h"
+#include "FuzzerWriter.h"
 #include "gtest/gtest.h"
+#include <chrono>
 #include <memory>
 #include <set>
 #include <sstream>
+#include <thread>
+
+#if LIBFUZZER_LINUX
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 using namespace fuzzer;
 
@@ -104,6 +119,53 @@ TEST(Fuzzer, CrossOver) {
   }
 }
 
+TEST(Fuzzer, BlockCrossOver) {
+  std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
+  fuzzer::EF = t.get();
+  Random Rand(0);
+  std::unique_ptr<MutationDispatcher> MD(new MutationDispatcher(Rand, {}));
+  const Unit A({0, 1, 2}), B({5, 6, 7});
+  const size_t MaxSize = 4;
+  std::set<Unit> Splice, TwoPoint, Aligned;
+  for (int Iter = 0; Iter < 3000; Iter++) {
+    Unit C = A;
+    C.resize(MaxSize);
+    C.resize(MD->SpliceCrossOver(B.data(), B.size(), C.data(), A.size(),
+                                 MaxSize));
+    Splice.insert(C);
+    C = A;
+    C.resize(MaxSize);
+    C.resize(MD->TwoPointCrossOver(B.data(), B.size(), C.data(), A.size(),
+                                   MaxSize));
+    TwoPoint.insert(C);
+    C = A;
+    C.resize(MD->AlignedCrossOver(B.data(), B.size(), C.data(), A.size()));
+    Aligned.insert(C);
+  }
+  std::set<Unit> ExpectedSplice = {
+      {0, 5, 6, 7}, {0, 6, 7},    {0, 7},       {0, 1, 5, 6},  {0, 1, 6, 7},
+      {0, 1, 7},    {0, 1, 2, 5}, {0, 1, 2, 6}, {0, 1, 2, 7}};
+  EXPECT_EQ(Splice, ExpectedSplice);
+
+  // Every A[0, ToBeg) + B[FromBeg, FromEnd) + A[ToEnd, 3) that fits.
+  std::set<Unit> ExpectedTwoPoint;
+  for (size_t ToBeg = 0; ToBeg < 3; ToBeg++)
+    for (size_t ToEnd = ToBeg + 1; ToEnd <= 3; ToEnd++)
+      for (size_t FromBeg = 0; FromBeg < 3; FromBeg++)
+        for (size_t FromEnd = FromBeg + 1; FromEnd <= 3; FromEnd++) {
+          Unit U(A.begin(), A.begin() + ToBeg);
+          U.insert(U.end(), B.begin() + FromBeg, B.begin() + FromEnd);
+          U.resize(std::min(U.size(), MaxSize - (3 - ToEnd)));
+          U.insert(U.end(), A.begin() + ToEnd, A.end());
+          ExpectedTwoPoint.insert(U);
+        }
+  EXPECT_EQ(TwoPoint, ExpectedTwoPoint);
+
+  std::set<Unit> ExpectedAligned = {{5, 1, 2}, {5, 6, 2}, {5, 6, 7},
+                                    {0, 6, 2}, {0, 6, 7}, {0, 1, 7}};
+  EXPECT_EQ(Aligned, ExpectedAligned);
+}
+
 TEST(Fuzzer, Hash) {
   uint8_t A[] = {'a', 'b', 'c'};
   fuzzer::Unit U(A, A + sizeof(A));
@@ -529,6 +591,76 @@ TEST(FuzzerMutate, ChangeBinaryInteger2) {
   TestChangeBinaryInteger(&MutationDispatcher::Mutate, 1 << 15);
 }
 
+TEST(FuzzerMutate, MutateWithMask) {
+  std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
+  fuzzer::EF = t.get();
+  Random Rand(0);
+  std::unique_ptr<MutationDispatcher> MD(new MutationDispatcher(Rand, {}));
+  const std::vector<uint8_t> Mask = {0, 1, 1, 0, 2, 2, 0, 1};
+  MutationMask M(Mask);
+  EXPECT_EQ(M.NumBytes(), 5U);
+  EXPECT_TRUE(MutationMask(std::vector<uint8_t>(8, 0)).empty());
+
+  const uint8_t Orig[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  std::vector<size_t> NumChanged(8);
+  for (int Iter = 0; Iter < 1000; Iter++) {
+    uint8_t T[8];
+    memcpy(T, Orig, sizeof(T));
+    // Only the first 6 bytes are passed, the run at offset 7 is ignored.
+    EXPECT_EQ(MD->MutateWithMask(T, 6, 6, M), 6U);
+    for (size_t I = 0; I < 8; I++)
+      NumChanged[I] += T[I] != Orig[I];
+  }
+  for (size_t I : {0, 3, 6, 7})
+    EXPECT_EQ(NumChanged[I], 0U);
+  for (size_t I : {1, 2, 4, 5})
+    EXPECT_GT(NumChanged[I], 0U);
+  // Half of the mutations only touch the heavy bytes.
+  EXPECT_GT(NumChanged[4] + NumChanged[5], NumChanged[1] + NumChanged[2]);
+}
+
+static size_t CountDeterministicMutations(MutationDispatcher *MD,
+                                          const std::vector<uint8_t> &Map) {
+  DeterministicCursor C;
+  size_t N = 0;
+  while (true) {
+    uint8_t T[2] = {0x10, 0x20};
+    if (!MD->MutateDeterministic(T, sizeof(T), &C, Map))
+      break;
+    EXPECT_NE(0, memcmp(T, "\x10\x20", 2));
+    N++;
+  }
+  EXPECT_TRUE(C.Done());
+  return N;
+}
+
+TEST(FuzzerMutate, Deterministic) {
+  std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
+  fuzzer::EF = t.get();
+  Random Rand(0);
+  std::unique_ptr<MutationDispatcher> MD(new MutationDispatcher(Rand, {}));
+
+  DeterministicCursor C;
+  uint8_t T[2] = {0x10, 0x20};
+  EXPECT_EQ(MD->MutateDeterministic(T, 2, &C, {}), 2U);
+  EXPECT_EQ(T[0], 0x11);
+  EXPECT_EQ(C.LastWalk, DeterministicCursor::kBitFlip);
+  EXPECT_EQ(C.LastPos, 0U);
+
+  // 16 bit flips, 2 byte flips, 2 * 32 arithmetic changes and 9 + 20 + 9
+  // interesting values, minus the two that match the existing bytes.
+  EXPECT_EQ(CountDeterministicMutations(MD.get(), {}), 118U);
+  // Byte 1 is not an effector: it still gets the flips but nothing else.
+  EXPECT_EQ(CountDeterministicMutations(MD.get(), {1, 0}), 78U);
+
+  uint8_t Word1[1] = {0xAA};
+  uint8_t Word2[3] = {0x01, 0x02, 0x03};
+  MD->AddWordToManualDictionary(Word(Word1, sizeof(Word1)));
+  MD->AddWordToManualDictionary(Word(Word2, sizeof(Word2)));
+  // Word2 does not fit anywhere.
+  EXPECT_EQ(CountDeterministicMutations(MD.get(), {1, 0}), 79U);
+}
+
 
 TEST(FuzzerDictionary, ParseOneDictionaryEntry) {
   Unit U;
@@ -691,6 +823,68 @@ TEST(Corpus, Replace) {
   EXPECT_EQ(SecondII->TimeOfUnit, std::chrono::microseconds(5678));
 }
 
+TEST(Corpus, CompressUnit) {
+  Random Rand(0);
+  std::vector<Unit> Units = {{}, {1}, Unit(12, 'a'), Unit(100000, 'b')};
+  Unit Text;
+  for (size_t i = 0; i < 1000; i++)
+    for (char C : "<tag attr=\"" + std::to_string(i % 37) + "\">")
+      Text.push_back(static_cast<uint8_t>(C));
+  Units.push_back(Text);
+  Unit Random(5000);
+  for (auto &B : Random)
+    B = static_cast<uint8_t>(Rand(256));
+  Units.push_back(Random);
+  for (auto &U : Units) {
+    Unit C, D;
+    CompressUnit(U.data(), U.size(), &C);
+    EXPECT_TRUE(DecompressUnit(C.data(), C.size(), U.size(), &D));
+    EXPECT_EQ(U, D);
+    if (U.size() >= 1000 && U != Random) {
+      EXPECT_LT(C.size() * 5, U.size());
+    }
+    // A wrong size or a damaged block are detected.
+    EXPECT_FALSE(DecompressUnit(C.data(), C.size(), U.size() + 1, &D));
+    if (C.size() > 1) {
+      EXPECT_FALSE(DecompressUnit(C.data(), C.size() - 1, U.size(), &D));
+    }
+  }
+}
+
+TEST(Corpus, Compression) {
+  DataFlowTrace DFT;
+  Random Rand(0);
+  struct EntropicOptions Entropic = {false, 0xFF, 100, false};
+  std::unique_ptr<InputCorpus> C(new InputCorpus("", Entropic));
+  C->EnableCompression(2);
+  const size_t N = 10;
+  for (size_t i = 0; i < N; i++) {
+    Unit U(1000, static_cast<uint8_t>(i));
+    C->AddToCorpus(U, /*NumFeatures*/ 1, /*MayDeleteFile*/ false,
+                   /*HasFocusFunction*/ false, /*ForceAddToCorpus*/ false,
+                   /*TimeOfUnit*/ std::chrono::microseconds(0),
+                   /*FeatureSet*/ {}, DFT, /*BaseII*/ nullptr);
+  }
+  C->AddToCorpus(Unit{1, 2, 3}, /*NumFeatures*/ 1, /*MayDeleteFile*/ false,
+                 /*HasFocusFunction*/ false, /*ForceAddToCorpus*/ false,
+                 /*TimeOfUnit*/ std::chrono::microseconds(0),
+                 /*FeatureSet*/ {}, DFT, /*BaseII*/ nullptr);
+  EXPECT_EQ(C->SizeInMemory(), N * 1000 + 3);
+  C->CompressColdUnits();
+  // The two most recent inputs and the small one stay uncompressed.
+  EXPECT_LT(C->SizeInMemory(), 2 * 1000 + 3 + N * 100);
+  EXPECT_EQ(C->SizeInBytes(), N * 1000 + 3);
+  EXPECT_EQ(C->NumActiveUnits(), N + 1);
+  EXPECT_EQ(C->MaxInputSize(), 1000U);
+  for (size_t i = 0; i < 100; i++) {
+    auto &II = C->ChooseUnitToMutate(Rand);
+    if (II.U.size() == 3)
+      continue;
+    EXPECT_EQ(II.U, Unit(1000, II.U[0]));
+    EXPECT_LE(C->SizeInMemory(), 3 * 1000 + 3 + N * 100);
+  }
+}
+
 template <typename T>
 void EQ(const std::vector<T> &A, const std::vector<T> &B) {
   EXPECT_EQ(A, B);
@@ -715,6 +909,395 @@ void EQ(const std::vector<MergeFileInfo> &A,
     EQ(A, __VA_ARGS__);                                                        \
   }
 
+TEST(Corpus, PackedFormat) {
+  Unit Pack;
+  AppendPackedCorpusHeader(&Pack);
+  size_t HeaderSize = PackedCorpusHeaderSize(Pack.data(), Pack.size());
+  EXPECT_EQ(HeaderSize, Pack.size());
+  size_t Offsets[3];
+  Unit Units[3] = {{1, 2, 3}, {}, Unit(300, 'x')};
+  for (size_t i = 0; i < 3; i++) {
+    Offsets[i] = Pack.size();
+    AppendPackedUnitRecord(Units[i], &Pack);
+  }
+  PackedUnitRecord R;
+  Unit U;
+  size_t Offset = HeaderSize;
+  for (size_t i = 0; i < 3; i++, Offset = R.End) {
+    ASSERT_TRUE(ParsePackedUnitRecord(Pack.data(), Pack.size(), Offset, &R));
+    EXPECT_EQ(R.Offset, Offsets[i]);
+    EXPECT_EQ(R.UnitSize, Units[i].size());
+    EXPECT_TRUE(DecodePackedUnit(R, &U));
+    EXPECT_EQ(U, Units[i]);
+  }
+  EXPECT_EQ(Offset, Pack.size());
+  EXPECT_FALSE(ParsePackedUnitRecord(Pack.data(), Pack.size(), Offset, &R));
+
+  // A truncated last record is not parsed.
+  EXPECT_FALSE(
+      ParsePackedUnitRecord(Pack.data(), Pack.size() - 1, Offsets[2], &R));
+
+  // A damaged unit fails the checksum.
+  Pack.back() = 'y';
+  ASSERT_TRUE(ParsePackedUnitRecord(Pack.data(), Pack.size(), Offsets[2], &R));
+  EXPECT_FALSE(DecodePackedUnit(R, &U));
+
+  Pack[0] = 'x';
+  EXPECT_EQ(PackedCorpusHeaderSize(Pack.data(), Pack.size()), 0U);
+
+  std::string Path;
+  EXPECT_TRUE(ParsePackedUnitPath(PackedUnitPath("a#b", 42), &Path, &Offset));
+  EXPECT_EQ(Path, "a#b");
+  EXPECT_EQ(Offset, 42U);
+  EXPECT_FALSE(ParsePackedUnitPath("a#", &Path, &Offset));
+  EXPECT_FALSE(ParsePackedUnitPath("a#1x", &Path, &Offset));
+  EXPECT_FALSE(ParsePackedUnitPath("a", &Path, &Offset));
+}
+
+TEST(Corpus, PackedFile) {
+  std::string Pack = TempPath("PackedFile", ".pack");
+  RemoveFile(Pack);
+  EXPECT_FALSE(IsPackedCorpus(Pack));
+  auto Paths =
+      AppendToPackedCorpus(std::vector<Unit>{{1, 2}, {3}, {1, 2}}, Pack);
+  ASSERT_EQ(Paths.size(), 3U);
+  EXPECT_EQ(Paths[0], Paths[2]);
+  EXPECT_TRUE(IsPackedCorpus(Pack));
+  // Units that are in the pack already are not appended again.
+  size_t Size = FileSize(Pack);
+  EXPECT_EQ(AppendToPackedCorpus(Unit({3}), Pack), Paths[1]);
+  EXPECT_EQ(FileSize(Pack), Size);
+  std::string Path = AppendToPackedCorpus(Unit({4, 5, 6}), Pack);
+
+  std::vector<SizedFile> Files;
+  GetSizedFilesFromDir(Pack, &Files);
+  ASSERT_EQ(Files.size(), 3U);
+  EXPECT_EQ(Files[2].File, Path);
+  EXPECT_EQ(Files[2].Size, 3U);
+  EXPECT_EQ(FileSize(Path), 3U);
+  EXPECT_EQ(FileToVector(Path), Unit({4, 5, 6}));
+  EXPECT_EQ(FileToVector(Path, 2), Unit({4, 5}));
+
+  // The epoch of a pack is the offset of the records not read yet.
+  std::vector<Unit> V;
+  long Epoch = 0;
+  ReadDirToVectorOfUnits(Pack.c_str(), &V, &Epoch, 0, false);
+  EXPECT_EQ(V.size(), 3U);
+  EXPECT_EQ(Epoch, static_cast<long>(FileSize(Pack)));
+  AppendToPackedCorpus(Unit({7}), Pack);
+  V.clear();
+  ReadDirToVectorOfUnits(Pack.c_str(), &V, &Epoch, 0, false);
+  ASSERT_EQ(V.size(), 1U);
+  EXPECT_EQ(V[0], Unit({7}));
+  RemoveFile(Pack);
+
+  // Nothing is appended to a file that is not a pack.
+  auto NotAPack = TempPath("PackedFile", ".notapack");
+  WriteToFile(Unit({1, 2, 3}), NotAPack);
+  EXPECT_EQ(AppendToPackedCorpus(Unit({4}), NotAPack), "");
+  EXPECT_EQ(FileToVector(NotAPack), Unit({1, 2, 3}));
+  RemoveFile(NotAPack);
+}
+
+TEST(Corpus, FilePrefetcher) {
+  std::string Pack = TempPath("FilePrefetcher", ".pack");
+  RemoveFile(Pack);
+  std::vector<Unit> Units;
+  for (uint8_t i = 1; i <= 100; i++)
+    Units.push_back(Unit(i, i));
+  AppendToPackedCorpus(Units, Pack);
+  std::vector<SizedFile> Files;
+  GetSizedFilesFromDir(Pack, &Files);
+  ASSERT_EQ(Files.size(), Units.size());
+  for (size_t Threads : {0, 1, 3}) {
+    // Small limits, the readers have to wait for the units to be taken.
+    FilePrefetcher P(Files, 50, Threads, /*MaxBytesAhead=*/100,
+                     /*MaxFilesAhead=*/4);
+    for (size_t i = 0; i < Files.size(); i++) {
+      Unit U = Units[i];
+      U.resize(std::min(U.size(), size_t(50)));
+      EXPECT_EQ(P.Take(i), U);
+    }
+  }
+  // Destroyed before all files are taken.
+  { FilePrefetcher P(Files, 0, 2); EXPECT_EQ(P.Take(0), Units[0]); }
+  RemoveFile(Pack);
+}
+
+#if LIBFUZZER_LINUX
+TEST(Corpus, DirWatcher) {
+  std::string Dir = TempPath("DirWatcher", ".dir");
+  RmDirRecursive(Dir);
+  MkDir(Dir);
+  WriteToFile(Unit({1}), DirPlusFile(Dir, "old"));
+  ASSERT_TRUE(StartDirWatcher(Dir));
+  EXPECT_FALSE(StartDirWatcher(Dir));  // One dir per process.
+  std::string Sub = DirPlusFile(Dir, "sub");
+  WriteToFile(Unit({2}), DirPlusFile(Dir, "new"));
+  MkDir(Sub);
+  WriteToFile(Unit({3}), DirPlusFile(Sub, "new"));
+  std::set<std::string> Files;
+  for (int i = 0; i < 100 && Files.size() < 2; i++) {
+    std::vector<std::string> V;
+    EXPECT_TRUE(TakeNewFilesFromDirWatcher(&V));
+    Files.insert(V.begin(), V.end());
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(Files, std::set<std::string>({DirPlusFile(Dir, "new"),
+                                          DirPlusFile(Sub, "new")}));
+  RmDirRecursive(Dir);
+}
+#endif  // LIBFUZZER_LINUX
+
+TEST(Corpus, AsyncWriter) {
+  std::string Dir = TempPath("AsyncWriter", ".dir");
+  RmDirRecursive(Dir);
+  MkDir(Dir);
+  auto A = DirPlusFile(Dir, "a"), B = DirPlusFile(Dir, "b"),
+       Log = DirPlusFile(Dir, "log"), Pack = DirPlusFile(Dir, "pack");
+  // Leaked, the writer thread never stops.
+  AsyncWriter *W = new AsyncWriter;
+  // Not started: the requests are done right away.
+  W->WriteToFile({1}, A);
+  EXPECT_EQ(FileToVector(A), Unit({1}));
+  W->Start(/*MaxQueuedBytes=*/4, AsyncWriter::kSyncFiles);
+  for (uint8_t i = 0; i < 100; i++) {
+    W->WriteToFile({i}, A);
+    W->AppendToFile(std::string(1, 'a' + i % 26), Log);
+    W->AppendToPackedCorpus({i, i}, Pack);
+  }
+  W->RenameFile(A, B);
+  W->WriteToFile({7}, A);
+  W->RemoveFile(A);
+  W->Flush();
+  EXPECT_FALSE(IsFile(A));
+  EXPECT_EQ(FileToVector(B), Unit({99}));
+  std::string Expected;
+  for (int i = 0; i < 100; i++)
+    Expected += static_cast<char>('a' + i % 26);
+  EXPECT_EQ(FileToString(Log), Expected);
+  std::vector<SizedFile> Files;
+  GetSizedFilesFromDir(Pack, &Files);
+  EXPECT_EQ(Files.size(), 100U);
+  EXPECT_GT(W->NumBatches(), 0U);
+  // A failed append does not stop the writer.
+  auto NotAPack = DirPlusFile(Dir, "not_a_pack");
+  fuzzer::WriteToFile(Unit({1, 2, 3}), NotAPack);
+  W->AppendToPackedCorpus({1}, NotAPack);
+  W->WriteToFile({8}, B);
+  W->Flush();
+  EXPECT_EQ(FileToVector(NotAPack), Unit({1, 2, 3}));
+  EXPECT_EQ(FileToVector(B), Unit({8}));
+  RmDirRecursive(Dir);
+}
+
+TEST(Corpus, SyncFrames) {
+  Unit Wire, Payload;
+  AppendSyncSeed(Unit({'a', 'b'}).data(), 2, {3, 200, 70000}, &Payload);
+  AppendSyncFrame(kSyncSeed, Payload, &Wire);
+  AppendSyncFrame(kSyncHello, {}, &Wire);
+  uint8_t Type;
+  const uint8_t *P;
+  size_t Size;
+  // Incomplete frames.
+  EXPECT_EQ(ParseSyncFrame(Wire.data(), 4, &Type, &P, &Size), 0U);
+  EXPECT_EQ(ParseSyncFrame(Wire.data(), Payload.size() + 4, &Type, &P, &Size),
+            0U);
+  EXPECT_EQ(Size, Payload.size());
+  size_t N = ParseSyncFrame(Wire.data(), Wire.size(), &Type, &P, &Size);
+  EXPECT_EQ(N, Payload.size() + 5);
+  EXPECT_EQ(Type, kSyncSeed);
+  SyncSeed S;
+  ASSERT_TRUE(ParseSyncSeed(P, Size, &S));
+  EXPECT_EQ(S.U, Unit({'a', 'b'}));
+  EXPECT_EQ(S.Features, std::vector<uint32_t>({3, 200, 70000}));
+  EXPECT_EQ(ParseSyncFrame(Wire.data() + N, Wire.size() - N, &Type, &P, &Size),
+            5U);
+  EXPECT_EQ(Type, kSyncHello);
+  EXPECT_EQ(Size, 0U);
+  // More features than bytes.
+  EXPECT_FALSE(ParseSyncSeed(Unit({5, 1}).data(), 2, &S));
+}
+
+#if LIBFUZZER_LINUX
+TEST(Corpus, SyncAgent) {
+  std::string Path = TempPath("SyncAgent", ".sock");
+  RemoveFile(Path);
+  sockaddr_un Addr = {};
+  Addr.sun_family = AF_UNIX;
+  ASSERT_LT(Path.size(), sizeof(Addr.sun_path));
+  strcpy(Addr.sun_path, Path.c_str());
+  int L = socket(AF_UNIX, SOCK_STREAM, 0);
+  ASSERT_EQ(bind(L, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)), 0);
+  ASSERT_EQ(listen(L, 1), 0);
+  // Leaked, the threads of the agent never stop.
+  SyncAgent *A = new SyncAgent;
+  A->Start(Path, 1 << 20);
+  int Fd = accept(L, nullptr, nullptr);
+  ASSERT_GE(Fd, 0);
+  uint8_t Sha1[kSHA1NumBytes] = {1, 2, 3};
+  A->PutSeed({'x', 'y'}, Sha1, {10, 20});
+  // Read the hello and the seed.
+  Unit Buf;
+  std::vector<std::pair<uint8_t, Unit>> Frames;
+  while (Frames.size() < 2) {
+    uint8_t Chunk[256];
+    ssize_t N = read(Fd, Chunk, sizeof(Chunk));
+    ASSERT_GT(N, 0);
+    Buf.insert(Buf.end(), Chunk, Chunk + N);
+    uint8_t Type;
+    const uint8_t *P;
+    size_t Size, FrameSize;
+    while ((FrameSize = ParseSyncFrame(Buf.data(), Buf.size(), &Type, &P,
+                                       &Size))) {
+      Frames.push_back({Type, Unit(P, P + Size)});
+      Buf.erase(Buf.begin(), Buf.begin() + FrameSize);
+    }
+  }
+  EXPECT_EQ(Frames[0].first, kSyncHello);
+  EXPECT_EQ(Frames[0].second[0], kSyncProtocolVersion);
+  EXPECT_EQ(Frames[1].first, kSyncPutSeed);
+  Unit &Put = Frames[1].second;
+  ASSERT_GT(Put.size(), kSHA1NumBytes);
+  EXPECT_TRUE(std::equal(Sha1, Sha1 + kSHA1NumBytes, Put.begin()));
+  SyncSeed S;
+  ASSERT_TRUE(ParseSyncSeed(Put.data() + kSHA1NumBytes,
+                            Put.size() - kSHA1NumBytes, &S));
+  EXPECT_EQ(S.U, Unit({'x', 'y'}));
+  EXPECT_EQ(S.Features, std::vector<uint32_t>({10, 20}));
+  // A seed from the peer.
+  Unit Payload, Frame;
+  AppendSyncSeed(Unit({'z'}).data(), 1, {}, &Payload);
+  AppendSyncFrame(kSyncSeed, Payload, &Frame);
+  ASSERT_EQ(write(Fd, Frame.data(), Frame.size()),
+            static_cast<ssize_t>(Frame.size()));
+  for (int i = 0; i < 500 && !A->HasSeeds(); i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  std::vector<SyncSeed> Seeds;
+  A->TakeSeeds(&Seeds);
+  ASSERT_EQ(Seeds.size(), 1U);
+  EXPECT_EQ(Seeds[0].U, Unit({'z'}));
+  EXPECT_FALSE(A->HasSeeds());
+  EXPECT_EQ(A->NumReceived(), 1U);
+  // Counted once send() returns, which may be after the read above.
+  for (int i = 0; i < 500 && !A->NumSent(); i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(A->NumSent(), 1U);
+  close(Fd);
+  close(L);
+  RemoveFile(Path);
+}
+#endif  // LIBFUZZER_LINUX
+
+TEST(Corpus, CoverageDelta) {
+  Random Rand(0);
+  std::set<uint32_t> S;
+  // Sparse features, dense runs and a dense random chunk: all containers.
+  for (int i = 0; i < 1000; i++)
+    S.insert(Rand(1 << 21));
+  for (uint32_t F = 5 << 16; F < (5 << 16) + 3000; F++)
+    S.insert(F);
+  for (int i = 0; i < 30000; i++)
+    S.insert((9 << 16) | Rand(1 << 16));
+  S.insert(0);
+  S.insert(UINT32_MAX);
+  std::vector<uint32_t> Features(S.begin(), S.end());
+  for (auto &V : {std::vector<uint32_t>(), std::vector<uint32_t>({0}),
+                  Features}) {
+    Unit Enc;
+    EncodeCoverageDelta(V, &Enc);
+    std::vector<uint32_t> Dec;
+    ASSERT_TRUE(DecodeCoverageDelta(Enc.data(), Enc.size(), &Dec));
+    EXPECT_EQ(Dec, V);
+    // Truncated.
+    if (!V.empty()) {
+      EXPECT_FALSE(DecodeCoverageDelta(Enc.data(), Enc.size() - 1, &Dec));
+    }
+  }
+  Unit Enc;
+  EncodeCoverageDelta(Features, &Enc);
+  // The runs and the dense chunk cost about one bit per feature.
+  EXPECT_LT(Enc.size(), 1000 * 4 + 8192 + 100U);
+  // Broken: a run past the end of its chunk.
+  Unit Bad = {1, 0, kCoverageRuns, 0, 1, 0xFF, 0xFF, 0x03, 1};
+  std::vector<uint32_t> Dec;
+  EXPECT_FALSE(DecodeCoverageDelta(Bad.data(), Bad.size(), &Dec));
+}
+
+TEST(Corpus, CoverageEpochs) {
+  struct EntropicOptions Entropic = {false, 0xFF, 100, false};
+  std::unique_ptr<InputCorpus> C(new InputCorpus("", Entropic));
+  EXPECT_EQ(C->CoverageEpoch(), 0U);
+  C->AddFeature(30, 5, false);
+  C->AddFeature(10, 5, false);
+  size_t Epoch = C->CoverageEpoch();
+  EXPECT_EQ(Epoch, 2U);
+  EXPECT_FALSE(C->AddFeature(10, 3, false));  // Not a new feature.
+  C->AddFeature(20, 5, false);
+  C->AddFeature(5, 5, false);
+  std::vector<uint32_t> V;
+  C->FeaturesSinceEpoch(0, &V);
+  EXPECT_EQ(V, std::vector<uint32_t>({5, 10, 20, 30}));
+  C->FeaturesSinceEpoch(Epoch, &V);
+  EXPECT_EQ(V, std::vector<uint32_t>({5, 20}));
+  C->FeaturesSinceEpoch(C->CoverageEpoch(), &V);
+  EXPECT_TRUE(V.empty());
+  EXPECT_TRUE(C->HasFeature(20));
+  EXPECT_FALSE(C->HasFeature(21));
+}
+
+TEST(Fuzzer, LengthController) {
+  const size_t N = LengthController::kExecsPerDecision;
+  // Long inputs find as much per second as the short ones: grow.
+  LengthController LC;
+  for (size_t i = 0; i < N; i++) {
+    LC.Record(10, 10, i % 100 == 0);
+    LC.Record(60, 10, i % 100 == 0);
+  }
+  EXPECT_EQ(LC.Update(64, 1000), 128U);
+  EXPECT_EQ(LC.LastDecision(), LengthController::kGrow);
+  // Nothing to decide until enough executions are recorded.
+  EXPECT_EQ(LC.Update(128, 1000), 128U);
+  // Never beyond max_len.
+  for (size_t i = 0; i < N; i++)
+    LC.Record(100, 10, i % 100 == 0);
+  EXPECT_EQ(LC.Update(128, 100), 100U);
+
+  // Long inputs are slow and find nothing: shrink.
+  LengthController LC2;
+  for (size_t i = 0; i < N; i++) {
+    LC2.Record(10, 10, i % 100 == 0);
+    LC2.Record(60, 1000, 0);
+  }
+  EXPECT_EQ(LC2.Update(64, 1000), 32U);
+  EXPECT_EQ(LC2.LastDecision(), LengthController::kShrink);
+  EXPECT_GT(LC2.ShortYield(), LC2.LongYield());
+
+  // Long inputs are a bit worse, but still worth running: keep.
+  LengthController LC3;
+  for (size_t i = 0; i < N; i++) {
+    LC3.Record(10, 10, i % 100 == 0);
+    LC3.Record(60, 40, i % 100 == 0);
+  }
+  EXPECT_EQ(LC3.Update(64, 1000), 64U);
+  EXPECT_EQ(LC3.LastDecision(), LengthController::kKeep);
+
+  // No new features at all: explore longer inputs.
+  LengthController LC4;
+  for (size_t i = 0; i < N; i++)
+    LC4.Record(10, 10, 0);
+  EXPECT_EQ(LC4.Update(64, 1000), 128U);
+
+  // The mutants as long as the limit are long ones.
+  LengthController LC5;
+  for (size_t i = 0; i < N; i++) {
+    LC5.Record(10, 10, i % 100 == 0);
+    LC5.Record(64, 10, i % 100 == 0);
+  }
+  EXPECT_EQ(LC5.Update(64, 1000), 128U);
+  EXPECT_GT(LC5.LongYield(), 0);
+}
+
 TEST(Merger, Parse) {
   Merger M;
 
@@ -823,6 +1406,221 @@ TEST(Merger, Parse) {
   TRACED_EQ(M.Files[2].Cov, {16});
 }
 
+TEST(Merger, ParseBinary) {
+  Merger M;
+  auto ToString = [](const Unit &U) { return std::string(U.begin(), U.end()); };
+  Unit CF;
+  AppendMergeControlFileHeader({"AA", "BB", "C"}, 2, &CF);
+
+  // Parse initial control file
+  EXPECT_TRUE(M.Parse(ToString(CF), false));
+  EXPECT_TRUE(M.IsBinary);
+  ASSERT_EQ(M.Files.size(), 3U);
+  EXPECT_EQ(M.NumFilesInFirstCorpus, 2U);
+  EXPECT_EQ(M.Files[2].Name, "C");
+  EXPECT_EQ(M.FirstNotProcessedFile, 0U);
+
+  // Parse features and PCs, and a failure on the last input.
+  AppendMergeStartedRecord(0, 1000, &CF);
+  AppendMergeValuesRecord(kMergeRecordFeatures, 0, {1, 2, 300000}, &CF);
+  AppendMergeValuesRecord(kMergeRecordCoverage, 0, {11, 12, 13}, &CF);
+  AppendMergeStartedRecord(1, 1001, &CF);
+  AppendMergeValuesRecord(kMergeRecordFeatures, 1, {}, &CF);
+  AppendMergeValuesRecord(kMergeRecordCoverage, 1, {7, 12}, &CF);
+  AppendMergeStartedRecord(2, 1002, &CF);
+  EXPECT_TRUE(M.Parse(ToString(CF), true));
+  EXPECT_EQ(M.LastFailure, "C");
+  EXPECT_EQ(M.FirstNotProcessedFile, 3U);
+  EXPECT_EQ(M.Files[1].Size, 1001U);
+  TRACED_EQ(M.Files[0].Features, {1, 2, 300000});
+  TRACED_EQ(M.Files[0].Cov, {11, 12, 13});
+  EXPECT_TRUE(M.Files[1].Features.empty());
+  TRACED_EQ(M.Files[1].Cov, {7});
+
+  // A record cut short by a crash is ignored.
+  Unit Complete = CF;
+  AppendMergeValuesRecord(kMergeRecordFeatures, 2, {5, 6}, &CF);
+  for (size_t Size = Complete.size(); Size < CF.size(); Size++) {
+    EXPECT_TRUE(M.Parse(ToString(Unit(CF.begin(), CF.begin() + Size)), true));
+    EXPECT_EQ(M.LastFailure, "C");
+  }
+  EXPECT_TRUE(M.Parse(ToString(CF), true));
+  EXPECT_TRUE(M.LastFailure.empty());
+  TRACED_EQ(M.Files[2].Features, {5, 6});
+
+  // Bad file IDs, unknown markers, a truncated header, an unknown version.
+  Unit Bad = Complete;
+  AppendMergeValuesRecord(kMergeRecordFeatures, 1, {5, 6}, &Bad);
+  EXPECT_FALSE(M.Parse(ToString(Bad), true));
+  Bad = Complete;
+  AppendMergeStartedRecord(3, 1, &Bad);
+  EXPECT_FALSE(M.Parse(ToString(Bad), true));
+  Bad = Complete;
+  Bad.push_back('X');
+  AppendVarint(2, &Bad);
+  AppendVarint(0, &Bad);
+  EXPECT_FALSE(M.Parse(ToString(Bad), true));
+  EXPECT_FALSE(M.Parse(ToString(Unit(Complete.begin(), Complete.begin() + 9)),
+                       false));
+  Bad = Complete;
+  Bad[kMergeControlFileMagicSize] = kMergeControlFileVersion + 1;
+  EXPECT_FALSE(M.Parse(ToString(Bad), false));
+
+  // Text control files are still parsed.
+  EXPECT_TRUE(M.Parse("1\n0\nAA\n", false));
+  EXPECT_FALSE(M.IsBinary);
+}
+
+TEST(Merger, FeatureBitSet) {
+  FeatureBitSet S;
+  EXPECT_EQ(S.size(), 0U);
+  EXPECT_FALSE(S.contains(0));
+  EXPECT_FALSE(S.contains(UINT32_MAX));
+  const std::vector<uint32_t> Features = {0, 63, 64, 65535, 65536, 1 << 21,
+                                          UINT32_MAX};
+  for (auto F : Features)
+    EXPECT_TRUE(S.insert(F));
+  for (auto F : Features) {
+    EXPECT_FALSE(S.insert(F));
+    EXPECT_TRUE(S.contains(F));
+  }
+  EXPECT_FALSE(S.contains(1));
+  EXPECT_FALSE(S.contains(65537));
+  EXPECT_EQ(S.size(), Features.size());
+  std::vector<uint32_t> Sorted;
+  S.ForEach([&](uint32_t F) { Sorted.push_back(F); });
+  EXPECT_EQ(Sorted, Features);
+}
+
+TEST(Fork, JobTuner) {
+  ForkJobTuner T;
+  // Without results: the usual ramp up and sqrt(corpus size) seeds.
+  EXPECT_EQ(T.JobTime(5), 5U);
+  EXPECT_EQ(T.JobTime(1000), ForkJobTuner::kMaxJobTime);
+  EXPECT_EQ(T.NumSeeds(100, 10), 10U);
+  EXPECT_EQ(T.NumSeeds(0, 10), 0U);
+  EXPECT_EQ(T.NumSeeds(10000, 240), 200U);  // Long jobs: more seeds.
+  EXPECT_EQ(T.NumCorpusGroups(100, 10), 12U);
+  EXPECT_EQ(T.NumCorpusGroups(6000, 77), 25U);
+  EXPECT_EQ(T.NumCorpusGroups(1000000, 1000), 80U);
+
+  ForkJobTuner::JobResult R;
+  R.TimeBudget = 10;
+  R.WallTime = 10.1;
+  R.InitTime = 0.1;
+  R.NumSeeds = 10;
+  R.NumNewFeatures = 5;
+  T.AddJobResult(R);
+  EXPECT_EQ(T.JobTime(1000), 8U);  // Shorter while finding new features.
+  R.NumNewFeatures = 0;
+  T.AddJobResult(R);
+  T.AddJobResult(R);
+  EXPECT_EQ(T.JobTime(1000), 13U);  // Longer when not.
+
+  // Jobs that spend seconds to start run long enough, with fewer seeds.
+  ForkJobTuner Slow;
+  R.WallTime = 10;
+  R.InitTime = 5;
+  R.NumNewFeatures = 5;
+  Slow.AddJobResult(R);
+  EXPECT_EQ(Slow.JobTime(1000), 50U);
+  EXPECT_EQ(Slow.NumSeeds(10000, 50), 10U);
+}
+
+TEST(Fork, SeedSelector) {
+  Random Rand(0);
+  size_t NumWithRare = 0, NumWithProductive = 0;
+  for (int i = 0; i < 100; i++) {
+    ForkSeedSelector S;
+    for (auto Name : {"A", "B", "E"})
+      S.AddFile(Name, {1});
+    S.AddFile("C", {3});
+    // Picking two of A, B and C: after A or B, the other one adds nothing.
+    auto Seeds = S.Choose({"A", "B", "C", "A"}, 2, Rand);
+    EXPECT_EQ(Seeds.size(), 2U);
+    EXPECT_NE(Seeds[0], Seeds[1]);
+    NumWithRare += std::count(Seeds.begin(), Seeds.end(), "C");
+    // The seeds of productive jobs are chosen more often.
+    S.AddJobResult({"A"}, 10);
+    NumWithProductive += S.Choose({"A", "B"}, 1, Rand)[0] == "A";
+  }
+  EXPECT_GT(NumWithRare, 90U);
+  EXPECT_GT(NumWithProductive, 75U);
+  // Once A, B and E are gone, feature 1 is as rare as feature 3.
+  size_t NumWithD = 0;
+  for (int i = 0; i < 100; i++) {
+    ForkSeedSelector S;
+    for (auto Name : {"A", "B", "E"})
+      S.AddFile(Name, {1});
+    S.AddFile("C", {3});
+    S.KeepFiles({"C"});
+    S.AddFile("D", {1});
+    NumWithD += S.Choose({"C", "D"}, 1, Rand)[0] == "D";
+  }
+  EXPECT_GT(NumWithD, 30U);
+  ForkSeedSelector Empty;
+  EXPECT_EQ(Empty.Choose({"X", "Y", "X"}, 5, Rand).size(), 2U);
+}
+
+TEST(Fork, JobDeques) {
+  FuzzJobDeques Q(2);
+  std::vector<FuzzJob *> Jobs;
+  for (size_t i = 0; i < 4; i++) {
+    Jobs.push_back(new FuzzJob);
+    Jobs.back()->JobId = i;
+  }
+  // The jobs go round robin: worker 0 has jobs 0 and 2, worker 1 job 1.
+  for (size_t i = 0; i < 3; i++)
+    Q.Push(Jobs[i]);
+  EXPECT_EQ(Q.Pop(1), Jobs[1]);
+  // Worker 1 runs dry and steals the newest job of worker 0.
+  EXPECT_EQ(Q.Pop(1), Jobs[2]);
+  EXPECT_EQ(Q.NumSteals(), 1U);
+  EXPECT_EQ(Q.Pop(0), Jobs[0]);
+  EXPECT_EQ(Q.NumSteals(), 1U);
+  for (size_t i = 0; i < 3; i++)
+    delete Jobs[i];
+
+  // Stop wakes up the waiting workers.
+  bool Returned = false;
+  std::thread Waiter([&] { Returned = !Q.Pop(0); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  Q.Stop();
+  Waiter.join();
+  EXPECT_TRUE(Returned);
+
+  // And deletes the jobs that were not taken.
+  FuzzJobDeques Left(1);
+  Left.Push(Jobs[3]);
+  Left.Stop();
+  EXPECT_EQ(Left.Pop(0), nullptr);
+}
+
+TEST(Merger, FeatureCache) {
+  Unit Cache;
+  AppendMergeFeatureCacheHeader(&Cache);
+  uint8_t A[kSHA1NumBytes] = {1}, B[kSHA1NumBytes] = {2};
+  AppendMergeFeatureCacheRecord(A, {1, 5, 100000}, &Cache);
+  AppendMergeFeatureCacheRecord(B, {7}, &Cache);
+  AppendMergeFeatureCacheRecord(A, {2}, &Cache);  // Later records win.
+  std::unordered_map<std::string, std::vector<uint32_t>> M;
+  EXPECT_TRUE(ParseMergeFeatureCache(Cache.data(), Cache.size(), &M));
+  ASSERT_EQ(M.size(), 2U);
+  std::string KeyA(reinterpret_cast<char *>(A), kSHA1NumBytes);
+  std::string KeyB(reinterpret_cast<char *>(B), kSHA1NumBytes);
+  TRACED_EQ(M[KeyA], {2});
+  TRACED_EQ(M[KeyB], {7});
+
+  // A truncated last record is ignored.
+  M.clear();
+  EXPECT_TRUE(ParseMergeFeatureCache(Cache.data(), Cache.size() - 1, &M));
+  TRACED_EQ(M[KeyA], {1, 5, 100000});
+
+  // Not a feature cache.
+  Cache[0] = 'x';
+  EXPECT_FALSE(ParseMergeFeatureCache(Cache.data(), Cache.size(), &M));
+}
+
 TEST(Merger, Merge) {
   Merger M;
   std::set<uint32_t> Features, NewFeatures;
@@ -1164,6 +1962,128 @@ TEST(DFT, FunctionWeights) {
   EXPECT_GT(Weights[1], Weights[0]);
 }
 
+TEST(DFT, IncrementalFunctionWeights) {
+  // The weights kept up to date on every append match the ones computed from
+  // the counters.
+  Random Rand(0);
+  const size_t NumFunctions = 8;
+  BlockCoverage Cov;
+  for (size_t Iter = 0; Iter < 500; Iter++) {
+    size_t F = Rand(NumFunctions);
+    uint32_t NumBlocks = static_cast<uint32_t>(F + 2);
+    std::string L = "C" + std::to_string(F);
+    for (uint32_t BB = 1; BB < NumBlocks; BB++)
+      if (Rand(3) == 0)
+        L += " " + std::to_string(BB);
+    EXPECT_TRUE(Cov.AppendCoverage(L + " " + std::to_string(NumBlocks)));
+    if (Rand(4))
+      continue;
+    auto Weights = Cov.FunctionWeights(NumFunctions);
+    for (size_t G = 0; G < NumFunctions; G++) {
+      uint32_t Min = 0;
+      for (uint32_t BB = 0; BB < Cov.GetNumberOfBlocks(G); BB++) {
+        uint32_t Cnt = Cov.GetCounter(G, BB);
+        if (Cnt && (!Min || Cnt < Min))
+          Min = Cnt;
+      }
+      double Expected =
+          Min ? 1. / Min * (Cov.GetNumberOfBlocks(G) -
+                            Cov.GetNumberOfCoveredBlocks(G) + 1)
+              : 0;
+      EXPECT_EQ(Weights[G], Expected);
+    }
+  }
+  EXPECT_FALSE(Cov.AppendCoverage("C100000000 5\n"));
+  // Or past the number of functions, once it is known.
+  Cov.SetNumFunctions(4);
+  EXPECT_TRUE(Cov.AppendCoverage("C3 5\n"));
+  EXPECT_FALSE(Cov.AppendCoverage("C4 5\n"));
+}
+
+TEST(DFT, BinaryTraces) {
+  Unit A = {'a'}, B = {'b'}, C = {'c'};
+  std::string TraceA = "F0 0110\nF3 1000000011\nC0 1 2 5\nC3 9\n";
+  std::string TraceB = "F3 0120\nC3 4 5 9\n";
+  DataFlowTraceFileWriter W;
+  EXPECT_TRUE(W.Add(Hash(B), TraceB));
+  EXPECT_TRUE(W.Add(Hash(A), TraceA));
+  EXPECT_FALSE(W.Add("not a sha1", TraceA));
+  EXPECT_EQ(W.size(), 2U);
+
+  std::string Dir = TempPath("DFT", ".dir");
+  RmDirRecursive(Dir);
+  MkDir(Dir);
+  auto Path = DirPlusFile(Dir, "traces.dftbin");
+  Unit Bin = W.Finish();
+  WriteToFile(Bin, Path);
+  DataFlowTraceFile F;
+  ASSERT_TRUE(F.Open(Path));
+  ASSERT_EQ(F.size(), 2U);
+  size_t IdxA = F.Find(Hash(A)), IdxB = F.Find(Hash(B));
+  EXPECT_EQ(F.Sha1(IdxA), Hash(A));
+  EXPECT_EQ(F.Sha1(IdxB), Hash(B));
+  EXPECT_EQ(F.Find(Hash(C)), F.size());
+
+  std::vector<uint8_t> T;
+  EXPECT_TRUE(F.ReadTrace(IdxA, 3, &T));
+  EXPECT_EQ(T, std::vector<uint8_t>({1, 0, 0, 0, 0, 0, 0, 0, 1, 1}));
+  EXPECT_TRUE(F.ReadTrace(IdxB, 3, &T));
+  EXPECT_EQ(T, std::vector<uint8_t>({0, 1, 2, 0}));
+  EXPECT_FALSE(F.ReadTrace(IdxB, 0, &T));
+
+  // The coverage is the same as from the text traces.
+  BlockCoverage Text, Binary;
+  EXPECT_TRUE(Text.AppendCoverage(TraceA + TraceB));
+  EXPECT_TRUE(F.ReadCoverage(IdxA, &Binary));
+  EXPECT_TRUE(F.ReadCoverage(IdxB, &Binary));
+  EXPECT_EQ(Text.FunctionWeights(4), Binary.FunctionWeights(4));
+  EXPECT_EQ(Binary.GetCounter(3, 4), 1U);
+
+  // A truncated index is rejected.
+  WriteToFile(Unit(Bin.begin(), Bin.begin() + 30), Path);
+  DataFlowTraceFile Truncated;
+  EXPECT_FALSE(Truncated.Open(Path));
+
+  // So is a block out of range, as in the text traces.
+  DataFlowTraceFileWriter OutOfRange;
+  EXPECT_TRUE(OutOfRange.Add(Hash(C), "C0 7 5\n"));
+  WriteToFile(OutOfRange.Finish(), Path);
+  DataFlowTraceFile BadBlock;
+  ASSERT_TRUE(BadBlock.Open(Path));
+  BlockCoverage Bad;
+  EXPECT_FALSE(BadBlock.ReadCoverage(0, &Bad));
+  EXPECT_FALSE(Bad.AppendCoverage("C0 7 5\n"));
+
+  // DataFlowTrace decodes the traces of the focus function on demand.
+  WriteToFile(Bin, Path);
+  WriteToFile("Func0\nFunc1\nFunc2\nFunc3\n",
+              DirPlusFile(Dir, "functions.txt"));
+  std::vector<SizedFile> Corpus;
+  for (auto &U : {A, B}) {
+    Corpus.push_back({DirPlusFile(Dir, Hash(U) + ".in"), U.size()});
+    WriteToFile(U, Corpus.back().File);
+  }
+  DataFlowTrace DFT;
+  Random Rand(0);
+  std::string Focus = "Func3";
+  EXPECT_TRUE(DFT.Init(Dir, &Focus, Corpus, Rand));
+  ASSERT_NE(DFT.Get(Hash(A)), nullptr);
+  EXPECT_EQ(*DFT.Get(Hash(A)), std::vector<uint8_t>({1, 0, 0, 0, 0, 0, 0, 0,
+                                                     1, 1}));
+  EXPECT_EQ(DFT.Get(Hash(C)), nullptr);
+  // As with the text traces, only the inputs in the corpus count.
+  std::vector<SizedFile> CorpusA = {Corpus[0]};
+  DataFlowTrace OnlyA;
+  EXPECT_TRUE(OnlyA.Init(Dir, &Focus, CorpusA, Rand));
+  EXPECT_NE(OnlyA.Get(Hash(A)), nullptr);
+  EXPECT_EQ(OnlyA.Get(Hash(B)), nullptr);
+  std::vector<SizedFile> CorpusC = {{DirPlusFile(Dir, "c.in"), C.size()}};
+  WriteToFile(C, CorpusC[0].File);
+  DataFlowTrace None;
+  EXPECT_FALSE(None.Init(Dir, &Focus, CorpusC, Rand));
+  RmDirRecursive(Dir);
+}
+
 
 TEST(Fuzzer, ForEachNonZeroByte) {
   const size_t N = 64;